@@ -10,15 +10,14 @@
 #include "Lcd.h"
 #include "Memory.h"
 #include "MemoryBus.h"
+#include "MasterClock.h"
 #include "MemoryMapper.h"
 #include "Sound.h"
 #include "Timer.h"
 
+#include "GuestProfile.h"
 #include "TraceLog.h"
 
-#include <map>
-#include <unordered_map>
-
 // Some ideas about disassembly:
 // -perform code flow analysis to track function entry and return points
 // -perform data flow analysis to identify function input parameters, function output parameters (analyze use of registers after function return; beware of interrupt calls)
@@ -28,308 +27,110 @@
 // -user-assigned memory cell names
 // -user-assigned function names or generated "best guess" names based on function behaviour
 
-#define ENUMERATE_DEVICES() \
-	ENUMERATE_DEVICE(Timer, DIV) \
-	ENUMERATE_DEVICE(Timer, TIMA) \
-	ENUMERATE_DEVICE(Timer, TMA) \
-	ENUMERATE_DEVICE(Timer, TAC) \
-	ENUMERATE_DEVICE(Joypad, P1_JOYP) \
-	ENUMERATE_DEVICE(GameLinkPort, SB) \
-	ENUMERATE_DEVICE(GameLinkPort, SC) \
-	ENUMERATE_DEVICE(Lcd, LCDC) \
-	ENUMERATE_DEVICE(Lcd, STAT) \
-	ENUMERATE_DEVICE(Lcd, SCY) \
-	ENUMERATE_DEVICE(Lcd, SCX) \
-	ENUMERATE_DEVICE(Lcd, LY) \
-	ENUMERATE_DEVICE(Lcd, LYC) \
-	ENUMERATE_DEVICE(Lcd, DMA) \
-	ENUMERATE_DEVICE(Lcd, BGP) \
-	ENUMERATE_DEVICE(Lcd, OBP0) \
-	ENUMERATE_DEVICE(Lcd, OBP1) \
-	ENUMERATE_DEVICE(Lcd, WY) \
-	ENUMERATE_DEVICE(Lcd, WX) \
-	ENUMERATE_DEVICE(Sound, NR10) \
-	ENUMERATE_DEVICE(Sound, NR11) \
-	ENUMERATE_DEVICE(Sound, NR12) \
-	ENUMERATE_DEVICE(Sound, NR13) \
-	ENUMERATE_DEVICE(Sound, NR14) \
-	ENUMERATE_DEVICE(Sound, NR21) \
-	ENUMERATE_DEVICE(Sound, NR22) \
-	ENUMERATE_DEVICE(Sound, NR23) \
-	ENUMERATE_DEVICE(Sound, NR24) \
-	ENUMERATE_DEVICE(Sound, NR30) \
-	ENUMERATE_DEVICE(Sound, NR31) \
-	ENUMERATE_DEVICE(Sound, NR32) \
-	ENUMERATE_DEVICE(Sound, NR33) \
-	ENUMERATE_DEVICE(Sound, NR34) \
-	ENUMERATE_DEVICE(Sound, NR41) \
-	ENUMERATE_DEVICE(Sound, NR42) \
-	ENUMERATE_DEVICE(Sound, NR43) \
-	ENUMERATE_DEVICE(Sound, NR44) \
-	ENUMERATE_DEVICE(Sound, NR50) \
-	ENUMERATE_DEVICE(Sound, NR51) \
-	ENUMERATE_DEVICE(Sound, NR52)
-
-//namespace
-//{
-//	auto OperandFormatFuncDummy = [](const std::string& operand, const Analyzer& analyzer, const Cpu& cpu, std::string& annotation, std::string& comment) {};
-//	using OperandFormatFunc = decltype(OperandFormatFuncDummy);
-//	static std::unordered_map<std::string, OperandFormatFunc> s_operandFormatters;
-//	//static std::unordered_map<std::string, decltype([](const std::string& operand, const Cpu& cpu) {})> s_operandFormatters;
-//
-//	struct Initializer
-//	{
-//		Initializer()
-//		{
-//			s_operandFormatters["n"] = [](const std::string& operand, const Analyzer& analyzer, const Cpu& cpu, std::string& annotation, std::string& comment) { analyzer.m_pCpu; };
-//			// Figure this out. Either:
-//			// -use member functions on the Analyzer
-//			// -use non-member lambdas and add accessors on the Analyzer for its state
-//
-//			// If the operand is indirect and the address is invalid, this needs to be apparent
-//			// If the operand is an immediate address, we can annotate it directly and move the immediate to the comment
-//			// IF the operand is a register indirect address, leave it as is but annotate in the comment if possible
-//		}
-//	};
-//	Initializer g_initializer;
-//}
-
-Analyzer::Analyzer(MemoryMapper* pMemoryMapper, Cpu* pCpu, MemoryBus* pMemory)
-{
-	m_operandFormatters["n"] = &Analyzer::Annotate_n;
-	m_operandFormatters["nn"] = &Analyzer::Annotate_nn;
-	m_operandFormatters["(nn)"] = &Analyzer::Annotate_ind_nn;
-
+Analyzer::Analyzer(MemoryMapper* pMemoryMapper, Cpu* pCpu, MemoryBus* pMemory, const MasterClock* pClock)
+{
 	m_pMemoryMapper = pMemoryMapper;
 	m_pCpu = pCpu;
 	m_pMemory = pMemory;
+	m_pClock = pClock;
+	m_tracingEnabled = false;
+	m_profileClockCycle = m_pClock->GetCycles();
+	m_profileCpuInstruction = m_pCpu->GetTotalExecutedOpcodes();
 	EnsureGlobalFunctionIsOnStack();
 }
 
-std::string Format8(Uint8 value)
-{
-	return Format("%02lXh", value);
-}
-
-std::string Format16(Uint16 value)
+bool Analyzer::IsTracingAt(Uint16 unmappedAddress)
 {
-	return Format("%04lXh", value);
+	// Cheapest tests first, as this is done for every instruction
+	return m_tracingEnabled
+		&& (!m_traceFilter.HasFunction() || (m_traceFunctionDepth > 0))
+		&& (!m_traceFilter.HasAddressRanges() || m_traceFilter.IsAddressTraced(m_pMemoryMapper->GetActiveBank(), unmappedAddress));
 }
 
-std::string Format8(Uint8 value, bool success)
+void Analyzer::FillTraceRecord(TraceLog::RecordType type, TraceLog::Record& record)
 {
-	return success ? Format8(value) : "??h";
-}
+	DisableMemoryTrackingForScope dmtfs(*this);
 
-std::string Format16(Uint16 value, bool success)
-{
-	return success ? Format16(value) : "????h";
+	record.cycle = m_pClock->GetCycles();
+	record.instructionCount = m_pCpu->GetTotalExecutedOpcodes();
+	record.pc = m_pCpu->GetPC();
+	record.sp = m_pCpu->GetSP();
+	record.type = type;
+	record.bank = m_pMemoryMapper->GetActiveBank();
+	record.opcode[0] = 0;
+	record.opcode[1] = 0;
+	record.opcode[2] = 0;
+	record.a = m_pCpu->GetA();
+	record.f = m_pCpu->GetF();
+	record.b = m_pCpu->GetB();
+	record.c = m_pCpu->GetC();
+	record.d = m_pCpu->GetD();
+	record.e = m_pCpu->GetE();
+	record.h = m_pCpu->GetH();
+	record.l = m_pCpu->GetL();
+	record.ly = m_pMemory->SafeRead8(static_cast<Uint16>(Lcd::Registers::LY));
+	record.flags = 0;
+	record.flags |= ((m_pCpu->GetIF() & Bit1) != 0) ? TraceLog::kVBlankRequested : 0;
+	record.flags |= m_pCpu->GetIME() ? TraceLog::kInterruptsEnabled : 0;
+	record.value = 0;
 }
 
-void Analyzer::Annotate_n(std::string& operandString, std::string& comment)
+void Analyzer::WriteTraceRecord(const TraceLog::Record& record)
 {
-	auto op8 = Uint8(0);
-	auto op8str = std::string();
-	bool op8success = false;
-	ParseOperand8(m_pCpu->GetPC() + 1, op8, op8str, op8success);
-	operandString = op8str;
-}
-
-void Analyzer::Annotate_nn(std::string& operandString, std::string& comment)
-{
-	auto op16 = Uint16(0);
-	auto op16str = std::string();
-	bool op16success = false;
-	ParseOperand16(m_pCpu->GetPC() + 1, op16, op16str, op16success);
-	operandString = op16str;
-}
-
-void Analyzer::Annotate_ind_nn(std::string& operandString, std::string& comment)
-{
-	auto op16 = Uint16(0);
-	auto op16str = std::string();
-	bool op16success = false;
-	ParseOperand16(m_pCpu->GetPC() + 1, op16, op16str, op16success);
-	operandString = Format("(%s)", op16str.c_str());
-	if (op16success)
+	if (!m_traceFilter.HasWatchpoint() || (m_traceRecordsLeft > 0))
 	{
-		auto annotation = GetAddressAnnotation(op16);
-		if (!annotation.empty())
-		{
-			comment = operandString;
-			operandString = Format("(%s)", annotation);
-		}
+		m_traceRecordsLeft -= (m_traceRecordsLeft > 0) ? 1 : 0;
+		m_pTraceWriter->Write(record);
+		return;
 	}
-}
 
-void Analyzer::ParseOperand8(Uint16 address, Uint8& op8, std::string& debugString8, bool& success)
-{
-	success = m_pMemory->SafeRead8(address, op8);
-	debugString8 = Format8(op8, success);
+	// Kept until a hit, when the ones before it are wanted too
+	m_traceHistory[m_traceHistoryNext] = record;
+	m_traceHistoryNext = (m_traceHistoryNext + 1) % m_traceHistory.size();
+	m_traceHistorySize = SDL_min(m_traceHistorySize + 1, m_traceHistory.size());
 }
 
-void Analyzer::ParseOperand16(Uint16 address, Uint16& op16, std::string& debugString16, bool& success)
+void Analyzer::OnTraceWatchpointHit(TraceLog::RecordType type, Uint16 address, Uint8 value)
 {
-	success = m_pMemory->SafeRead16(address, op16);
-	debugString16 = Format16(op16, success);
-}
+	// The access is the instruction's, so only counts if the other filters let the instruction through; the records after it
+	// are filtered as they come
+	if (!m_isTracingInstruction)
+	{
+		return;
+	}
 
-std::string Analyzer::GetAddressAnnotation(Uint16 address)
-{
-	switch (address)
+	auto numRecords = m_traceHistory.size();
+	for (auto i = numRecords - m_traceHistorySize; i < numRecords; ++i)
 	{
-#define ENUMERATE_DEVICE(device, reg) case device::Registers::reg: return std::string(#reg); break;
-		ENUMERATE_DEVICES()
-#undef ENUMERATE_DEVICE
+		m_pTraceWriter->Write(m_traceHistory[(m_traceHistoryNext + i) % numRecords]);
 	}
-	return "";
+	m_traceHistorySize = 0;
+
+	TraceLog::Record record;
+	FillTraceRecord(type, record);
+	record.pc = address;
+	record.value = value;
+	m_pTraceWriter->Write(record);
+
+	// A hit while tracing after another extends the window
+	m_traceRecordsLeft = m_traceFilter.GetWatchRecordsAround();
 }
 
 void Analyzer::DebugNextOpcode()
 {
-	if (TraceLog::IsEnabled())
+	m_isTracingInstruction = IsTracingAt(m_pCpu->GetPC());
+	if (m_isTracingInstruction)
 	{
 		DisableMemoryTrackingForScope dmtfs(*this);
 
-		//@OPTIMIZE: lots of duplicate accesses to memory around the PC for ease of formatting and parsing. This could be streamlined.
-		auto pc = m_pCpu->GetPC();
-
-		const auto& meta = CpuMetadata::GetOpcodeMetadata(m_pMemory->SafeRead8(pc), m_pMemory->SafeRead8(pc + 1));
-		std::string mnemonic = meta.fullMnemonic;
-
-		//auto op8 = Uint8(0);
-		//auto op8str = std::string();
-		//bool op8success = false;
-		//ParseOperand8(pc + 1, op8, op8str, op8success);
-
-		//auto op16 = Uint16(0);
-		//auto op16str = std::string();
-		//bool op16success = false;
-		//ParseOperand16(pc + 1, op16, op16str, op16success);
-
-		//auto inputComment = std::string();
-		//auto outputComment = std::string();
-
-		//auto OperandFormatFuncDummy =
-		//	[this, &meta, op8, &op8str, &op8success, op16, &op16str, &op16success]
-		//	(std::string& annotation, std::string& comment) {};
-		//using OperandFormatFunc = decltype(OperandFormatFuncDummy);
-		//static std::unordered_map<std::string, OperandFormatFunc> s_operandFormatters;
-		//struct OperandFormatFuncsInitializer
-		//{
-		//	Initializer()
-		//	{
-		//		s_operandFormatters["n"] = [](const std::string& operand, const Analyzer& analyzer, const Cpu& cpu, std::string& annotation, std::string& comment) { analyzer.m_pCpu; };
-		//		// If the operand is indirect and the address is invalid, this needs to be apparent
-		//		// If the operand is an immediate address, we can annotate it directly and move the immediate to the comment
-		//		// IF the operand is a register indirect address, leave it as is but annotate in the comment if possible
-		//	}
-		//};
-		//Initializer g_initializer;
-
-		auto formatOperand = [this](std::string& operand, std::string& comment)
-		{
-			auto formatIt = m_operandFormatters.find(operand);
-			if (formatIt != m_operandFormatters.end())
-			{
-				((this)->*(formatIt->second))(operand, comment);
-			}
-		};
-
-		std::string directOutputOperand = meta.directOutput;
-		std::string directOutputComment;
-		if (meta.HasDirectOutput())
-		{
-			formatOperand(directOutputOperand, directOutputComment);
-		}
-
-		std::string directInputOperand = meta.directInput;
-		std::string directInputComment;
-		if (meta.HasDirectInput())
-		{
-			formatOperand(directInputOperand, directInputComment);
-		}
-
-		std::string finalComment = directOutputComment;
-		if (!directInputComment.empty())
-		{
-			if (!finalComment.empty())
-			{
-				finalComment += " / ";
-			}
-			finalComment += directInputComment;
-		}
-
-		//// Do some "smart" replacements to improve legibility for many opcodes
-		//if (meta.baseMnemonic == "LDH")
-		//{
-		//	auto address = Make16(0xFF, op8);
-		//	auto annotation = op8success ? GetAddressAnnotation(address) : std::string("");
-		//	auto addressStr = Format16(address, op8success);
-		//	auto substitutionString = Format("(%sh)", addressStr.c_str());
-		//	if (annotation.length() > 0)
-		//	{
-		//		// If we have an annotation, use that instead
-		//		comment = substitutionString;
-		//		substitutionString = Format("(%s)", annotation.c_str());
-		//	}
-		//	mnemonic = ReplaceFirst(mnemonic, "(n)", substitutionString);
-		//}
-		//else if (meta.baseMnemonic == "JR")
-		//{
-		//	mnemonic = ReplaceFirst(mnemonic, "n", Format("%sh", op8str.c_str()));
-		//	comment = Format("(%sh)", Format16(pc + 2 + static_cast<Sint8>(op8), op8success).c_str());
-		//}
-
-		//if ((meta.baseMnemonic == "JR") || (meta.baseMnemonic == "JP") || (meta.baseMnemonic == "CALL"))
-		//{
-		//	// Add information about flag state
-		//	//mnemonic = ReplaceFirst(mnemonic, " Z", m_pCpu->GetFlagValue(FlagBitIndex::Zero) ? " Z" : " z");
-		//	//mnemonic = ReplaceFirst(mnemonic, " NZ", !m_pCpu->GetFlagValue(FlagBitIndex::Zero) ? " NZ" : " nz");
-		//	//mnemonic = ReplaceFirst(mnemonic, " C", m_pCpu->GetFlagValue(FlagBitIndex::Carry) ? " C" : " C");
-		//	//mnemonic = ReplaceFirst(mnemonic, " NC", !m_pCpu->GetFlagValue(FlagBitIndex::Carry) ? " NC" : " nc");
-		//}
-
-		//@TOOD: possibly replace the format strings for the mnemonic table with clearer substitution tokens
-		//mnemonic = Replace(mnemonic, "(nn)", Format("(%sh)", op16str)); //@TODO: useless until we print target value, this is covered by the next line
-		//mnemonic = ReplaceFirst(mnemonic, "nn", Format("%sh", op16str.c_str()));
-		////mnemonic = Replace(mnemonic, "(n)", Format("(%sh)", DebugStringPeek8(m_pCpu->GetPC() + 1).c_str())); // all (n) are LDH
-		//mnemonic = ReplaceFirst(mnemonic, "n", Format("%sh", op8str.c_str()));
-
-		//TraceLog::Log(Format("-----\n0x%04lX  %02lX   %s  \n", m_pCpu->GetPC(), opcode, pMnemonic));
-		//TraceLog::Log(Format("A: 0x%02lX F: %s%s%s%s B: 0x%02lX C: 0x%02lX D: 0x%02lX E: 0x%02lX H: 0x%02lX L: 0x%02lX\n",
-		//	A,
-		//	GetFlagValue(FlagBitIndex::Zero) ? "Z" : "z",
-		//	GetFlagValue(FlagBitIndex::Subtract) ? "S" : "s",
-		//	GetFlagValue(FlagBitIndex::HalfCarry) ? "H" : "h",
-		//	GetFlagValue(FlagBitIndex::Carry) ? "C" : "c", 
-		//	B, C, D, E, H, L));
-		//TraceLog::Log(Format("AF: 0x%04lX BC: 0x%04lX DE: 0x%04lX HL: 0x%04lX SP: 0x%04lX IME: %d\n", AF, BC, DE, HL, SP, IME ? 1 : 0));
-		//TraceLog::Log(Format("n: 0x%s nn: 0x%s\n", DebugStringPeek8(m_pCpu->GetPC() + 1).c_str(), DebugStringPeek16(m_pCpu->GetPC() + 1).c_str()));
-		////printf("(BC): 0x%s (DE): 0x%s (HL): 0x%s (nn): 0x%s\n", DebugStringPeek8(BC), DebugStringPeek8(DE), DebugStringPeek8(HL), DebugStringPeek16(Peek16(m_pCpu->GetPC() + 1)));
-		//TraceLog::Log(Format("(BC): 0x%s (DE): 0x%s (HL): 0x%s\n", DebugStringPeek8(BC).c_str(), DebugStringPeek8(DE).c_str(), DebugStringPeek8(HL).c_str()));
-		// Format partly inspired from VisualBoyAdvance and then bastardized...
-		TraceLog::Log(Format("CPU %08d: [%04X] %-16s %-10s AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X %c%c%c%c LY=%d %c%c\n",
-			m_pCpu->GetTotalExecutedOpcodes(),
-			m_pCpu->GetPC(),
-			mnemonic.c_str(),
-			finalComment.length() > 0 ? Format("; %s", finalComment.c_str()).c_str() : "",
-			m_pCpu->GetA(),
-			m_pCpu->GetF(),
-			m_pCpu->GetB(),
-			m_pCpu->GetC(),
-			m_pCpu->GetD(),
-			m_pCpu->GetE(),
-			m_pCpu->GetH(),
-			m_pCpu->GetL(),
-			m_pCpu->GetSP(),
-			m_pCpu->GetFlagValue(FlagBitIndex::Zero) ? 'Z' : 'z',
-			m_pCpu->GetFlagValue(FlagBitIndex::Subtract) ? 'S' : 's',
-			m_pCpu->GetFlagValue(FlagBitIndex::HalfCarry) ? 'H' : 'h',
-			m_pCpu->GetFlagValue(FlagBitIndex::Carry) ? 'C' : 'c',
-			m_pMemory->SafeRead8(static_cast<Uint16>(Lcd::Registers::LY)),
-			((m_pCpu->GetIF() & Bit1) != 0) ? 'V' : 'v',
-			m_pCpu->GetIME() ? 'I' : 'i'));
+		// Just the raw state; formatting it as text is left to TraceLog::Decode(), offline
+		TraceLog::Record record;
+		FillTraceRecord(TraceLog::RecordType::Instruction, record);
+		auto pc = record.pc;
+		record.opcode[0] = m_pMemory->SafeRead8(pc);
+		record.opcode[1] = m_pMemory->SafeRead8(pc + 1);
+		record.opcode[2] = m_pMemory->SafeRead8(pc + 2);
+		WriteTraceRecord(record);
 		
 		//@TODO: add traced opcode to function?
 	}
@@ -337,35 +138,69 @@ void Analyzer::DebugNextOpcode()
 
 void Analyzer::SetTracingEnabled(bool enabled)
 {
-	TraceLog::SetEnabled(enabled);
+	m_tracingEnabled = enabled && m_pTraceWriter;
+}
+
+void Analyzer::SetTraceFilter(const TraceFilter& filter)
+{
+	// Takes effect from the next call to a filtered function, if one is running already
+	m_traceFilter = filter;
+	m_traceFunctionDepth = 0;
+	m_traceHistory.assign(filter.HasWatchpoint() ? filter.GetWatchRecordsAround() : 0, TraceLog::Record());
+	m_traceHistoryNext = 0;
+	m_traceHistorySize = 0;
+	m_traceRecordsLeft = 0;
+	m_isTracingInstruction = false;
 }
 
 void Analyzer::FlushTrace()
 {
-	TraceLog::Flush();
+	if (m_pTraceWriter)
+	{
+		m_pTraceWriter->Flush();
+	}
 }
 
 void Analyzer::OnStart(const char * pRomName)
 {
-	TraceLog::Reset();
-	TraceLog::Log(Format("\n\nNew run on %s\n\n", pRomName));
+	m_pTraceWriter.reset(new TraceLog::Writer(TRACELOG_FILENAME, pRomName));
 	EnsureGlobalFunctionIsOnStack();
 	m_trackMemoryAccesses = true;
 }
 
 void Analyzer::OnHalt()
 {
-    if (TraceLog::IsEnabled())
+    if (IsTracingAt(m_pCpu->GetPC()))
     {
-        TraceLog::Log("(HALT executed, CPU halted)\n");
+		TraceLog::Record record;
+		FillTraceRecord(TraceLog::RecordType::Halt, record);
+		WriteTraceRecord(record);
     }
 }
 
+void Analyzer::OnPostFrame()
+{
+	// Written whether tracing or not, to keep the trace's frame numbers those of the emulator
+	if (m_pTraceWriter)
+	{
+		// Records are written in the order they happened, and the frame starts a keyframe, so the records kept for a watchpoint
+		// hit can't follow it: a hit only brings back those from its own frame
+		m_traceHistorySize = 0;
+
+		TraceLog::Record record;
+		FillTraceRecord(TraceLog::RecordType::Frame, record);
+		m_pTraceWriter->Write(record);
+	}
+}
+
 void Analyzer::OnHaltResumed(Uint8 IF)
 {
-    if (TraceLog::IsEnabled())
+    if (IsTracingAt(m_pCpu->GetPC()))
     {
-        TraceLog::Log(Format("(resuming after HALT - IF %d)\n", IF));
+		TraceLog::Record record;
+		FillTraceRecord(TraceLog::RecordType::HaltResumed, record);
+		record.value = IF;
+		WriteTraceRecord(record);
     }
 }
 
@@ -377,7 +212,7 @@ void Analyzer::OnPreExecuteOpcode()
 
 void Analyzer::OnOpcodeExecutionSkipped()
 {
-    if (TraceLog::IsEnabled())
+    if (m_tracingEnabled)
     {
         //TraceLog::Log(Format("(CPU halted, will not execute opcode at 0x%02lX)\n", m_pCpu->GetPC()));
     }
@@ -387,19 +222,22 @@ void Analyzer::OnPreCall(Uint16 unmappedAddress)
 {
 	auto ma = GetMappedAddress(unmappedAddress);
 	//GetFunction(ma);
-	PushFunction(ma);
+	PushFunction(ma, GetMappedAddress(m_pCpu->GetPCAtInstructionStart()));
 }
 
 void Analyzer::OnPreCallInterrupt(Uint16 unmappedAddress)
 {
 	auto ma = GetMappedAddress(unmappedAddress);
 	//GetFunction(ma);
-	PushFunction(ma);
+	PushFunction(ma, GetMappedPC()); // called from wherever it interrupted
 	GetTopFunction().isInterruptServiceRoutine = true;
 
-    if (TraceLog::IsEnabled())
+    if (IsTracingAt(unmappedAddress))
     {
-        TraceLog::Log(Format("(interrupt 0x%04lX pending - CPU unhalted)\n", unmappedAddress));
+		TraceLog::Record record;
+		FillTraceRecord(TraceLog::RecordType::Interrupt, record);
+		record.pc = unmappedAddress;
+		WriteTraceRecord(record);
     }
 }
 
@@ -407,7 +245,7 @@ void Analyzer::OnPreReturn(Uint16 returnStatementAddress)
 {
 	auto ma = GetMappedPC();
 	auto& func = GetTopFunction();
-	func.exitPoints.insert(ma);
+	AddExitPoint(func, ma);
 	PopFunction();
 }
 
@@ -426,6 +264,11 @@ void Analyzer::OnPostRead8(Uint16 address, Uint8 value)
 		return;
 	}
 
+	if (m_traceFilter.HasWatchpoint() && (address == m_traceFilter.GetWatchAddress()))
+	{
+		OnTraceWatchpointHit(TraceLog::RecordType::WatchpointRead, address, value);
+	}
+
 	auto& func = GetTopFunction();
 	++func.readCount;
 	switch (address)
@@ -445,6 +288,11 @@ void Analyzer::OnPostWrite8(Uint16 address, Uint8 value)
 		return;
 	}
 
+	if (m_traceFilter.HasWatchpoint() && (address == m_traceFilter.GetWatchAddress()))
+	{
+		OnTraceWatchpointHit(TraceLog::RecordType::WatchpointWrite, address, value);
+	}
+
 	auto& func = GetTopFunction();
 	++func.writeCount;
 	switch (address)
@@ -486,10 +334,77 @@ void Analyzer::OnUnknownOpcode(Uint16 unmappedAddress)
 	//printf("n: 0x%s nn: 0x%s\n", DebugStringPeek8(m_pCpu->GetPC()).c_str(), DebugStringPeek16(m_pCpu->GetPC()).c_str());
 }
 
+void Analyzer::GetProfile(GuestProfile& profile)
+{
+	ChargeProfileTime();
+
+	profile.functions.resize(m_functions.size());
+	for (const auto& func : m_functions)
+	{
+		auto& function = profile.functions[func.index];
+		function.bank = func.entryPoint.bank;
+		function.address = func.entryPoint.address;
+		function.isInterruptServiceRoutine = func.isInterruptServiceRoutine;
+		function.calls = func.callCount;
+		function.exclusiveCycles = func.exclusiveCycles;
+		function.exclusiveInstructions = func.exclusiveInstructions;
+		function.inclusiveCycles = func.inclusiveCycles;
+		function.inclusiveInstructions = func.inclusiveInstructions;
+	}
+
+	profile.callEdges.resize(m_profileEdges.size());
+	for (size_t i = 0; i < m_profileEdges.size(); ++i)
+	{
+		const auto& edge = m_profileEdges[i];
+		auto& callEdge = profile.callEdges[i];
+		callEdge.caller = edge.caller;
+		callEdge.callee = edge.callee;
+		callEdge.callSiteBank = edge.callSite.bank;
+		callEdge.callSiteAddress = edge.callSite.address;
+		callEdge.calls = edge.calls;
+		callEdge.inclusiveCycles = edge.inclusiveCycles;
+		callEdge.inclusiveInstructions = edge.inclusiveInstructions;
+	}
+
+	profile.contexts.resize(m_profileContexts.size());
+	for (size_t i = 0; i < m_profileContexts.size(); ++i)
+	{
+		const auto& context = m_profileContexts[i];
+		auto& profileContext = profile.contexts[i];
+		profileContext.parent = (context.parent == kNoProfileEntry) ? GuestProfile::kNone : context.parent;
+		profileContext.function = context.function;
+		profileContext.exclusiveCycles = context.exclusiveCycles;
+		profileContext.exclusiveInstructions = context.exclusiveInstructions;
+	}
+
+	// The calls that haven't returned yet, like the main loop's, count up to now
+	std::vector<bool> isCounted(m_functions.size(), false);
+	for (const auto& frame : m_functionStack)
+	{
+		auto cycles = m_profileCycles - frame.entryCycle;
+		auto instructions = m_profileInstructions - frame.entryInstruction;
+		auto index = frame.pFunction->index;
+		if (!isCounted[index])
+		{
+			isCounted[index] = true;
+			profile.functions[index].inclusiveCycles += cycles;
+			profile.functions[index].inclusiveInstructions += instructions;
+		}
+		if (frame.edge != kNoProfileEntry)
+		{
+			profile.callEdges[frame.edge].inclusiveCycles += cycles;
+			profile.callEdges[frame.edge].inclusiveInstructions += instructions;
+		}
+	}
+}
+
 Analyzer::MappedAddress Analyzer::GetMappedAddress(Uint16 unmappedAddress)
 {
 	SDL_assert(m_pMemoryMapper != nullptr);
-	return MappedAddress(m_pMemoryMapper->GetActiveBank(), unmappedAddress);
+
+	// Only the window at 4000h-7FFFh is banked, so the same code elsewhere is the same function whatever the bank
+	auto isBanked = (unmappedAddress >= 0x4000) && (unmappedAddress < 0x8000);
+	return MappedAddress(isBanked ? m_pMemoryMapper->GetActiveBank() : 0, unmappedAddress);
 }
 
 Analyzer::MappedAddress Analyzer::GetMappedPC()
@@ -497,22 +412,121 @@ Analyzer::MappedAddress Analyzer::GetMappedPC()
 	return GetMappedAddress(m_pCpu->GetPC());
 }
 
-void Analyzer::PushFunction(Analyzer::MappedAddress address)
+void Analyzer::PushFunction(Analyzer::MappedAddress address, Analyzer::MappedAddress callSite)
 {
-	m_functionStack.push(address);
-	m_pTopFunction = &GetTopFunctionFromStack();
+	// Deep recursion stops making new contexts, and is charged to the deepest one
+	static const size_t maxContextDepth = 64;
+
+	auto& func = GetFunction(address);
+	StackFrame frame;
+	frame.pFunction = &func;
+	frame.edge = kNoProfileEntry;
+	auto parentContext = kNoProfileEntry;
+	if (!m_functionStack.empty())
+	{
+		ChargeProfileTime();
+
+		// Function indices go in 20 bits, which is more than there is code for
+		const auto& caller = m_functionStack.back();
+		SDL_assert((func.index < (1 << 20)) && (caller.pFunction->index < (1 << 20)));
+		auto edgeKey = static_cast<Uint64>(callSite.GetKey()) | (static_cast<Uint64>(func.index) << 24) | (static_cast<Uint64>(caller.pFunction->index) << 44);
+		bool inserted = false;
+		auto& edgeIndex = m_profileEdgeIndices.FindOrInsert(edgeKey, &inserted);
+		if (inserted)
+		{
+			edgeIndex = static_cast<Uint32>(m_profileEdges.size());
+			ProfileEdge edge;
+			edge.caller = caller.pFunction->index;
+			edge.callee = func.index;
+			edge.callSite = callSite;
+			m_profileEdges.push_back(edge);
+		}
+		frame.edge = edgeIndex;
+		++m_profileEdges[edgeIndex].calls;
+		parentContext = caller.context;
+	}
+
+	if (m_functionStack.size() >= maxContextDepth)
+	{
+		frame.context = parentContext;
+	}
+	else
+	{
+		bool inserted = false;
+		auto& contextIndex = m_profileContextIndices.FindOrInsert((static_cast<Uint64>(parentContext) << 32) | func.index, &inserted);
+		if (inserted)
+		{
+			contextIndex = static_cast<Uint32>(m_profileContexts.size());
+			ProfileContext context;
+			context.parent = parentContext;
+			context.function = func.index;
+			m_profileContexts.push_back(context);
+		}
+		frame.context = contextIndex;
+	}
+
+	frame.entryCycle = m_profileCycles;
+	frame.entryInstruction = m_profileInstructions;
+	++func.callCount;
+	++func.activeFrames;
+	m_functionStack.push_back(frame);
+	m_pTopFunction = &func;
+
+	if ((m_traceFunctionDepth == 0) && m_traceFilter.IsFunction(address.bank, address.address))
+	{
+		m_traceFunctionDepth = m_functionStack.size();
+	}
 }
 
 void Analyzer::PopFunction()
 {
-	m_functionStack.pop();
+	ChargeProfileTime();
+
+	const auto& frame = m_functionStack.back();
+	auto cycles = m_profileCycles - frame.entryCycle;
+	auto instructions = m_profileInstructions - frame.entryInstruction;
+	if (--frame.pFunction->activeFrames == 0)
+	{
+		frame.pFunction->inclusiveCycles += cycles;
+		frame.pFunction->inclusiveInstructions += instructions;
+	}
+	if (frame.edge != kNoProfileEntry)
+	{
+		m_profileEdges[frame.edge].inclusiveCycles += cycles;
+		m_profileEdges[frame.edge].inclusiveInstructions += instructions;
+	}
+	m_functionStack.pop_back();
 
 	// Failsafe - some games do weird stack manipulation...
 	if (m_functionStack.size() == 0)
 	{
 		EnsureGlobalFunctionIsOnStack();
 	}
-	m_pTopFunction = &GetTopFunctionFromStack();
+	m_pTopFunction = m_functionStack.back().pFunction;
+
+	if (m_functionStack.size() < m_traceFunctionDepth)
+	{
+		m_traceFunctionDepth = 0;
+	}
+}
+
+void Analyzer::ChargeProfileTime()
+{
+	// The clock restarts when the emulator is reset, and then all of its time is new
+	auto clockCycle = m_pClock->GetCycles();
+	auto cpuInstruction = m_pCpu->GetTotalExecutedOpcodes();
+	auto cycles = (clockCycle >= m_profileClockCycle) ? clockCycle - m_profileClockCycle : clockCycle;
+	auto instructions = (cpuInstruction >= m_profileCpuInstruction) ? cpuInstruction - m_profileCpuInstruction : cpuInstruction;
+	m_profileClockCycle = clockCycle;
+	m_profileCpuInstruction = cpuInstruction;
+	m_profileCycles += cycles;
+	m_profileInstructions += instructions;
+
+	const auto& frame = m_functionStack.back();
+	frame.pFunction->exclusiveCycles += cycles;
+	frame.pFunction->exclusiveInstructions += instructions;
+	m_profileContexts[frame.context].exclusiveCycles += cycles;
+	m_profileContexts[frame.context].exclusiveInstructions += instructions;
 }
 
 Analyzer::AnalyzedFunction& Analyzer::GetTopFunction()
@@ -520,16 +534,36 @@ Analyzer::AnalyzedFunction& Analyzer::GetTopFunction()
 	return *m_pTopFunction;
 }
 
-Analyzer::AnalyzedFunction& Analyzer::GetTopFunctionFromStack()
+Analyzer::AnalyzedFunction& Analyzer::GetFunction(Analyzer::MappedAddress address)
 {
-	return GetFunction(m_functionStack.top());
+	bool inserted = false;
+	auto& index = m_functionIndices.FindOrInsert(address.GetKey(), &inserted);
+	if (inserted)
+	{
+		index = static_cast<Uint32>(m_functions.size());
+		m_functions.emplace_back();
+		m_functions.back().entryPoint = address;
+		m_functions.back().index = index;
+	}
+	return m_functions[index];
 }
 
-Analyzer::AnalyzedFunction& Analyzer::GetFunction(Analyzer::MappedAddress address)
+void Analyzer::AddExitPoint(Analyzer::AnalyzedFunction& func, Analyzer::MappedAddress address)
 {
-	auto func = AnalyzedFunction();
-	func.entryPoint = address;
-	return m_functions.insert(std::make_pair(address, func)).first->second;
+	// Functions have few exit points, and the one found first is the one added last
+	for (auto i = func.firstExitPoint; i != kNoExitPoint; i = m_exitPoints[i].next)
+	{
+		if (m_exitPoints[i].address == address)
+		{
+			return;
+		}
+	}
+
+	ExitPoint exitPoint;
+	exitPoint.address = address;
+	exitPoint.next = func.firstExitPoint;
+	func.firstExitPoint = static_cast<Uint32>(m_exitPoints.size());
+	m_exitPoints.push_back(exitPoint);
 }
 
 void Analyzer::EnsureGlobalFunctionIsOnStack()
@@ -538,7 +572,7 @@ void Analyzer::EnsureGlobalFunctionIsOnStack()
 	GetFunction(ma);
 	if (m_functionStack.size() == 0)
 	{
-		PushFunction(ma);
+		PushFunction(ma, ma);
 	}
 }
 
@@ -2,19 +2,67 @@
 
 #include "SDL.h"
 
+#include "FlatHashMap.h"
 #include "IMemoryBusDevice.h"
+#include "TraceFilter.h"
+#include "TraceLog.h"
 
-#include <map>
-#include <stack>
-#include <set>
-#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <vector>
 
 class MemoryMapper;
 class Cpu;
 class MemoryBus;
+class MasterClock;
+struct GuestProfile;
 
 #define ENABLE_ANALYZER 0
 
+// Every named device register, for mapping addresses to names: define ENUMERATE_DEVICE(device, reg) and expand this where the
+// device headers are included
+#define ENUMERATE_DEVICES() \
+	ENUMERATE_DEVICE(Timer, DIV) \
+	ENUMERATE_DEVICE(Timer, TIMA) \
+	ENUMERATE_DEVICE(Timer, TMA) \
+	ENUMERATE_DEVICE(Timer, TAC) \
+	ENUMERATE_DEVICE(Joypad, P1_JOYP) \
+	ENUMERATE_DEVICE(GameLinkPort, SB) \
+	ENUMERATE_DEVICE(GameLinkPort, SC) \
+	ENUMERATE_DEVICE(Lcd, LCDC) \
+	ENUMERATE_DEVICE(Lcd, STAT) \
+	ENUMERATE_DEVICE(Lcd, SCY) \
+	ENUMERATE_DEVICE(Lcd, SCX) \
+	ENUMERATE_DEVICE(Lcd, LY) \
+	ENUMERATE_DEVICE(Lcd, LYC) \
+	ENUMERATE_DEVICE(Lcd, DMA) \
+	ENUMERATE_DEVICE(Lcd, BGP) \
+	ENUMERATE_DEVICE(Lcd, OBP0) \
+	ENUMERATE_DEVICE(Lcd, OBP1) \
+	ENUMERATE_DEVICE(Lcd, WY) \
+	ENUMERATE_DEVICE(Lcd, WX) \
+	ENUMERATE_DEVICE(Sound, NR10) \
+	ENUMERATE_DEVICE(Sound, NR11) \
+	ENUMERATE_DEVICE(Sound, NR12) \
+	ENUMERATE_DEVICE(Sound, NR13) \
+	ENUMERATE_DEVICE(Sound, NR14) \
+	ENUMERATE_DEVICE(Sound, NR21) \
+	ENUMERATE_DEVICE(Sound, NR22) \
+	ENUMERATE_DEVICE(Sound, NR23) \
+	ENUMERATE_DEVICE(Sound, NR24) \
+	ENUMERATE_DEVICE(Sound, NR30) \
+	ENUMERATE_DEVICE(Sound, NR31) \
+	ENUMERATE_DEVICE(Sound, NR32) \
+	ENUMERATE_DEVICE(Sound, NR33) \
+	ENUMERATE_DEVICE(Sound, NR34) \
+	ENUMERATE_DEVICE(Sound, NR41) \
+	ENUMERATE_DEVICE(Sound, NR42) \
+	ENUMERATE_DEVICE(Sound, NR43) \
+	ENUMERATE_DEVICE(Sound, NR44) \
+	ENUMERATE_DEVICE(Sound, NR50) \
+	ENUMERATE_DEVICE(Sound, NR51) \
+	ENUMERATE_DEVICE(Sound, NR52)
+
 #if ENABLE_ANALYZER
 #define ELIDE_IF_ANALYZER_DISABLED ;
 #else
@@ -24,10 +72,11 @@ class MemoryBus;
 class Analyzer
 {
 public:
-	Analyzer(MemoryMapper* pMemoryMapper, Cpu* pCpu, MemoryBus* pMemory) ELIDE_IF_ANALYZER_DISABLED
+	Analyzer(MemoryMapper* pMemoryMapper, Cpu* pCpu, MemoryBus* pMemory, const MasterClock* pClock) ELIDE_IF_ANALYZER_DISABLED
 
 	void SetTracingEnabled(bool enabled) ELIDE_IF_ANALYZER_DISABLED
 	void FlushTrace() ELIDE_IF_ANALYZER_DISABLED
+	void SetTraceFilter(const TraceFilter& filter) ELIDE_IF_ANALYZER_DISABLED
 
 	void OnStart(const char* pRomName) ELIDE_IF_ANALYZER_DISABLED
 
@@ -48,11 +97,16 @@ public:
 	void OnPostVramAccess(MemoryRequestType requestType, Uint16 address, Uint8 value) ELIDE_IF_ANALYZER_DISABLED
 	void OnPostOamAccess(MemoryRequestType requestType, Uint16 address, Uint8 value) ELIDE_IF_ANALYZER_DISABLED
 
+	void OnPostFrame() ELIDE_IF_ANALYZER_DISABLED
+
 	void OnPostRomBankSwitch(Uint8 bankIndex) ELIDE_IF_ANALYZER_DISABLED
 	void OnPostBankingModeSwitch() ELIDE_IF_ANALYZER_DISABLED
 	
 	void OnUnknownOpcode(Uint16 unmappedAddress) ELIDE_IF_ANALYZER_DISABLED
 
+	// Where the time went since the start, by function, call site and call stack
+	void GetProfile(GuestProfile& profile) ELIDE_IF_ANALYZER_DISABLED
+
 private:
 	struct MappedAddress
 	{
@@ -60,13 +114,25 @@ private:
 		Uint16 address = 0;
 		MappedAddress() {}
 		MappedAddress(Uint8 bank_, Uint16 address_) { bank = bank_; address = address_; }
-		bool operator<(const MappedAddress& other) const { return (bank < other.bank) ? true : ((bank > other.bank) ? false : (address < other.address)); }
+		bool operator==(const MappedAddress& other) const { return (bank == other.bank) && (address == other.address); }
+		// Bank and address packed into 24 bits, for hashing
+		Uint32 GetKey() const { return (bank << 16) | address; }
+	};
+
+	static const Uint32 kNoExitPoint = ~0u;
+
+	// Exit points of all functions share one pool, each function's a list through it, newest first
+	struct ExitPoint
+	{
+		MappedAddress address;
+		Uint32 next;
 	};
 
 	struct AnalyzedFunction
 	{
 		Analyzer::MappedAddress entryPoint;
-		std::set<Analyzer::MappedAddress> exitPoints;
+		Uint32 index = 0; // in m_functions
+		Uint32 firstExitPoint = kNoExitPoint; // in m_exitPoints
 		bool isInterruptServiceRoutine = false;
 		bool usesTimer = false;
 		bool usesJoypad = false;
@@ -80,39 +146,95 @@ private:
 		Uint32 readCount = 0;
 		Uint32 writeCount = 0;
 		Uint32 executedInstructionCount = 0;
+
+		// Profile: cycles in the function itself, and in it and its callees from entry to return, counted once per
+		// outermost call when it recurses
+		Uint64 callCount = 0;
+		Uint64 exclusiveCycles = 0;
+		Uint64 exclusiveInstructions = 0;
+		Uint64 inclusiveCycles = 0;
+		Uint64 inclusiveInstructions = 0;
+		Uint32 activeFrames = 0; // on the stack
+	};
+	// Functions never move once added, so the stack can point at them
+	using AnalyzedFunctionList = std::deque<Analyzer::AnalyzedFunction>;
+	using AnalyzedFunctionIndexMap = FlatHashMap<Uint32, Uint32>; // by MappedAddress::GetKey()
+
+	// A function called from a call site in another; as the call graph is sparse, these only exist for the calls made
+	struct ProfileEdge
+	{
+		Uint32 caller;
+		Uint32 callee;
+		MappedAddress callSite;
+		Uint64 calls = 0;
+		Uint64 inclusiveCycles = 0;
+		Uint64 inclusiveInstructions = 0;
+	};
+
+	// A distinct call stack, as its last function and the context it was called from
+	struct ProfileContext
+	{
+		Uint32 parent;
+		Uint32 function;
+		Uint64 exclusiveCycles = 0;
+		Uint64 exclusiveInstructions = 0;
+	};
+
+	struct StackFrame
+	{
+		AnalyzedFunction* pFunction;
+		Uint32 edge; // kNoProfileEntry at the bottom
+		Uint32 context;
+		Uint64 entryCycle; // in m_profileCycles
+		Uint64 entryInstruction;
 	};
-	using AnalyzedFunctionMap = std::map<Analyzer::MappedAddress, Analyzer::AnalyzedFunction>;
-	using AnalyzedFunctionStack = std::stack<Analyzer::MappedAddress>;
-
-	//using OperandFormatFunc = void(int);
-	//std::unordered_map<std::string, OperandFormatFunc> m_operandFormatters;
-	void Annotate_n(std::string& operandString, std::string& comment);
-	void Annotate_nn(std::string& operandString, std::string& comment);
-	void Annotate_ind_nn(std::string& operandString, std::string& comment);
-
-	void ParseOperand8(Uint16 address, Uint8& op8, std::string& debugString8, bool& success);
-	void ParseOperand16(Uint16 address, Uint16& op16, std::string& debugString16, bool& success);
-	std::string GetAddressAnnotation(Uint16 address);
+	using AnalyzedFunctionStack = std::vector<StackFrame>;
+
+	static const Uint32 kNoProfileEntry = ~0u;
+
+	bool IsTracingAt(Uint16 unmappedAddress);
+	void FillTraceRecord(TraceLog::RecordType type, TraceLog::Record& record);
+	void WriteTraceRecord(const TraceLog::Record& record);
+	void OnTraceWatchpointHit(TraceLog::RecordType type, Uint16 address, Uint8 value);
 	void DebugNextOpcode();
 
 	MappedAddress GetMappedAddress(Uint16 unmappedAddress);
 	MappedAddress GetMappedPC();
 
-	void PushFunction(MappedAddress address);
+	void PushFunction(MappedAddress address, MappedAddress callSite);
 	void PopFunction();
+	void ChargeProfileTime();
 	AnalyzedFunction& GetTopFunction(); // this is an optimization
-	AnalyzedFunction& GetTopFunctionFromStack(); //equivalent to GetTopFunction but slow
 	AnalyzedFunction& GetFunction(MappedAddress address);
+	void AddExitPoint(AnalyzedFunction& func, MappedAddress address);
 	void EnsureGlobalFunctionIsOnStack();
 
-	std::unordered_map<std::string, void(Analyzer::*)(std::string&, std::string&)> m_operandFormatters;
-
 	MemoryMapper* m_pMemoryMapper;
 	Cpu* m_pCpu;
 	MemoryBus* m_pMemory;
-	AnalyzedFunctionMap m_functions;
+	const MasterClock* m_pClock;
+	std::unique_ptr<TraceLog::Writer> m_pTraceWriter; // created by OnStart()
+	bool m_tracingEnabled;
+	TraceFilter m_traceFilter;
+	size_t m_traceFunctionDepth = 0; // with a function filter, the stack size on entering the function; 0 when outside it
+	std::vector<TraceLog::Record> m_traceHistory; // with a watchpoint filter, the latest records, in case of a hit
+	size_t m_traceHistoryNext = 0;
+	size_t m_traceHistorySize = 0;
+	Uint32 m_traceRecordsLeft = 0; // to trace after a watchpoint hit
+	bool m_isTracingInstruction = false; // whether the instruction being executed passed the filters
+	AnalyzedFunctionList m_functions;
+	AnalyzedFunctionIndexMap m_functionIndices;
+	std::vector<ExitPoint> m_exitPoints;
 	AnalyzedFunctionStack m_functionStack;
 	AnalyzedFunction* m_pTopFunction;
+	std::vector<ProfileEdge> m_profileEdges;
+	FlatHashMap<Uint64, Uint32> m_profileEdgeIndices; // by call site, callee and caller
+	std::vector<ProfileContext> m_profileContexts;
+	FlatHashMap<Uint64, Uint32> m_profileContextIndices; // by parent context and function
+	Uint64 m_profileClockCycle = 0; // up to which time has been charged to the top function
+	Uint32 m_profileCpuInstruction = 0;
+	Uint64 m_profileCycles = 0; // charged in all, as the clock restarts on reset
+	Uint64 m_profileInstructions = 0;
 
 	struct DisableMemoryTrackingForScope
 	{
@@ -120,6 +242,7 @@ private:
 			: m_analyzer(analyzer)
 		{
 			m_restoreValue = m_analyzer.m_trackMemoryAccesses;
+			m_analyzer.m_trackMemoryAccesses = false;
 		}
 		
 		~DisableMemoryTrackingForScope()
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BLIP_BUFFER_USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define BLIP_BUFFER_USE_SSE2 0
+#endif
+
+// Band-limited step synthesis, along the lines of blip_buf.  Instead of point-sampling a waveform, the producer records each
+// change in amplitude (a delta) at the clock cycle it happens on.  Each delta is spread over the output samples around it
+// using a windowed-sinc kernel picked for the delta's sub-sample phase, so square edges come out without aliasing.  The
+// buffer holds the derivative of the signal, and reading integrates it back into samples.
+//
+// Usage per frame: AddDelta() any number of times with times relative to the start of the frame, EndFrame() with the
+// frame's length in clocks, then ReadSamples().
+//
+// Since the kernel is evaluated at the output rate, any output rate is produced directly from the clock-rate deltas; there
+// is no intermediate fixed-rate stream to resample.
+class BlipBuffer
+{
+public:
+	// Fast spreads each delta over 8 output samples, High over 16 with a sharper cutoff
+	enum class Quality
+	{
+		Fast,
+		High,
+	};
+
+	static const int kPhaseBits = 5;
+	static const int kPhaseCount = 1 << kPhaseBits;
+	static const int kMaxKernelWidth = 16; // kernel widths are multiples of 8, for the SSE2 path
+	static const int kKernelBits = 14; // each kernel phase sums to 1 << kKernelBits
+	static const int kBassShift = 9; // integrator leak, a gentle DC-removing high-pass (around 14Hz at 44.1kHz)
+
+	BlipBuffer(int maxSamplesPerFrame, Quality quality = Quality::High)
+		: m_capacity(maxSamplesPerFrame)
+		, m_buffer(maxSamplesPerFrame + kMaxKernelWidth)
+		, m_factor(0)
+		, m_pKernel(&GetKernel(quality))
+	{
+		Clear();
+	}
+
+	Quality GetQuality() const
+	{
+		return m_pKernel->quality;
+	}
+
+	void SetRates(double clockRate, double sampleRate)
+	{
+		m_factor = static_cast<Uint64>((sampleRate / clockRate) * static_cast<double>(kTimeUnit) + 0.5);
+	}
+
+	void Clear()
+	{
+		m_offset = 0;
+		m_samplesAvailable = 0;
+		m_integrator = 0;
+		std::fill(m_buffer.begin(), m_buffer.end(), 0);
+	}
+
+	// Number of whole output samples that the given number of clocks from the start of the current frame spans
+	int GetSamplesForClocks(Uint32 clocks) const
+	{
+		return static_cast<int>((clocks * m_factor + m_offset) >> kTimeBits);
+	}
+
+	void AddDelta(Uint32 time, int delta)
+	{
+		Uint64 fixedTime = time * m_factor + m_offset;
+		int position = m_samplesAvailable + static_cast<int>(fixedTime >> kTimeBits);
+		int phase = static_cast<int>(fixedTime >> (kTimeBits - kPhaseBits)) & (kPhaseCount - 1);
+		int width = m_pKernel->width;
+		SDL_assert(position + width <= static_cast<int>(m_buffer.size()));
+
+		const Sint16* pKernel = m_pKernel->taps[phase];
+		Sint32* pOut = &m_buffer[position];
+
+#if BLIP_BUFFER_USE_SSE2
+		// 16x16->32 bit products of eight taps at a time, from the low and high halves of the 16-bit multiplies
+		if ((delta >= -32768) && (delta <= 32767))
+		{
+			__m128i delta16 = _mm_set1_epi16(static_cast<short>(delta));
+			for (int tap = 0; tap < width; tap += 8)
+			{
+				__m128i taps = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&pKernel[tap]));
+				__m128i productsLow = _mm_mullo_epi16(taps, delta16);
+				__m128i productsHigh = _mm_mulhi_epi16(taps, delta16);
+				__m128i* pOut128 = reinterpret_cast<__m128i*>(&pOut[tap]);
+				_mm_storeu_si128(pOut128, _mm_add_epi32(_mm_loadu_si128(pOut128), _mm_unpacklo_epi16(productsLow, productsHigh)));
+				_mm_storeu_si128(pOut128 + 1, _mm_add_epi32(_mm_loadu_si128(pOut128 + 1), _mm_unpackhi_epi16(productsLow, productsHigh)));
+			}
+			return;
+		}
+#endif
+
+		for (int tap = 0; tap < width; ++tap)
+		{
+			pOut[tap] += pKernel[tap] * delta;
+		}
+	}
+
+	void EndFrame(Uint32 clocks)
+	{
+		Uint64 fixedTime = clocks * m_factor + m_offset;
+		m_samplesAvailable += static_cast<int>(fixedTime >> kTimeBits);
+		m_offset = fixedTime & (kTimeUnit - 1);
+		SDL_assert(m_samplesAvailable <= m_capacity);
+	}
+
+	int GetSamplesAvailable() const
+	{
+		return m_samplesAvailable;
+	}
+
+	// Writes up to count samples, stride apart (2 for one side of interleaved stereo), and returns how many were written
+	int ReadSamples(Sint16* pOut, int count, int stride)
+	{
+		count = SDL_min(count, m_samplesAvailable);
+
+		Sint32 integrator = m_integrator;
+		for (int i = 0; i < count; ++i)
+		{
+			*pOut = Integrate(integrator, m_buffer[i]);
+			pOut += stride;
+		}
+		m_integrator = integrator;
+
+		RemoveSamples(count);
+		return count;
+	}
+
+	// Reads a left and a right buffer, which must have been fed the same frames, into interleaved stereo in one pass; the
+	// same as a ReadSamples() of each side with a stride of 2
+	static int ReadStereoSamples(BlipBuffer& left, BlipBuffer& right, Sint16* pOut, int count)
+	{
+		SDL_assert(left.m_samplesAvailable == right.m_samplesAvailable);
+		count = SDL_min(count, left.m_samplesAvailable);
+
+#if BLIP_BUFFER_USE_SSE2
+		// Both integrators side by side in the low two lanes; the saturating pack to 16 bits is the clamp, and leaves the pair
+		// in the low 32 bits in output order
+		__m128i integrators = _mm_unpacklo_epi32(_mm_cvtsi32_si128(left.m_integrator), _mm_cvtsi32_si128(right.m_integrator));
+		for (int i = 0; i < count; ++i)
+		{
+			__m128i deltas = _mm_unpacklo_epi32(_mm_cvtsi32_si128(left.m_buffer[i]), _mm_cvtsi32_si128(right.m_buffer[i]));
+			integrators = _mm_add_epi32(integrators, deltas);
+			__m128i samples = _mm_srai_epi32(integrators, kKernelBits);
+			Sint32 pair = _mm_cvtsi128_si32(_mm_packs_epi32(samples, samples));
+			memcpy(&pOut[i * 2], &pair, sizeof(pair));
+			integrators = _mm_sub_epi32(integrators, _mm_slli_epi32(samples, kKernelBits - kBassShift));
+		}
+		left.m_integrator = _mm_cvtsi128_si32(integrators);
+		right.m_integrator = _mm_cvtsi128_si32(_mm_srli_si128(integrators, 4));
+#else
+		Sint32 leftIntegrator = left.m_integrator;
+		Sint32 rightIntegrator = right.m_integrator;
+		for (int i = 0; i < count; ++i)
+		{
+			pOut[i * 2] = Integrate(leftIntegrator, left.m_buffer[i]);
+			pOut[i * 2 + 1] = Integrate(rightIntegrator, right.m_buffer[i]);
+		}
+		left.m_integrator = leftIntegrator;
+		right.m_integrator = rightIntegrator;
+#endif
+
+		left.RemoveSamples(count);
+		right.RemoveSamples(count);
+		return count;
+	}
+
+	void RemoveSamples(int count)
+	{
+		int remaining = m_samplesAvailable - count + kMaxKernelWidth;
+		memmove(&m_buffer[0], &m_buffer[count], remaining * sizeof(Sint32));
+		std::fill(m_buffer.begin() + remaining, m_buffer.begin() + remaining + count, 0);
+		m_samplesAvailable -= count;
+	}
+
+private:
+	// One step of the leaky integrator that turns the buffer's deltas back into samples
+	static Sint16 Integrate(Sint32& integrator, Sint32 delta)
+	{
+		integrator += delta;
+		Sint32 sample = integrator >> kKernelBits;
+		integrator -= sample << (kKernelBits - kBassShift);
+		return static_cast<Sint16>(SDL_max(-32768, SDL_min(sample, 32767)));
+	}
+
+	static const int kTimeBits = 32;
+	static const Uint64 kTimeUnit = static_cast<Uint64>(1) << kTimeBits;
+
+	struct Kernel
+	{
+		Quality quality;
+		int width;
+		Sint16 taps[kPhaseCount][kMaxKernelWidth];
+
+		Kernel(Quality quality_, int width_, double cutoff)
+			: quality(quality_)
+			, width(width_)
+		{
+			// Blackman-windowed sinc with its cutoff a little under Nyquist, sampled at every phase and normalized so that
+			// a step always settles at exactly its full height
+			const double pi = 3.14159265358979323846;
+			int halfWidth = width / 2;
+			memset(taps, 0, sizeof(taps));
+			for (int phase = 0; phase < kPhaseCount; ++phase)
+			{
+				double values[kMaxKernelWidth];
+				double sum = 0.0;
+				for (int tap = 0; tap < width; ++tap)
+				{
+					double x = tap - (halfWidth - 1) - static_cast<double>(phase) / kPhaseCount;
+					double sinc = (x == 0.0) ? 1.0 : sin(pi * cutoff * x) / (pi * cutoff * x);
+					double window = 0.42 + 0.5 * cos(pi * x / halfWidth) + 0.08 * cos(2.0 * pi * x / halfWidth);
+					values[tap] = sinc * window;
+					sum += values[tap];
+				}
+
+				int total = 0;
+				for (int tap = 0; tap < width; ++tap)
+				{
+					taps[phase][tap] = static_cast<Sint16>(floor(values[tap] * (1 << kKernelBits) / sum + 0.5));
+					total += taps[phase][tap];
+				}
+				taps[phase][halfWidth - 1] += static_cast<Sint16>((1 << kKernelBits) - total);
+			}
+		}
+	};
+
+	static const Kernel& GetKernel(Quality quality)
+	{
+		static const Kernel fastKernel(Quality::Fast, 8, 0.75);
+		static const Kernel highKernel(Quality::High, 16, 0.9);
+		return (quality == Quality::Fast) ? fastKernel : highKernel;
+	}
+
+	int m_capacity;
+	std::vector<Sint32> m_buffer;
+	Uint64 m_factor; // output samples per clock, in 1 / kTimeUnit
+	Uint64 m_offset; // fractional sample position of the start of the current frame
+	int m_samplesAvailable;
+	Sint32 m_integrator;
+	const Kernel* m_pKernel;
+};
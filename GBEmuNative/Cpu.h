@@ -2,6 +2,8 @@
 
 #include "Analyzer.h"
 #include "MemoryBus.h"
+#include "RomCoverage.h"
+#include "SamplingProfiler.h"
 
 #include "CpuMetadata.h"
 
@@ -43,6 +45,8 @@ public:
 
 	Cpu(const std::shared_ptr<MemoryBus>& memory)
 		: m_pMemory(memory)
+		, m_pSamplingProfiler(nullptr)
+		, m_pRomCoverage(nullptr)
 	{
 		Reset();
 	}
@@ -89,6 +93,18 @@ public:
 		return GetBitValue(F, static_cast<Uint8>(position));
 	}
 
+	// Kept informed of calls, interrupts and returns; null when not sampling
+	void SetSamplingProfiler(SamplingProfiler* pSamplingProfiler)
+	{
+		m_pSamplingProfiler = pSamplingProfiler;
+	}
+
+	// Told which reads are opcode and operand fetches
+	void SetRomCoverage(RomCoverage* pRomCoverage)
+	{
+		m_pRomCoverage = pRomCoverage;
+	}
+
 	void SignalInterrupt(Uint8 interruptFlagMask)
 	{
 		IF |= interruptFlagMask;
@@ -96,6 +112,8 @@ public:
 
 	Uint8 GetInstructionSize(Uint16 address)
 	{
+		// For the debugger, so not a read by the guest
+		RomCoverage::SuspendScope suspendCoverage(m_pRomCoverage);
 		return CpuMetadata::GetOpcodeMetadata(Read8(PC), Read8(PC + 1)).size;
 		//Uint8 opcode = Read8(address);
 		//if (!CpuMetadata::IsExtendedOpcode(opcode))
@@ -431,6 +449,11 @@ private:
 
 		Push16(PC);
 		PC = address;
+
+		if (m_pSamplingProfiler)
+		{
+			m_pSamplingProfiler->OnCall(address, SP);
+		}
 	}
 
 	void CallI(Uint16 address)
@@ -443,6 +466,10 @@ private:
 	void Ret()
 	{
 		GetAnalyzer()->OnPreReturn(m_PCAtInstructionStart);
+		if (m_pSamplingProfiler)
+		{
+			m_pSamplingProfiler->OnReturn(SP);
+		}
 		PC = Pop16();
 		GetAnalyzer()->OnPostReturn();
 	}
@@ -1005,7 +1032,7 @@ private:
 		// Starting a new instruction, so bookmark this memory location in case we need to know where we started from for analysis purposes
 		m_PCAtInstructionStart = PC;
 
-		Uint8 opcode = Fetch8();
+		Uint8 opcode = Fetch8(RomCoverage::Access::Opcode);
 		bool unknownOpcode = false;
 
 		Sint32 instructionCycles = -1; // number of clock cycles used by the opcode
@@ -1282,7 +1309,7 @@ private:
 
 		case 0xCB: // Extended opcodes
 			{
-				opcode = Fetch8();
+				opcode = Fetch8(RomCoverage::Access::Opcode);
 				switch (opcode)
 				{
 					OPCODE(0x00, 8, RLC_CB_0__0_7)
@@ -1677,16 +1704,20 @@ private:
 	//	return m_pMemory->Read16(address);
 	//}
 
-	Uint8 Fetch8()
+	Uint8 Fetch8(RomCoverage::Access access = RomCoverage::Access::Operand)
 	{
+		m_pRomCoverage->SetAccess(access);
 		auto result = m_pMemory->Read8(PC);
+		m_pRomCoverage->SetAccess(RomCoverage::Access::Data);
 		++PC;
 		return result;
 	}
 
 	Uint16 Fetch16()
 	{
+		m_pRomCoverage->SetAccess(RomCoverage::Access::Operand);
 		auto result = m_pMemory->Read16(PC);
+		m_pRomCoverage->SetAccess(RomCoverage::Access::Data);
 		PC += 2;
 		return result;
 	}
@@ -1861,4 +1892,6 @@ private:
 	Uint32 m_totalExecutedOpcodes;
 
 	std::shared_ptr<MemoryBus> m_pMemory;
+	SamplingProfiler* m_pSamplingProfiler;
+	RomCoverage* m_pRomCoverage;
 };
@@ -192,6 +192,19 @@ namespace CpuMetadata
 		return opcode == 0xCB;
 	}
 
+	OperandFormat GetOperandFormat(const std::string& operand)
+	{
+		if (operand.empty()) return OperandFormat::None;
+		if (operand == "n") return OperandFormat::Immediate8;
+		if (operand == "nn") return OperandFormat::Immediate16;
+		if (operand == "n_rel") return OperandFormat::Relative8;
+		if (operand == "(n_high)") return OperandFormat::HighPageIndirect8;
+		if (operand == "(nn)") return OperandFormat::Indirect16;
+		if (operand[0] == '(') return OperandFormat::RegisterIndirect;
+		if ((operand[0] >= '0') && (operand[0] <= '9')) return OperandFormat::Constant;
+		return OperandFormat::Named;
+	}
+
 	void ParseMnemonic(const char* fullMnemonic, OpcodeMetadata& meta)
 	{
         SDL_assert(false && "fixme: single-operand instructions like CP A use a single input operand, INC HL have a single inout operand, etc.");
@@ -242,6 +255,9 @@ namespace CpuMetadata
 			meta.outputs.push_back(meta.directOutput);
 		}
 
+		meta.directInputFormat = GetOperandFormat(meta.directInput);
+		meta.directOutputFormat = GetOperandFormat(meta.directOutput);
+
 		// Process special cases
 		// @TODO: many special cases here. Many instructions have implicit operands (e.g. A in the CP instructions, inout semantics for LDI/LDH, etc.)
 		// We need to see how far we want/can go with analysis here.
@@ -7,11 +7,28 @@
 
 namespace CpuMetadata
 {
+	// What a direct operand is, from its text in the mnemonic, so that tools can handle each kind by index rather than by
+	// comparing strings
+	enum class OperandFormat : Uint8
+	{
+		None,
+		Named, // a register or condition: A, HL, NZ...
+		Constant, // a bit number or restart vector
+		RegisterIndirect, // (BC), (DE), (HL), or (C) in the high page
+		Immediate8, // n
+		Immediate16, // nn
+		Relative8, // n_rel
+		HighPageIndirect8, // (n_high)
+		Indirect16, // (nn)
+	};
+
 	struct OpcodeMetadata
 	{
 		OpcodeMetadata()
 			: size(0)
 			, illegal(false)
+			, directInputFormat(OperandFormat::None)
+			, directOutputFormat(OperandFormat::None)
 		{
 		}
 
@@ -31,6 +48,8 @@ namespace CpuMetadata
 		// Uint8 cycles; // this is conditional
 		Uint8 size;
 		bool illegal;
+		OperandFormat directInputFormat;
+		OperandFormat directOutputFormat;
 
 		bool HasDirectInput() const { return !directInput.empty(); }
 		bool HasDirectOutput() const { return !directOutput.empty(); }
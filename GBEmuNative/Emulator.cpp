@@ -1,4 +1,10 @@
 #include "GameBoy.h"
+#include "GameBoyPair.h"
+#include "GuestProfile.h"
+#include "HostInput.h"
+#include "TestRomRunner.h"
+#include "TraceFilter.h"
+#include "TraceLog.h"
 #include "Utils.h"
 
 #include "SDL.h"
@@ -12,7 +18,465 @@
 #include <Windows.h>
 #include <direct.h>
 
-float g_totalCyclesExecuted = 0.0f;
+// Measures band-limited synthesis throughput for each quality tier and a few output rates, with a dense stream of amplitude
+// changes (a 4-cycle square wave, the fastest a channel can toggle, on top of a slow one)
+void BenchmarkAudioSynthesis()
+{
+	static const BlipBuffer::Quality qualities[] = { BlipBuffer::Quality::Fast, BlipBuffer::Quality::High };
+	static const char* qualityNames[] = { "fast", "high" };
+	static const int frequencies[] = { 22050, 32000, 44100, 48000 };
+	static const int emulatedSeconds = 10;
+	static const int cyclesPerFrame = 16384;
+
+	for (size_t qualityIndex = 0; qualityIndex < ARRAY_SIZE(qualities); ++qualityIndex)
+	{
+		for (size_t frequencyIndex = 0; frequencyIndex < ARRAY_SIZE(frequencies); ++frequencyIndex)
+		{
+			int frequency = frequencies[frequencyIndex];
+			BlipBuffer blipBuffer(Sound::GetMaxSamplesPerSoundFrame(frequency), qualities[qualityIndex]);
+			blipBuffer.SetRates(MemoryBus::kCyclesPerSecond, frequency);
+			std::vector<Sint16> samples(Sound::GetMaxSamplesPerSoundFrame(frequency));
+
+			Sint64 numSamples = 0;
+			Sint64 numDeltas = 0;
+			auto startMicroseconds = GetMicroseconds();
+			for (Uint32 frame = 0; frame < emulatedSeconds * MemoryBus::kCyclesPerSecond / cyclesPerFrame; ++frame)
+			{
+				for (Uint32 cycle = 0; cycle < cyclesPerFrame; cycle += 4)
+				{
+					blipBuffer.AddDelta(cycle, ((cycle & 4) != 0) ? 1000 : -1000);
+					++numDeltas;
+					if ((cycle & 0x3FF) == 0)
+					{
+						blipBuffer.AddDelta(cycle, ((cycle & 0x400) != 0) ? 8000 : -8000);
+						++numDeltas;
+					}
+				}
+				blipBuffer.EndFrame(cyclesPerFrame);
+				numSamples += blipBuffer.ReadSamples(samples.data(), static_cast<int>(samples.size()), 1);
+			}
+			auto seconds = (GetMicroseconds() - startMicroseconds) / 1000000.0f;
+
+			printf("%s %5dHz: %6.1f M samples/s, %6.1f M deltas/s, %6.0fx real time\n", qualityNames[qualityIndex], frequency,
+				numSamples / seconds / 1000000.0f, numDeltas / seconds / 1000000.0f, emulatedSeconds / seconds);
+		}
+	}
+}
+
+// Measures the whole APU against its reference stepping, which advances the generators one cycle at a time through the same
+// code, and checks that the two give the same output.  All four channels play a new note every frame, with the noise
+// channel over most of its range, and time is passed in instruction-sized steps as the emulator does.  Returns whether the
+// outputs matched.
+bool BenchmarkApu()
+{
+	static const int emulatedSeconds = 10;
+	static const int instructionCycles[] = { 4, 8, 12, 4, 16, 8, 24, 4, 20, 12 };
+	static const char* fileNames[] = { "benchmark_apu.wav", "benchmark_apu_reference.wav" };
+
+	float seconds[ARRAY_SIZE(fileNames)];
+	for (size_t run = 0; run < ARRAY_SIZE(fileNames); ++run)
+	{
+		Sound::OutputSettings audioSettings;
+		audioSettings.openDevice = false;
+		audioSettings.stepEveryCycle = (run == 1);
+		Sound sound(audioSettings);
+		sound.StartWavCapture(fileNames[run], false);
+		srand(1); // for the noise channel
+
+		auto write = [&sound](Sound::Registers reg, Uint8 value)
+		{
+			sound.HandleRequest(MemoryRequestType::Write, static_cast<Uint16>(reg), value);
+		};
+		write(Sound::Registers::NR52, 0x80);
+		write(Sound::Registers::NR51, 0xFF);
+		write(Sound::Registers::NR50, 0x77);
+		for (Uint16 offset = 0; offset < Sound::kWaveRamSize; ++offset)
+		{
+			Uint8 value = static_cast<Uint8>((offset * 17) ^ 0x5A);
+			sound.HandleRequest(MemoryRequestType::Write, Sound::kWaveRamBase + offset, value);
+		}
+
+		static const Uint32 cyclesPerNote = MemoryBus::kCyclesPerSecond / 60;
+		Uint32 instruction = 0;
+		auto startMicroseconds = GetMicroseconds();
+		for (Uint32 note = 0; note < emulatedSeconds * 60; ++note)
+		{
+			auto ch1Frequency = 1200 + (note * 37) % 800;
+			auto ch2Frequency = 1500 + (note * 53) % 500;
+			auto ch3Frequency = 1000 + (note * 71) % 1000;
+			write(Sound::Registers::NR10, ((note % 4) != 0) ? 0x15 : 0x00);
+			write(Sound::Registers::NR11, 0x80 | (note % 64));
+			write(Sound::Registers::NR12, 0xF3);
+			write(Sound::Registers::NR13, ch1Frequency & 0xFF);
+			write(Sound::Registers::NR14, 0x80 | (((note % 3) != 0) ? 0x40 : 0) | (ch1Frequency >> 8));
+			write(Sound::Registers::NR21, 0x40 | (note % 64));
+			write(Sound::Registers::NR22, 0xA5);
+			write(Sound::Registers::NR23, ch2Frequency & 0xFF);
+			write(Sound::Registers::NR24, 0x80 | (ch2Frequency >> 8));
+			write(Sound::Registers::NR30, 0x80);
+			write(Sound::Registers::NR31, note % 256);
+			write(Sound::Registers::NR32, 0x20 << (note % 2));
+			write(Sound::Registers::NR33, ch3Frequency & 0xFF);
+			write(Sound::Registers::NR34, 0x80 | (ch3Frequency >> 8));
+			write(Sound::Registers::NR41, note % 64);
+			write(Sound::Registers::NR42, 0xC2);
+			write(Sound::Registers::NR43, (note * 29) % 0x78);
+			write(Sound::Registers::NR44, 0x80 | (((note % 5) != 0) ? 0 : 0x40));
+
+			for (Uint32 cycle = 0; cycle < cyclesPerNote;)
+			{
+				auto cycles = instructionCycles[instruction++ % ARRAY_SIZE(instructionCycles)];
+				sound.Update(cycles);
+				cycle += cycles;
+			}
+		}
+		sound.StopWavCapture();
+		seconds[run] = (GetMicroseconds() - startMicroseconds) / 1000000.0f;
+
+		printf("APU, %s: %6.1f ns per emulated cycle, %6.0fx real time\n", audioSettings.stepEveryCycle ? "every cycle" : "bulk       ",
+			seconds[run] * 1000000000.0f / (emulatedSeconds * static_cast<float>(MemoryBus::kCyclesPerSecond)), emulatedSeconds / seconds[run]);
+	}
+
+	std::vector<Uint8> output;
+	std::vector<Uint8> referenceOutput;
+	LoadFileAsByteArray(output, fileNames[0]);
+	LoadFileAsByteArray(referenceOutput, fileNames[1]);
+	auto matched = (output == referenceOutput);
+	for (auto pFileName : fileNames)
+	{
+		remove(pFileName);
+	}
+
+	printf("APU bulk stepping is %.1fx faster than every cycle; output %s\n", seconds[1] / SDL_max(seconds[0], 0.000001f), matched ? "identical" : "DIFFERENT");
+	return matched;
+}
+
+// Runs a headless Game Boy up to the given cycle, in slices of a frame's time or so, as fast as the host allows
+void RunToCycle(GameBoy& gb, Uint64 cycle)
+{
+	static const Uint64 cyclesPerUpdate = MemoryBus::kCyclesPerSecond / 60;
+	while (gb.GetCycles() < cycle)
+	{
+		auto cycles = SDL_min(cycle - gb.GetCycles(), cyclesPerUpdate);
+		gb.Update(static_cast<float>(cycles) / MemoryBus::kCyclesPerSecond);
+	}
+}
+
+// Renders the given length of a ROM's audio to a WAV file as fast as the host allows, with no window, audio device or real-time
+// pacing, then reports how many times faster than real time that was
+void RenderAudioToWav(const char* pRomFileName, Sound::OutputSettings audioSettings, const char* pWavFileName, float seconds, bool channelStems)
+{
+	audioSettings.openDevice = false;
+	GameBoy gb(pRomFileName, nullptr, audioSettings);
+	gb.SetFrameSkip(Lcd::kSkipAllFrames);
+	gb.StartWavCapture(pWavFileName, channelStems);
+
+	// The length is turned into a cycle once, so that the emulator's own clock, not a running sum of float seconds, says when
+	// it is reached
+	auto startMicroseconds = GetMicroseconds();
+	RunToCycle(gb, static_cast<Uint64>(static_cast<double>(seconds) * MemoryBus::kCyclesPerSecond));
+	gb.StopWavCapture();
+	auto elapsedSeconds = (GetMicroseconds() - startMicroseconds) / 1000000.0f;
+
+	printf("Rendered %.1fs of audio to %s%s in %.2fs, %.1fx real time\n", seconds, pWavFileName, channelStems ? " (with channel stems)" : "",
+		elapsedSeconds, seconds / SDL_max(elapsedSeconds, 0.000001f));
+}
+
+// Writes where the guest spent its time, for pprof if the file name ends in .pb or .pprof, for KCachegrind otherwise
+void WriteProfile(GameBoy& gb, const char* pProfileFileName)
+{
+	GuestProfile profile;
+	gb.GetProfile(profile);
+
+	auto length = strlen(pProfileFileName);
+	if (((length >= 3) && (_stricmp(pProfileFileName + length - 3, ".pb") == 0))
+		|| ((length >= 6) && (_stricmp(pProfileFileName + length - 6, ".pprof") == 0)))
+	{
+		profile.WritePprof(pProfileFileName);
+	}
+	else
+	{
+		profile.WriteCallgrind(pProfileFileName);
+	}
+}
+
+// Writes the samples taken since StartSamplingProfiler() as folded stacks
+void WriteSamplingProfile(GameBoy& gb, const char* pFileName)
+{
+	auto pSamplingProfiler = gb.StopSamplingProfiler();
+	pSamplingProfiler->WriteFoldedStacks(pFileName);
+	printf("Wrote %u samples to %s", pSamplingProfiler->GetNumSamples(), pFileName);
+	if (pSamplingProfiler->GetNumDroppedSamples() > 0)
+	{
+		printf(" (%u more dropped, the buffer was full)", pSamplingProfiler->GetNumDroppedSamples());
+	}
+	printf("\n");
+}
+
+// Writes which ROM bytes were run as code and read as data, and prints a summary per bank
+void WriteRomCoverage(const GameBoy& gb, const char* pFileName)
+{
+	gb.GetRomCoverage().Save(pFileName);
+	printf("ROM coverage written to %s:\n%s", pFileName, gb.GetRomCoverage().GetSummary().c_str());
+}
+
+// Hashes every frame a Game Boy shows, and all of them together, for telling whether two runs diverged.  Every frame is
+// rendered, synchronously unless asked otherwise, and each is complete when hashed.  Per-frame hashes are optionally written
+// out, one "<frame> <hash>" line per frame, for diffing.
+class FrameHasher
+{
+public:
+	FrameHasher(GameBoy& gb, FILE* pFrameHashFile = nullptr, bool asyncRendering = false)
+		: m_gb(gb)
+		, m_pFrameHashFile(pFrameHashFile)
+		, m_numFrames(0)
+		, m_frameHash(0)
+		, m_hashedFrameBufferVersion(0)
+		, m_combinedHash(Movie::kHashSeed)
+	{
+		gb.SetFrameSkip(0);
+		gb.SetAsyncRendering(asyncRendering);
+		gb.SetFrameCallback([this] { OnFrame(); });
+	}
+
+	Uint32 GetNumFrames() const
+	{
+		return m_numFrames;
+	}
+
+	Uint64 GetCombinedHash() const
+	{
+		return m_combinedHash;
+	}
+
+private:
+	void OnFrame()
+	{
+		// An asynchronously rendered frame would otherwise only be picked up at the start of the next one
+		if (m_gb.IsAsyncRendering())
+		{
+			m_gb.FinishAsyncRendering();
+		}
+
+		// The frame buffer only needs hashing again if it changed
+		if ((m_numFrames == 0) || (m_gb.GetFrameBufferVersion() != m_hashedFrameBufferVersion))
+		{
+			m_frameHash = Movie::Hash(m_gb.GetFrameBufferPixels(), Lcd::kScreenWidth * Lcd::kScreenHeight * sizeof(Uint32));
+			m_hashedFrameBufferVersion = m_gb.GetFrameBufferVersion();
+		}
+		m_combinedHash = Movie::Hash(&m_frameHash, sizeof(m_frameHash), m_combinedHash);
+		if (m_pFrameHashFile)
+		{
+			fprintf(m_pFrameHashFile, "%u %016llx\n", m_numFrames, m_frameHash);
+		}
+		++m_numFrames;
+	}
+
+	GameBoy& m_gb;
+	FILE* m_pFrameHashFile;
+	Uint32 m_numFrames;
+	Uint64 m_frameHash;
+	Uint32 m_hashedFrameBufferVersion;
+	Uint64 m_combinedHash;
+};
+
+// Runs a ROM for the given emulated time at each frame skip level F cycles through, with no window, input, audio device or
+// real-time pacing, and prints how many emulated frames per second the host managed at each
+void BenchmarkFrameSkip(const char* pRomFileName, Sound::OutputSettings audioSettings, float seconds)
+{
+	audioSettings.openDevice = false;
+	static const int frameSkipLevels[] = { 0, 3, Lcd::kSkipAllFrames };
+	auto cycles = static_cast<Uint64>(seconds * MemoryBus::kCyclesPerSecond);
+	for (auto frameSkip : frameSkipLevels)
+	{
+		GameBoy gb(pRomFileName, nullptr, audioSettings);
+		gb.SetFrameSkip(frameSkip);
+
+		auto startMicroseconds = GetMicroseconds();
+		RunToCycle(gb, cycles);
+		auto elapsedSeconds = SDL_max((GetMicroseconds() - startMicroseconds) / 1000000.0f, 0.000001f);
+
+		auto emulatedFrames = gb.GetRenderedFrameCount() + gb.GetReusedFrameCount() + gb.GetSkippedFrameCount();
+		printf("Frame skip %-3s: %5u frames (%u rendered, %u reused, %u skipped) in %.2fs, %7.1f emulated FPS, %.1fx real time\n",
+			(frameSkip == Lcd::kSkipAllFrames) ? "all" : Format("%d", frameSkip).c_str(), emulatedFrames, gb.GetRenderedFrameCount(),
+			gb.GetReusedFrameCount(), gb.GetSkippedFrameCount(), elapsedSeconds, emulatedFrames / elapsedSeconds, seconds / elapsedSeconds);
+	}
+}
+
+// Replays a movie with no window, audio device or real-time pacing, hashing every frame so that a replay that diverges from
+// another (or from the recording) shows up at the first frame that differs.
+void PlayMovie(const char* pRomFileName, Sound::OutputSettings audioSettings, const char* pMovieFileName, const char* pFrameHashFileName, const char* pProfileFileName,
+	const char* pSamplingProfileFileName, Uint32 cyclesPerSample, const char* pCoverageFileName)
+{
+	auto movie = Movie::Load(pMovieFileName);
+
+	audioSettings.openDevice = false;
+	GameBoy gb(pRomFileName, nullptr, audioSettings);
+
+	FILE* pFrameHashFile = nullptr;
+	if (pFrameHashFileName && ((fopen_s(&pFrameHashFile, pFrameHashFileName, "w") != 0) || !pFrameHashFile))
+	{
+		throw Exception("Couldn't open frame hash file for writing: %s", pFrameHashFileName);
+	}
+	Janitor closeFrameHashFile([&] { if (pFrameHashFile) fclose(pFrameHashFile); });
+	FrameHasher frameHasher(gb, pFrameHashFile);
+
+	gb.StartMoviePlayback(movie);
+	if (pSamplingProfileFileName)
+	{
+		gb.StartSamplingProfiler(cyclesPerSample);
+	}
+
+	auto startMicroseconds = GetMicroseconds();
+	RunToCycle(gb, movie.GetLengthCycles());
+	auto elapsedSeconds = (GetMicroseconds() - startMicroseconds) / 1000000.0f;
+	auto seconds = static_cast<float>(movie.GetLengthCycles()) / MemoryBus::kCyclesPerSecond;
+
+	printf("Played %.1fs movie %s (%u input events) in %.2fs, %.1fx real time: %u frames, hash %016llx\n", seconds, pMovieFileName,
+		static_cast<Uint32>(movie.GetEvents().size()), elapsedSeconds, seconds / SDL_max(elapsedSeconds, 0.000001f), frameHasher.GetNumFrames(),
+		frameHasher.GetCombinedHash());
+
+	if (pProfileFileName)
+	{
+		WriteProfile(gb, pProfileFileName);
+	}
+
+	if (pSamplingProfileFileName)
+	{
+		WriteSamplingProfile(gb, pSamplingProfileFileName);
+	}
+
+	if (pCoverageFileName)
+	{
+		WriteRomCoverage(gb, pCoverageFileName);
+	}
+}
+
+// Records a movie's input again the way the front end does, setting each change of buttons between updates at the cycle the
+// emulator has got to, then replays that recording with its input queued up front, as --play does.  The two have to give
+// the same frames, or recorded movies would not replay what was played.  Returns whether they did.
+bool CheckMovie(const char* pRomFileName, Sound::OutputSettings audioSettings, const char* pMovieFileName)
+{
+	auto movie = Movie::Load(pMovieFileName);
+	const auto& events = movie.GetEvents();
+	audioSettings.openDevice = false;
+
+	Movie recording;
+	Uint32 numRecordedFrames = 0;
+	Uint64 recordedHash = 0;
+	{
+		GameBoy gb(pRomFileName, nullptr, audioSettings);
+		FrameHasher frameHasher(gb);
+		gb.StartMovieRecording();
+		for (size_t event = 0; gb.GetCycles() < movie.GetLengthCycles();)
+		{
+			while ((event < events.size()) && (events[event].cycle <= gb.GetCycles()))
+			{
+				gb.SetInput(events[event++].buttons);
+			}
+			RunToCycle(gb, (event < events.size()) ? SDL_min(events[event].cycle, movie.GetLengthCycles()) : movie.GetLengthCycles());
+		}
+		recording = gb.StopMovieRecording();
+		numRecordedFrames = frameHasher.GetNumFrames();
+		recordedHash = frameHasher.GetCombinedHash();
+	}
+
+	GameBoy gb(pRomFileName, nullptr, audioSettings);
+	FrameHasher frameHasher(gb);
+	gb.StartMoviePlayback(recording);
+	RunToCycle(gb, recording.GetLengthCycles());
+
+	auto matched = (frameHasher.GetNumFrames() == numRecordedFrames) && (frameHasher.GetCombinedHash() == recordedHash);
+	printf("Recorded %s (%u input events): %u frames, hash %016llx; replayed: %u frames, hash %016llx; %s\n", pMovieFileName,
+		static_cast<Uint32>(recording.GetEvents().size()), numRecordedFrames, recordedHash, frameHasher.GetNumFrames(),
+		frameHasher.GetCombinedHash(), matched ? "match" : "MISMATCH");
+	return matched;
+}
+
+// Runs every test ROM in a directory headless and in parallel, printing each result as it comes in and optionally writing a
+// report (JUnit XML if the file name ends in .xml, JSON otherwise).  Returns the number of ROMs that did not pass.
+int RunTestRoms(const char* pDirectory, const char* pReportFileName, float budgetSeconds, int numThreads)
+{
+	auto romFileNames = TestRomRunner::FindRoms(pDirectory);
+	if (romFileNames.empty())
+	{
+		throw Exception("No test ROMs found in %s", pDirectory);
+	}
+
+	auto startMicroseconds = GetMicroseconds();
+	auto results = TestRomRunner::RunRoms(romFileNames, budgetSeconds, numThreads, [](const TestRomRunner::Result& result)
+	{
+		printf("%-9s %s (%.1fs emulated in %.2fs)%s%s\n", TestRomRunner::GetOutcomeName(result.outcome), result.romFileName.c_str(),
+			result.emulatedSeconds, result.hostSeconds, result.error.empty() ? "" : ": ", result.error.c_str());
+	});
+	auto elapsedSeconds = (GetMicroseconds() - startMicroseconds) / 1000000.0f;
+
+	auto numPassed = TestRomRunner::CountPassed(results);
+	printf("%d of %d test ROMs passed in %.2fs\n", numPassed, static_cast<int>(results.size()), elapsedSeconds);
+
+	if (pReportFileName)
+	{
+		auto length = strlen(pReportFileName);
+		if ((length >= 4) && (_stricmp(pReportFileName + length - 4, ".xml") == 0))
+		{
+			TestRomRunner::WriteJUnitReport(results, pReportFileName);
+		}
+		else
+		{
+			TestRomRunner::WriteJsonReport(results, pReportFileName);
+		}
+	}
+
+	return static_cast<int>(results.size()) - numPassed;
+}
+
+// Parses "[bank:]address" in hex, as used by the trace filter options; without a bank, the address is in any bank
+const char* ParseBankedAddress(const char* pText, int& bank, Uint16& address)
+{
+	char* pEnd = nullptr;
+	auto value = strtoul(pText, &pEnd, 16);
+	bank = TraceFilter::kAnyBank;
+	if (*pEnd == ':')
+	{
+		bank = static_cast<int>(value);
+		pText = pEnd + 1;
+		value = strtoul(pText, &pEnd, 16);
+	}
+	if ((pEnd == pText) || (value > 0xFFFF))
+	{
+		throw Exception("Invalid address: %s", pText);
+	}
+	address = static_cast<Uint16>(value);
+	return pEnd;
+}
+
+// Runs a ROM for the given number of frames' time with every frame rendered synchronously, then again from reset with every
+// frame rendered on the worker thread, with no input either time.  The two have to give the same frames, or asynchronous
+// rendering would change what is shown.  Returns whether they did.
+bool CheckAsyncRendering(const char* pRomFileName, Sound::OutputSettings audioSettings, Uint32 numFrames)
+{
+	audioSettings.openDevice = false;
+	auto cycles = static_cast<Uint64>(numFrames) * Lcd::kCyclesPerLine * Lcd::kLinesPerFrame;
+
+	Uint32 numSyncFrames = 0;
+	Uint64 syncHash = 0;
+	{
+		GameBoy gb(pRomFileName, nullptr, audioSettings);
+		FrameHasher frameHasher(gb);
+		RunToCycle(gb, cycles);
+		numSyncFrames = frameHasher.GetNumFrames();
+		syncHash = frameHasher.GetCombinedHash();
+	}
+
+	GameBoy gb(pRomFileName, nullptr, audioSettings);
+	FrameHasher frameHasher(gb, nullptr, true);
+	RunToCycle(gb, cycles);
+
+	auto matched = (frameHasher.GetNumFrames() == numSyncFrames) && (frameHasher.GetCombinedHash() == syncHash);
+	printf("Rendered %s synchronously: %u frames, hash %016llx; asynchronously: %u frames, hash %016llx; %s\n", pRomFileName,
+		numSyncFrames, syncHash, frameHasher.GetNumFrames(), frameHasher.GetCombinedHash(), matched ? "match" : "MISMATCH");
+	return matched;
+}
 
 int main(int argc, char **argv)
 {
@@ -20,7 +484,255 @@ int main(int argc, char **argv)
 	{
 		if (argc < 3)
 		{
-			throw Exception("Wrong syntax: %s <working directory> <rom>", argv[0]);
+			throw Exception("Wrong syntax: %s <working directory> <rom> [--audio-rate <Hz>] [--audio-quality fast|high] [--audio-thread] [--benchmark-audio] [--benchmark-frame-skip <seconds>] [--wav <file> <seconds> [--stems]] [--record <movie>] [--play <movie> [--frame-hashes <file>]] [--check-movie <movie>] [--check-async-rendering <frames>] [--link <rom>] [--test-roms [--report <file>] [--jobs <n>] [--budget <seconds>]] [--trace-range [<bank>:]<first>-<last>] [--trace-function [<bank>:]<address>] [--trace-watch <address> <count>] [--decode-trace <text file> [--trace-frames <first> <count>]] [--profile <file>] [--sample-profile <file> [--sample-period <cycles>]] [--coverage <file>]", argv[0]);
+		}
+
+		Sound::OutputSettings audioSettings;
+		bool benchmarkAudio = false;
+		float frameSkipBenchmarkSeconds = 0.0f;
+		const char* pWavFileName = nullptr;
+		float wavSeconds = 0.0f;
+		bool wavStems = false;
+		const char* pRecordMovieFileName = nullptr;
+		const char* pPlayMovieFileName = nullptr;
+		const char* pFrameHashFileName = nullptr;
+		const char* pCheckMovieFileName = nullptr;
+		Uint32 numAsyncCheckFrames = 0;
+		const char* pLinkRomFileName = nullptr;
+		bool runTestRoms = false;
+		const char* pReportFileName = nullptr;
+		int numTestThreads = 0;
+		float testBudgetSeconds = 120.0f;
+		TraceFilter traceFilter;
+		const char* pDecodedTraceFileName = nullptr;
+		Uint32 firstTraceFrame = 0;
+		Uint32 numTraceFrames = TraceLog::kAllFrames;
+		const char* pProfileFileName = nullptr;
+		const char* pSamplingProfileFileName = nullptr;
+		Uint32 cyclesPerSample = 4096;
+		const char* pCoverageFileName = nullptr;
+		for (int arg = 3; arg < argc; ++arg)
+		{
+			if ((strcmp(argv[arg], "--audio-rate") == 0) && (arg + 1 < argc))
+			{
+				audioSettings.frequency = atoi(argv[++arg]);
+			}
+			else if ((strcmp(argv[arg], "--audio-quality") == 0) && (arg + 1 < argc))
+			{
+				++arg;
+				if (strcmp(argv[arg], "fast") == 0)
+				{
+					audioSettings.quality = BlipBuffer::Quality::Fast;
+				}
+				else if (strcmp(argv[arg], "high") == 0)
+				{
+					audioSettings.quality = BlipBuffer::Quality::High;
+				}
+				else
+				{
+					throw Exception("Unknown audio quality: %s", argv[arg]);
+				}
+			}
+			else if (strcmp(argv[arg], "--audio-thread") == 0)
+			{
+				audioSettings.threadedSynthesis = true;
+			}
+			else if (strcmp(argv[arg], "--benchmark-audio") == 0)
+			{
+				benchmarkAudio = true;
+			}
+			else if ((strcmp(argv[arg], "--benchmark-frame-skip") == 0) && (arg + 1 < argc))
+			{
+				frameSkipBenchmarkSeconds = static_cast<float>(atof(argv[++arg]));
+				if (frameSkipBenchmarkSeconds <= 0.0f)
+				{
+					throw Exception("Invalid benchmark length: %s", argv[arg]);
+				}
+			}
+			else if ((strcmp(argv[arg], "--wav") == 0) && (arg + 2 < argc))
+			{
+				pWavFileName = argv[++arg];
+				wavSeconds = static_cast<float>(atof(argv[++arg]));
+				if (wavSeconds <= 0.0f)
+				{
+					throw Exception("Invalid WAV length: %s", argv[arg]);
+				}
+			}
+			else if (strcmp(argv[arg], "--stems") == 0)
+			{
+				wavStems = true;
+			}
+			else if ((strcmp(argv[arg], "--record") == 0) && (arg + 1 < argc))
+			{
+				pRecordMovieFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--play") == 0) && (arg + 1 < argc))
+			{
+				pPlayMovieFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--frame-hashes") == 0) && (arg + 1 < argc))
+			{
+				pFrameHashFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--check-movie") == 0) && (arg + 1 < argc))
+			{
+				pCheckMovieFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--check-async-rendering") == 0) && (arg + 1 < argc))
+			{
+				numAsyncCheckFrames = atoi(argv[++arg]);
+				if (numAsyncCheckFrames == 0)
+				{
+					throw Exception("Invalid frame count: %s", argv[arg]);
+				}
+			}
+			else if ((strcmp(argv[arg], "--link") == 0) && (arg + 1 < argc))
+			{
+				pLinkRomFileName = argv[++arg];
+			}
+			else if (strcmp(argv[arg], "--test-roms") == 0)
+			{
+				runTestRoms = true;
+			}
+			else if ((strcmp(argv[arg], "--report") == 0) && (arg + 1 < argc))
+			{
+				pReportFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--jobs") == 0) && (arg + 1 < argc))
+			{
+				numTestThreads = atoi(argv[++arg]);
+			}
+			else if ((strcmp(argv[arg], "--budget") == 0) && (arg + 1 < argc))
+			{
+				testBudgetSeconds = static_cast<float>(atof(argv[++arg]));
+				if (testBudgetSeconds <= 0.0f)
+				{
+					throw Exception("Invalid test budget: %s", argv[arg]);
+				}
+			}
+			else if ((strcmp(argv[arg], "--trace-range") == 0) && (arg + 1 < argc))
+			{
+				int bank;
+				Uint16 firstAddress, lastAddress;
+				auto pText = ParseBankedAddress(argv[++arg], bank, firstAddress);
+				if (*pText != '-')
+				{
+					throw Exception("Invalid trace range: %s", argv[arg]);
+				}
+				int lastBank;
+				if ((*ParseBankedAddress(pText + 1, lastBank, lastAddress) != '\0') || (lastBank != TraceFilter::kAnyBank))
+				{
+					throw Exception("Invalid trace range: %s", argv[arg]);
+				}
+				traceFilter.AddAddressRange(bank, firstAddress, lastAddress);
+			}
+			else if ((strcmp(argv[arg], "--trace-function") == 0) && (arg + 1 < argc))
+			{
+				int bank;
+				Uint16 address;
+				if (*ParseBankedAddress(argv[++arg], bank, address) != '\0')
+				{
+					throw Exception("Invalid function address: %s", argv[arg]);
+				}
+				traceFilter.SetFunction(bank, address);
+			}
+			else if ((strcmp(argv[arg], "--trace-watch") == 0) && (arg + 2 < argc))
+			{
+				int bank;
+				Uint16 address;
+				if ((*ParseBankedAddress(argv[++arg], bank, address) != '\0') || (bank != TraceFilter::kAnyBank))
+				{
+					throw Exception("Invalid watchpoint address: %s", argv[arg]);
+				}
+				traceFilter.SetWatchpoint(address, static_cast<Uint32>(strtoul(argv[++arg], nullptr, 10)));
+			}
+			else if ((strcmp(argv[arg], "--decode-trace") == 0) && (arg + 1 < argc))
+			{
+				pDecodedTraceFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--trace-frames") == 0) && (arg + 2 < argc))
+			{
+				firstTraceFrame = static_cast<Uint32>(strtoul(argv[++arg], nullptr, 10));
+				numTraceFrames = static_cast<Uint32>(strtoul(argv[++arg], nullptr, 10));
+				if (numTraceFrames == 0)
+				{
+					throw Exception("Invalid trace frame count: %s", argv[arg]);
+				}
+			}
+			else if ((strcmp(argv[arg], "--profile") == 0) && (arg + 1 < argc))
+			{
+				pProfileFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--sample-profile") == 0) && (arg + 1 < argc))
+			{
+				pSamplingProfileFileName = argv[++arg];
+			}
+			else if ((strcmp(argv[arg], "--sample-period") == 0) && (arg + 1 < argc))
+			{
+				cyclesPerSample = static_cast<Uint32>(strtoul(argv[++arg], nullptr, 10));
+				if (cyclesPerSample == 0)
+				{
+					throw Exception("Invalid sampling period: %s", argv[arg]);
+				}
+			}
+			else if ((strcmp(argv[arg], "--coverage") == 0) && (arg + 1 < argc))
+			{
+				pCoverageFileName = argv[++arg];
+			}
+			else
+			{
+				throw Exception("Unknown option: %s", argv[arg]);
+			}
+		}
+
+		if (wavStems && !pWavFileName)
+		{
+			throw Exception("--stems needs --wav");
+		}
+
+		if (pFrameHashFileName && !pPlayMovieFileName)
+		{
+			throw Exception("--frame-hashes needs --play");
+		}
+
+		if ((pRecordMovieFileName != nullptr) + (pPlayMovieFileName != nullptr) + (pCheckMovieFileName != nullptr) + (numAsyncCheckFrames != 0) > 1)
+		{
+			throw Exception("--record, --play, --check-movie and --check-async-rendering can't be used together");
+		}
+
+		if (pLinkRomFileName && (pRecordMovieFileName || pPlayMovieFileName || pCheckMovieFileName))
+		{
+			throw Exception("--link can't be used with movies");
+		}
+
+		if ((firstTraceFrame || (numTraceFrames != TraceLog::kAllFrames)) && !pDecodedTraceFileName)
+		{
+			throw Exception("--trace-frames needs --decode-trace");
+		}
+
+		if ((traceFilter.HasAddressRanges() || traceFilter.HasFunction() || traceFilter.HasWatchpoint()) && !ENABLE_ANALYZER)
+		{
+			throw Exception("--trace-range, --trace-function and --trace-watch need a build with ENABLE_ANALYZER set");
+		}
+
+		if (pProfileFileName && !ENABLE_ANALYZER)
+		{
+			throw Exception("--profile needs a build with ENABLE_ANALYZER set");
+		}
+
+		if (pCoverageFileName && !RomCoverage::IsEnabled())
+		{
+			throw Exception("--coverage needs a build with ENABLE_ROM_COVERAGE set");
+		}
+
+		if ((cyclesPerSample != 4096) && !pSamplingProfileFileName)
+		{
+			throw Exception("--sample-period needs --sample-profile");
+		}
+
+		if ((pReportFileName || numTestThreads || (testBudgetSeconds != 120.0f)) && !runTestRoms)
+		{
+			throw Exception("--report, --jobs and --budget need --test-roms");
 		}
 
 		{
@@ -36,6 +748,51 @@ int main(int argc, char **argv)
 
 		SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
 
+		if (benchmarkAudio)
+		{
+			BenchmarkAudioSynthesis();
+			return BenchmarkApu() ? 0 : 1;
+		}
+
+		if (frameSkipBenchmarkSeconds > 0.0f)
+		{
+			BenchmarkFrameSkip(argv[2], audioSettings, frameSkipBenchmarkSeconds);
+			return 0;
+		}
+
+		if (pWavFileName)
+		{
+			RenderAudioToWav(argv[2], audioSettings, pWavFileName, wavSeconds, wavStems);
+			return 0;
+		}
+
+		if (pDecodedTraceFileName)
+		{
+			TraceLog::Decode(argv[2], pDecodedTraceFileName, firstTraceFrame, numTraceFrames);
+			return 0;
+		}
+
+		if (runTestRoms)
+		{
+			return (RunTestRoms(argv[2], pReportFileName, testBudgetSeconds, numTestThreads) == 0) ? 0 : 1;
+		}
+
+		if (pPlayMovieFileName)
+		{
+			PlayMovie(argv[2], audioSettings, pPlayMovieFileName, pFrameHashFileName, pProfileFileName, pSamplingProfileFileName, cyclesPerSample, pCoverageFileName);
+			return 0;
+		}
+
+		if (pCheckMovieFileName)
+		{
+			return CheckMovie(argv[2], audioSettings, pCheckMovieFileName) ? 0 : 1;
+		}
+
+		if (numAsyncCheckFrames)
+		{
+			return CheckAsyncRendering(argv[2], audioSettings, numAsyncCheckFrames) ? 0 : 1;
+		}
+
 		if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_JOYSTICK | SDL_INIT_GAMECONTROLLER) < 0)
 		{
 			throw Exception("Couldn't initialize SDL: %s", SDL_GetError());
@@ -43,7 +800,9 @@ int main(int argc, char **argv)
 
 		Janitor j([] { SDL_Quit(); });
 
-		std::shared_ptr<SDL_Window> pWindow(SDL_CreateWindow("GBEmu", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, Lcd::kScreenWidth * 4, Lcd::kScreenHeight * 4, 0), SDL_DestroyWindow);
+		// With --link, the second Game Boy is shown to the right of the first
+		auto numScreens = pLinkRomFileName ? 2 : 1;
+		std::shared_ptr<SDL_Window> pWindow(SDL_CreateWindow("GBEmu", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, Lcd::kScreenWidth * 4 * numScreens, Lcd::kScreenHeight * 4, 0), SDL_DestroyWindow);
 		if (!pWindow)
 		{
 			throw Exception("Couldn't create window");
@@ -56,7 +815,31 @@ int main(int argc, char **argv)
 			throw Exception("Couldn't create renderer");
 		}
 
-		GameBoy gb(argv[2], pRenderer.get());
+		GameBoy gb(argv[2], pRenderer.get(), audioSettings);
+		gb.SetTraceFilter(traceFilter);
+		HostInput hostInput;
+
+		// The second Game Boy only has a window and input; its audio is not played.  L switches which one the input goes to.
+		std::unique_ptr<GameBoy> pLinkedGb;
+		std::unique_ptr<GameBoyPair> pGameBoyPair;
+		auto inputIndex = 0;
+		if (pLinkRomFileName)
+		{
+			auto linkedAudioSettings = audioSettings;
+			linkedAudioSettings.openDevice = false;
+			pLinkedGb.reset(new GameBoy(pLinkRomFileName, pRenderer.get(), linkedAudioSettings));
+			pGameBoyPair.reset(new GameBoyPair(gb, *pLinkedGb));
+		}
+
+		if (pSamplingProfileFileName)
+		{
+			gb.StartSamplingProfiler(cyclesPerSample);
+		}
+
+		if (pRecordMovieFileName)
+		{
+			gb.StartMovieRecording();
+		}
 
 		const auto& gameName = gb.GetRom().GetRomName();
 		SDL_SetWindowTitle(pWindow.get(), gameName.c_str());
@@ -69,6 +852,11 @@ int main(int argc, char **argv)
 		auto lastPrintMicroseconds = static_cast<int64_t>(0);
 		auto paused = false;
 
+		// Frame skip levels cycled through with F; the emulated frame rate shown in the title measures throughput at each level
+		static const int frameSkipLevels[] = { 0, 3, Lcd::kSkipAllFrames };
+		auto frameSkipLevelIndex = 0;
+		auto lastPrintEmulatedFrames = static_cast<Uint32>(0);
+
 		while (!done)
 		{
 			SDL_Event event;
@@ -98,6 +886,20 @@ int main(int argc, char **argv)
 						case SDLK_p:
 							paused = !paused;
 							break;
+						case SDLK_f:
+							frameSkipLevelIndex = (frameSkipLevelIndex + 1) % ARRAY_SIZE(frameSkipLevels);
+							gb.SetFrameSkip(frameSkipLevels[frameSkipLevelIndex]);
+							break;
+						case SDLK_t:
+							gb.SetAsyncRendering(!gb.IsAsyncRendering());
+							break;
+						case SDLK_l:
+							if (pGameBoyPair)
+							{
+								pGameBoyPair->GetGameBoy(inputIndex).SetInput(0);
+								inputIndex = 1 - inputIndex;
+							}
+							break;
 						}
 					}
 					break;
@@ -117,24 +919,82 @@ int main(int argc, char **argv)
 			static float maxTimeStep = 0.1f;
 			seconds = SDL_min(seconds, maxTimeStep);
 
+			// Fast-forward while Tab is held
+			static float fastForwardRate = 8.0f;
+			auto emulatedSeconds = SDL_GetKeyboardState(nullptr)[SDL_SCANCODE_TAB] ? (seconds * fastForwardRate) : seconds;
+
 			static float averagingRate = 0.3f;
 			averageSeconds = (averageSeconds > 0.0f) ? (averageSeconds * (1.0f - averagingRate) + (seconds * averagingRate)) : seconds;
 			if (microseconds - lastPrintMicroseconds > 200000)
 			{
-				SDL_SetWindowTitle(pWindow.get(), Format("%s - %3.1f FPS", gameName.c_str(), 1.0f / averageSeconds).c_str());
+				auto emulatedFrames = gb.GetRenderedFrameCount() + gb.GetReusedFrameCount() + gb.GetSkippedFrameCount();
+				auto emulatedFps = (emulatedFrames - lastPrintEmulatedFrames) * 1000000.0f / (microseconds - lastPrintMicroseconds);
+				auto frameSkip = gb.GetFrameSkip();
+				auto title = Format("%s - %3.1f FPS - %3.1f emulated FPS (skip %s%s) - audio %3.1fms x%1.4f, %u underruns",
+					gameName.c_str(), 1.0f / averageSeconds, emulatedFps, (frameSkip == Lcd::kSkipAllFrames) ? "all" : Format("%d", frameSkip).c_str(),
+					gb.IsAsyncRendering() ? ", async" : "", gb.GetAudioQueuedMilliseconds(), gb.GetAudioRateRatio(), gb.GetAudioUnderrunCount());
+				if (pGameBoyPair)
+				{
+					const auto& linkStatistics = pGameBoyPair->GetLinkStatistics();
+					title += Format(" - link: input to %d, %u transfers, %u stalls, %u late", inputIndex + 1, linkStatistics.transferCount,
+						linkStatistics.stallCount, linkStatistics.lateTransferCount);
+				}
+				SDL_SetWindowTitle(pWindow.get(), title.c_str());
 				//printf("%3.1f FPS\n", 1.0f / averageSeconds);
 				lastPrintMicroseconds = microseconds;
+				lastPrintEmulatedFrames = emulatedFrames;
 			}
 
 			if (!paused)
 			{
-				gb.Update(seconds);
+				if (pGameBoyPair)
+				{
+					pGameBoyPair->GetGameBoy(inputIndex).SetInput(hostInput.GetButtons());
+					pGameBoyPair->Update(emulatedSeconds);
+				}
+				else
+				{
+					gb.SetInput(hostInput.GetButtons());
+					gb.Update(emulatedSeconds);
+				}
 			}
 
 		    SDL_RenderClear(pRenderer.get());
-		    SDL_RenderCopy(pRenderer.get(), gb.GetFrontFrameBufferTexture(), NULL, NULL);
+			if (pGameBoyPair)
+			{
+				int windowWidth, windowHeight;
+				SDL_GetWindowSize(pWindow.get(), &windowWidth, &windowHeight);
+				SDL_Rect leftRect = { 0, 0, windowWidth / 2, windowHeight };
+				SDL_Rect rightRect = { windowWidth / 2, 0, windowWidth / 2, windowHeight };
+				SDL_RenderCopy(pRenderer.get(), gb.GetFrontFrameBufferTexture(), NULL, &leftRect);
+				SDL_RenderCopy(pRenderer.get(), pLinkedGb->GetFrontFrameBufferTexture(), NULL, &rightRect);
+			}
+			else
+			{
+				SDL_RenderCopy(pRenderer.get(), gb.GetFrontFrameBufferTexture(), NULL, NULL);
+			}
 		    SDL_RenderPresent(pRenderer.get());
 		}
+
+		if (pRecordMovieFileName)
+		{
+			gb.StopMovieRecording(pRecordMovieFileName);
+		}
+
+		if (pProfileFileName)
+		{
+			WriteProfile(gb, pProfileFileName);
+		}
+
+		if (pSamplingProfileFileName)
+		{
+			WriteSamplingProfile(gb, pSamplingProfileFileName);
+		}
+
+		if (pCoverageFileName)
+		{
+			WriteRomCoverage(gb, pCoverageFileName);
+		}
 	}
 	catch (const Exception& e)
 	{
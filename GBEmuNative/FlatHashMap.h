@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <vector>
+
+// A hash map from unsigned integer keys for lookups on hot paths: one array of slots, linear probing, and no allocation per
+// entry.  The all-ones key is reserved to mark empty slots.  Values move when the map grows, so hold on to keys or indices
+// rather than pointers into it.
+template <typename Key, typename Value>
+class FlatHashMap
+{
+public:
+	static const Key kEmptyKey = static_cast<Key>(~static_cast<Key>(0));
+
+	FlatHashMap()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		static const int initialCapacityBits = 6;
+
+		m_slots.assign(size_t(1) << initialCapacityBits, Slot());
+		m_capacityBits = initialCapacityBits;
+		m_size = 0;
+	}
+
+	size_t GetSize() const
+	{
+		return m_size;
+	}
+
+	Value* Find(Key key)
+	{
+		auto pSlot = FindSlot(key);
+		return (pSlot->key == key) ? &pSlot->value : nullptr;
+	}
+
+	const Value* Find(Key key) const
+	{
+		return const_cast<FlatHashMap*>(this)->Find(key);
+	}
+
+	// The value for the key, added default-constructed if not there yet
+	Value& FindOrInsert(Key key, bool* pInserted = nullptr)
+	{
+		SDL_assert(key != kEmptyKey);
+
+		auto pSlot = FindSlot(key);
+		if (pInserted)
+		{
+			*pInserted = (pSlot->key != key);
+		}
+		if (pSlot->key == key)
+		{
+			return pSlot->value;
+		}
+
+		// At most three quarters full, to keep probe sequences short
+		if ((m_size + 1) * 4 > m_slots.size() * 3)
+		{
+			Grow();
+			pSlot = FindSlot(key);
+		}
+		pSlot->key = key;
+		pSlot->value = Value();
+		++m_size;
+		return pSlot->value;
+	}
+
+	// Calls func(key, value) for every entry, in no particular order
+	template <typename Func>
+	void ForEach(const Func& func) const
+	{
+		for (const auto& slot : m_slots)
+		{
+			if (slot.key != kEmptyKey)
+			{
+				func(slot.key, slot.value);
+			}
+		}
+	}
+
+private:
+	struct Slot
+	{
+		Slot() : key(kEmptyKey), value() {}
+
+		Key key;
+		Value value;
+	};
+
+	// The slot holding the key, or the empty one where it would go
+	Slot* FindSlot(Key key)
+	{
+		auto mask = m_slots.size() - 1;
+		for (auto index = GetHash(key); ; index = (index + 1) & mask)
+		{
+			auto& slot = m_slots[index];
+			if ((slot.key == key) || (slot.key == kEmptyKey))
+			{
+				return &slot;
+			}
+		}
+	}
+
+	// Fibonacci hashing: the top bits of a multiply spread keys that differ only in their low bits, like neighbouring
+	// addresses, across the table
+	size_t GetHash(Key key) const
+	{
+		return static_cast<size_t>((static_cast<Uint64>(key) * 0x9E3779B97F4A7C15ull) >> (64 - m_capacityBits));
+	}
+
+	void Grow()
+	{
+		std::vector<Slot> oldSlots(size_t(1) << (m_capacityBits + 1));
+		oldSlots.swap(m_slots);
+		++m_capacityBits;
+		for (auto& oldSlot : oldSlots)
+		{
+			if (oldSlot.key != kEmptyKey)
+			{
+				*FindSlot(oldSlot.key) = std::move(oldSlot);
+			}
+		}
+	}
+
+	std::vector<Slot> m_slots;
+	int m_capacityBits;
+	size_t m_size;
+};
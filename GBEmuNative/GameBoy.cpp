@@ -1,3 +1 @@
 #include "GameBoy.h"
-
-bool GameBoy::s_stopOnNextInstruction = false;
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "Rom.h"
 #include "MemoryBus.h"
 #include "Cpu.h"
+#include "MasterClock.h"
 #include "Timer.h"
 #include "Joypad.h"
 #include "GameLinkPort.h"
@@ -15,6 +16,9 @@
 #include "Mbc1Mapper.h"
 
 #include "Analyzer.h"
+#include "GuestProfile.h"
+#include "Movie.h"
+#include "SamplingProfiler.h"
 
 class GameBoy
 {
@@ -32,9 +36,11 @@ public:
 		Enabled
 	};
 
-	GameBoy(const char* pFileName, SDL_Renderer* pRenderer)
+	// With no renderer the emulator runs headless; with no audio device, sound is only produced while captured to a WAV file
+	GameBoy(const char* pFileName, SDL_Renderer* pRenderer, const Sound::OutputSettings& audioSettings = Sound::OutputSettings())
 	{
 		m_pRom.reset(new Rom(pFileName));
+		m_romHash = Movie::Hash(m_pRom->GetRom().data(), m_pRom->GetRom().size());
 
 		auto cartridgeType = m_pRom->GetCartridgeType();
 		switch (cartridgeType)
@@ -50,14 +56,20 @@ public:
 			throw Exception("Unsupported cartridge type: %d", cartridgeType);
 		}
 
+		m_pRomCoverage.reset(new RomCoverage(m_pRom->GetRom().size()));
+		m_pMapper->SetRomCoverage(m_pRomCoverage.get());
+
 		m_pMemoryBus.reset(new MemoryBus());
+		m_pMemoryBus->SetRomCoverage(m_pRomCoverage.get());
 		m_pMemory.reset(new Memory());
 		m_pCpu.reset(new Cpu(m_pMemoryBus));
-		m_pTimer.reset(new Timer(m_pCpu));
-		m_pJoypad.reset(new Joypad(m_pCpu));
-		m_pGameLinkPort.reset(new GameLinkPort(m_pCpu));
+		m_pCpu->SetRomCoverage(m_pRomCoverage.get());
+		m_pClock.reset(new MasterClock());
+		m_pTimer.reset(new Timer(m_pCpu, m_pClock));
+		m_pJoypad.reset(new Joypad(m_pCpu, m_pClock));
+		m_pGameLinkPort.reset(new GameLinkPort(m_pCpu, m_pClock));
 		m_pLcd.reset(new Lcd(m_pMemoryBus, m_pCpu, pRenderer));
-		m_pSound.reset(new Sound());
+		m_pSound.reset(new Sound(audioSettings));
 		m_pUnknownMemoryMappedRegisters.reset(new UnknownMemoryMappedRegisters());
 
 		m_pMemoryBus->AddDevice(m_pMemory);
@@ -70,10 +82,12 @@ public:
 		m_pMemoryBus->AddDevice(m_pSound);
 		m_pMemoryBus->AddDevice(m_pUnknownMemoryMappedRegisters);
 
-		m_pAnalyzer.reset(new Analyzer(m_pMapper.get(), m_pCpu.get(), m_pMemoryBus.get()));
+		m_pAnalyzer.reset(new Analyzer(m_pMapper.get(), m_pCpu.get(), m_pMemoryBus.get(), m_pClock.get()));
 
 		m_pMemoryBus->LockDevices(m_pAnalyzer.get());
+		m_pRomCoverage->Clear(); // of the bus probing every address
 
+		m_stopOnNextInstruction = false;
 		m_tracingState = TracingState::Enabled;
 
 		SetAnalyzerTracingState();
@@ -92,23 +106,254 @@ public:
 		return m_pLcd->GetFrontFrameBufferTexture();
 	}
 
+	void SetFrameSkip(int framesSkippedPerRenderedFrame)
+	{
+		m_pLcd->SetFrameSkip(framesSkippedPerRenderedFrame);
+	}
+
+	int GetFrameSkip() const
+	{
+		return m_pLcd->GetFrameSkip();
+	}
+
+	void SetAsyncRendering(bool enabled)
+	{
+		m_pLcd->SetAsyncRendering(enabled);
+	}
+
+	bool IsAsyncRendering() const
+	{
+		return m_pLcd->IsAsyncRendering();
+	}
+
+	void FinishAsyncRendering()
+	{
+		m_pLcd->FinishAsyncRendering();
+	}
+
+	Uint32 GetRenderedFrameCount() const
+	{
+		return m_pLcd->GetRenderedFrameCount();
+	}
+
+	Uint32 GetReusedFrameCount() const
+	{
+		return m_pLcd->GetReusedFrameCount();
+	}
+
+	Uint32 GetSkippedFrameCount() const
+	{
+		return m_pLcd->GetSkippedFrameCount();
+	}
+
+	const Uint32* GetFrameBufferPixels() const
+	{
+		return m_pLcd->GetFrameBufferPixels();
+	}
+
+	Uint32 GetFrameBufferVersion() const
+	{
+		return m_pLcd->GetFrameBufferVersion();
+	}
+
+	bool WasLastFrameUnchanged() const
+	{
+		return m_pLcd->WasLastFrameUnchanged();
+	}
+
+	Uint32 GetAudioUnderrunCount() const
+	{
+		return m_pSound->GetUnderrunCount();
+	}
+
+	Uint32 GetAudioOverrunCount() const
+	{
+		return m_pSound->GetOverrunCount();
+	}
+
+	float GetAudioQueuedMilliseconds() const
+	{
+		return m_pSound->GetQueuedMilliseconds();
+	}
+
+	float GetAudioRateRatio() const
+	{
+		return m_pSound->GetRateRatio();
+	}
+
+	// Emulated cycles since the last reset, on which input events are timed
+	Uint64 GetCycles() const
+	{
+		return m_pClock->GetCycles();
+	}
+
+	// See Joypad::QueueInput()
+	void QueueInput(Uint64 cycle, Uint8 buttons)
+	{
+		m_pJoypad->QueueInput(cycle, buttons);
+	}
+
+	// Sets the held buttons (a Joypad::Buttons mask) from the current cycle on
+	void SetInput(Uint8 buttons)
+	{
+		m_pJoypad->SetInput(buttons);
+	}
+
+	// Identifies the ROM for movies
+	Uint64 GetRomHash() const
+	{
+		return m_romHash;
+	}
+
+	// Resets and records all input from power-on until StopMovieRecording()
+	void StartMovieRecording()
+	{
+		Reset();
+		m_pRecordingMovie.reset(new Movie(m_romHash));
+		m_pJoypad->SetInputRecording(&m_pRecordingMovie->GetEvents());
+	}
+
+	bool IsRecordingMovie() const
+	{
+		return m_pRecordingMovie != nullptr;
+	}
+
+	Movie StopMovieRecording()
+	{
+		SDL_assert(m_pRecordingMovie);
+		m_pJoypad->SetInputRecording(nullptr);
+		m_pRecordingMovie->SetLengthCycles(GetCycles());
+
+		auto pMovie = std::move(m_pRecordingMovie);
+		return *pMovie;
+	}
+
+	void StopMovieRecording(const char* pFileName)
+	{
+		StopMovieRecording().Save(pFileName);
+	}
+
+	// Resets and queues all of the movie's input; it then plays out as recorded over the following Update() calls, provided
+	// nothing else queues input
+	void StartMoviePlayback(const Movie& movie)
+	{
+		if (movie.GetRomHash() != m_romHash)
+		{
+			throw Exception("Movie was recorded with a different ROM (hash %016llx, ROM hash %016llx)", movie.GetRomHash(), m_romHash);
+		}
+
+		Reset();
+		for (const auto& event : movie.GetEvents())
+		{
+			m_pJoypad->QueueInput(event.cycle, event.buttons);
+		}
+	}
+
+	// Samples the PC and call stack every so many cycles from now on, until StopSamplingProfiler(); see SamplingProfiler
+	void StartSamplingProfiler(Uint32 cyclesPerSample)
+	{
+		// About 45 minutes of samples at a 4096-cycle period, with a typical stack depth
+		static const size_t bufferWords = 16 << 20;
+
+		m_pSamplingProfiler.reset(new SamplingProfiler(m_pMapper, m_pClock, cyclesPerSample, bufferWords));
+		m_pCpu->SetSamplingProfiler(m_pSamplingProfiler.get());
+	}
+
+	std::unique_ptr<SamplingProfiler> StopSamplingProfiler()
+	{
+		SDL_assert(m_pSamplingProfiler);
+		m_pCpu->SetSamplingProfiler(nullptr);
+		return std::move(m_pSamplingProfiler);
+	}
+
+	// See RomCoverage; only records anything with ENABLE_ROM_COVERAGE set
+	const RomCoverage& GetRomCoverage() const
+	{
+		return *m_pRomCoverage;
+	}
+
+	// See Lcd::SetFrameCallback()
+	void SetFrameCallback(const std::function<void()>& callback)
+	{
+		m_pLcd->SetFrameCallback(callback);
+	}
+
+	// See GameLinkPort::GetSerialOutput()
+	const std::string& GetSerialOutput() const
+	{
+		return m_pGameLinkPort->GetSerialOutput();
+	}
+
+	void SetSerialEcho(bool enabled)
+	{
+		m_pGameLinkPort->SetSerialEcho(enabled);
+	}
+
+	// Whether the CPU is on a jump to itself (JR -2 or JP to its own address), which is how test ROMs, and a good deal of
+	// other code, stop once they are done.  Interrupts can still get it out again.
+	bool IsAtSelfJump() const
+	{
+		auto PC = m_pCpu->GetPC();
+		auto opcode = m_pMemoryBus->SafeRead8(PC);
+		if (opcode == 0x18)
+		{
+			return m_pMemoryBus->SafeRead8(PC + 1) == 0xFE;
+		}
+		if (opcode == 0xC3)
+		{
+			return Make16(m_pMemoryBus->SafeRead8(PC + 2), m_pMemoryBus->SafeRead8(PC + 1)) == PC;
+		}
+		return false;
+	}
+
+	// See GameLinkPort::ConnectCable(); GameBoyPair does this, and runs the two machines on either side
+	void ConnectLinkCable(const std::shared_ptr<LinkCable>& cable, int side)
+	{
+		m_pGameLinkPort->ConnectCable(cable, side);
+	}
+
+	// Runs until the clock reaches the given cycle (the last instruction can take it a little past), or until the link
+	// port has to wait for the other side of the cable
+	void RunUntil(Uint64 cycle)
+	{
+		m_cyclesRemaining = (cycle > GetCycles()) ? static_cast<float>(cycle - GetCycles()) : 0.0f;
+		Update(0.0f);
+	}
+
+	// See Sound::StartWavCapture()
+	void StartWavCapture(const char* pFileName, bool channelStems)
+	{
+		m_pSound->StartWavCapture(pFileName, channelStems);
+	}
+
+	void StopWavCapture()
+	{
+		m_pSound->StopWavCapture();
+	}
+
 	void Reset()
 	{
-		m_totalCyclesExecuted = 0.0f;
 		m_cyclesRemaining = 0.0f;
 		m_debuggerState = DebuggerState::Running;
 		//m_debuggerState = DebuggerState::SingleStepping;
 		m_breakpointAddress = -1;
 		m_lastUpdateAddress = -1;
 
+		m_pClock->Reset();
 		m_pMemoryBus->Reset();
 		m_pMemory->Reset();
 		m_pCpu->Reset();
 		m_pTimer->Reset();
 		m_pJoypad->Reset();
+		m_pGameLinkPort->Reset();
 		m_pLcd->Reset();
 		m_pSound->Reset();
 		m_pMapper->Reset();
+
+		if (m_pSamplingProfiler)
+		{
+			m_pSamplingProfiler->Reset();
+		}
 	}
 
 	void ToggleStepping()
@@ -152,6 +397,20 @@ public:
 		DebugBreak();
 	}
 
+	// See TraceFilter; only does anything with the analyzer enabled
+	void SetTraceFilter(const TraceFilter& filter)
+	{
+		m_pAnalyzer->SetTraceFilter(filter);
+	}
+
+	// See GuestProfile; empty without the analyzer
+	void GetProfile(GuestProfile& profile)
+	{
+		profile = GuestProfile();
+		profile.romName = m_pRom->GetRomName();
+		m_pAnalyzer->GetProfile(profile);
+	}
+
 	void SetAnalyzerTracingState()
 	{
 		switch (m_tracingState)
@@ -177,11 +436,11 @@ public:
 		{
 			if (m_pCpu->GetPC() != m_lastUpdateAddress)
 			{
-				if ((m_pCpu->GetPC() == m_breakpointAddress) || s_stopOnNextInstruction)
+				if ((m_pCpu->GetPC() == m_breakpointAddress) || m_stopOnNextInstruction)
 				{
 					Stop();
 					m_breakpointAddress = -1;
-					s_stopOnNextInstruction = false;
+					m_stopOnNextInstruction = false;
 				}
 
 				SetAnalyzerTracingState();
@@ -194,21 +453,48 @@ public:
 				m_lastUpdateAddress = m_pCpu->GetPC();
 			}
 
+			// A transfer can arrive, or the other side supply the byte this side is waiting on, while this side is not running
+			if (m_pClock->GetCycles() >= m_pGameLinkPort->GetNextEventCycle())
+			{
+				m_pGameLinkPort->Update();
+				if (m_pGameLinkPort->IsWaitingForCable())
+				{
+					break;
+				}
+			}
+
+			// Input is applied before the next instruction whether it was queued ahead of time, by movie playback, or set at the
+			// current cycle between updates, by the front end while recording, so that both see it on the same instruction
+			if (m_pClock->GetCycles() >= m_pJoypad->GetNextEventCycle())
+			{
+				m_pJoypad->Update();
+			}
+
 			if (m_cyclesRemaining > 0)
 			{
 				auto instructionCycles = m_pCpu->ExecuteSingleInstruction();
-				m_totalCyclesExecuted += instructionCycles;
-				g_totalCyclesExecuted += instructionCycles;
+				m_pClock->Advance(instructionCycles);
 				m_cyclesRemaining -= instructionCycles;
 
-                const float secondsPerClockCycle = 1.0f / MemoryBus::kCyclesPerSecond;
-                auto secondsSpentOnInstruction = secondsPerClockCycle * instructionCycles;
+				// The timer and link port work themselves out from the clock when accessed, so only need to see time pass to
+				// raise their interrupts
+				if (m_pClock->GetCycles() >= m_pTimer->GetNextEventCycle())
+				{
+					m_pTimer->Update();
+				}
+
+				if (m_pClock->GetCycles() >= m_pGameLinkPort->GetNextEventCycle())
+				{
+					m_pGameLinkPort->Update();
+				}
 
-				m_pTimer->Update(secondsSpentOnInstruction);
-				m_pJoypad->Update(secondsSpentOnInstruction);
-				m_pLcd->Update(secondsSpentOnInstruction);
-				m_pSound->Update(secondsSpentOnInstruction);
-                m_pGameLinkPort->Update(secondsSpentOnInstruction);
+				m_pLcd->Update(instructionCycles);
+				m_pSound->Update(instructionCycles);
+
+				if (m_pSamplingProfiler && (m_pClock->GetCycles() >= m_pSamplingProfiler->GetNextSampleCycle()))
+				{
+					m_pSamplingProfiler->Sample(m_pCpu->GetPC());
+				}
 			}
 			else
 			{
@@ -218,26 +504,29 @@ public:
 	}
 
 private:
-	static bool s_stopOnNextInstruction;
-	
 	// @TODO: possibly refactor into some kind of system component collection?
 	std::shared_ptr<Analyzer> m_pAnalyzer;
 	std::shared_ptr<Rom> m_pRom;
 	std::shared_ptr<MemoryMapper> m_pMapper;
+	std::unique_ptr<RomCoverage> m_pRomCoverage;
 	std::shared_ptr<MemoryBus> m_pMemoryBus;
 	std::shared_ptr<Memory> m_pMemory;
 	std::shared_ptr<Cpu> m_pCpu;
+	std::shared_ptr<MasterClock> m_pClock;
 	std::shared_ptr<Timer> m_pTimer;
 	std::shared_ptr<Joypad> m_pJoypad;
 	std::shared_ptr<GameLinkPort> m_pGameLinkPort;
 	std::shared_ptr<Lcd> m_pLcd;
 	std::shared_ptr<Sound> m_pSound;
 	std::shared_ptr<UnknownMemoryMappedRegisters> m_pUnknownMemoryMappedRegisters;
+	std::unique_ptr<Movie> m_pRecordingMovie; // null when not recording
+	std::unique_ptr<SamplingProfiler> m_pSamplingProfiler; // null when not sampling
+	Uint64 m_romHash;
 
-	float m_totalCyclesExecuted;
 	float m_cyclesRemaining;
 	DebuggerState m_debuggerState;
 	TracingState m_tracingState;
 	Sint32 m_breakpointAddress;
+	bool m_stopOnNextInstruction; // set from the debugger
 	Sint32 m_lastUpdateAddress;
 };
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "GameBoy.h"
+#include "LinkCable.h"
+
+// Two Game Boys joined by a link cable, for trading and battles on one host.  Rather than stepping both an instruction at a
+// time, each is run in turn for as long as it can get without being more than a window of cycles ahead of the other.  With
+// the default window, just under a transfer's length, transfers are delivered on the exact cycle they complete on (see
+// LinkCable), so the machines behave exactly as if stepped together, while switching between them only every few thousand
+// cycles.  Wider windows switch less often, at the cost of transfers that arrive late (counted in the cable's statistics).
+class GameBoyPair
+{
+public:
+	// Leaves room for the longest instruction, plus an interrupt dispatch, to overshoot the window
+	static const Uint64 kDefaultWindowCycles = LinkCable::kTransferCycles - 64;
+
+	GameBoyPair(GameBoy& gameBoy0, GameBoy& gameBoy1, Uint64 windowCycles = kDefaultWindowCycles)
+		: m_pCable(std::make_shared<LinkCable>())
+		, m_windowCycles(windowCycles)
+	{
+		SDL_assert(windowCycles > 0);
+		m_pGameBoys[0] = &gameBoy0;
+		m_pGameBoys[1] = &gameBoy1;
+		gameBoy0.ConnectLinkCable(m_pCable, 0);
+		gameBoy1.ConnectLinkCable(m_pCable, 1);
+		m_targetCycle = SDL_max(gameBoy0.GetCycles(), gameBoy1.GetCycles());
+		m_cyclesRemaining = 0.0f;
+	}
+
+	GameBoy& GetGameBoy(int index)
+	{
+		return *m_pGameBoys[index];
+	}
+
+	const LinkCable::Statistics& GetLinkStatistics() const
+	{
+		return m_pCable->GetStatistics();
+	}
+
+	// Runs both machines for the given time
+	void Update(float seconds)
+	{
+		m_cyclesRemaining += seconds * MemoryBus::kCyclesPerSecond;
+		auto cycles = static_cast<Uint64>(SDL_max(m_cyclesRemaining, 0.0f));
+		m_cyclesRemaining -= cycles;
+		m_targetCycle += cycles;
+
+		for (;;)
+		{
+			bool progressed = false;
+			for (int index = 0; index < 2; ++index)
+			{
+				auto& gameBoy = *m_pGameBoys[index];
+				auto& otherGameBoy = *m_pGameBoys[1 - index];
+				auto limit = SDL_min(m_targetCycle, otherGameBoy.GetCycles() + m_windowCycles);
+				// Even with nothing to run, this picks up transfers the other side has started since
+				auto startCycles = gameBoy.GetCycles();
+				gameBoy.RunUntil(limit);
+				progressed = progressed || (gameBoy.GetCycles() != startCycles);
+				if (gameBoy.GetCycles() < limit)
+				{
+					m_pCable->OnStall();
+				}
+			}
+
+			if ((m_pGameBoys[0]->GetCycles() >= m_targetCycle) && (m_pGameBoys[1]->GetCycles() >= m_targetCycle))
+			{
+				break;
+			}
+
+			// Either side can always run up to the transfer the other is waiting on, so both being stuck means one is
+			// single stepping in the debugger
+			if (!progressed)
+			{
+				break;
+			}
+		}
+	}
+
+private:
+	std::shared_ptr<LinkCable> m_pCable;
+	GameBoy* m_pGameBoys[2];
+	Uint64 m_windowCycles;
+	Uint64 m_targetCycle;
+	float m_cyclesRemaining;
+};
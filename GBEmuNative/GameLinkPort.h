@@ -1,9 +1,13 @@
 #pragma once
 
 #include "IMemoryBusDevice.h"
+#include "MasterClock.h"
+#include "LinkCable.h"
 
 #include "Utils.h"
 
+#include <string>
+
 class GameLinkPort : public IMemoryBusDevice
 {
 public:
@@ -13,9 +17,14 @@ public:
 		SC = 0xFF02,	// Serial transfer control
 	};
 
-	GameLinkPort(const std::shared_ptr<Cpu>& cpu)
+	static const size_t kMaxSerialOutputSize = 1 << 20;
+
+	GameLinkPort(const std::shared_ptr<Cpu>& cpu, const std::shared_ptr<MasterClock>& clock)
 	{
         m_pCpu = cpu;
+		m_pClock = clock;
+		m_cableSide = 0;
+		m_echoSerialOutput = true;
 		Reset();
 	}
 
@@ -23,26 +32,83 @@ public:
 	{
 		SB = 0;
 		SC = 0;
-        m_updateTimeLeft = 0.0f;
-        m_pendingOutboundTransfer = false;
+		m_transferCycle = MasterClock::kNever;
+		m_serialOutput.clear();
+		if (m_pCable)
+		{
+			m_pCable->ResetSide(m_cableSide);
+		}
+	}
+
+	// Plugs a cable in, as one of its two sides; with none, transfers this side clocks receive 0xFF, as with nothing
+	// connected on hardware, and transfers on the external clock never complete
+	void ConnectCable(const std::shared_ptr<LinkCable>& cable, int side)
+	{
+		m_pCable = cable;
+		m_cableSide = side;
+		m_pCable->Connect(side, m_pClock);
 	}
 
-    void Update(float seconds)
-    {
-        m_updateTimeLeft += seconds;
-        if (m_pendingOutboundTransfer)
-        {
-            if (m_updateTimeLeft >= 8.0f / 8192)
-            {
-                m_pendingOutboundTransfer = false;
-                m_pCpu->SignalInterrupt(Bit3);
-            }
-        }
-        else
-        {
-            m_updateTimeLeft = 0.0f;
-        }
-    }
+	// Every byte this side has sent since the last reset.  Test ROMs report their results this way, as text; only the most
+	// recent kMaxSerialOutputSize bytes or so are kept, for programs that never stop sending.
+	const std::string& GetSerialOutput() const
+	{
+		return m_serialOutput;
+	}
+
+	// Whether sent bytes are also printed to the console as they go
+	void SetSerialEcho(bool enabled)
+	{
+		m_echoSerialOutput = enabled;
+	}
+
+	// The master clock cycle on or after which Update() needs calling, for a transfer completing
+	Uint64 GetNextEventCycle() const
+	{
+		if (m_pCable)
+		{
+			return SDL_min(m_pCable->GetOutgoingTransferCycle(m_cableSide), m_pCable->GetIncomingTransferCycle(m_cableSide));
+		}
+		return m_transferCycle;
+	}
+
+	// Whether a transfer this side clocks is due but still waiting on the other side of the cable; emulation of this side
+	// has to stop until it is not
+	bool IsWaitingForCable() const
+	{
+		return m_pCable && (m_pClock->GetCycles() >= m_pCable->GetOutgoingTransferCycle(m_cableSide));
+	}
+
+	void Update()
+	{
+		auto cycle = m_pClock->GetCycles();
+		if (!m_pCable)
+		{
+			if (cycle >= m_transferCycle)
+			{
+				m_transferCycle = MasterClock::kNever;
+				CompleteTransfer(0xFF);
+			}
+			return;
+		}
+
+		// A transfer the other side clocks arrives whether or not this side is listening, but is only taken if it is
+		if (cycle >= m_pCable->GetIncomingTransferCycle(m_cableSide))
+		{
+			bool listening = (SC & (Bit7 | Bit0)) == Bit7;
+			auto value = m_pCable->ReceiveTransfer(m_cableSide, listening ? SB : 0xFF);
+			if (listening)
+			{
+				CompleteTransfer(value);
+			}
+		}
+
+		Uint8 value;
+		if ((cycle >= m_pCable->GetOutgoingTransferCycle(m_cableSide)) && m_pCable->TryCompleteTransfer(m_cableSide, value))
+		{
+			CompleteTransfer(value);
+		}
+	}
 
 	virtual bool HandleRequest(MemoryRequestType requestType, Uint16 address, Uint8& value)
 	{
@@ -57,21 +123,21 @@ public:
 				else
 				{
 					SC = value;
-					
-					//@TODO: timing emulation, internal/external clock, interrupt
-					if (value & Bit7)
+
+					// Transfers on the internal clock are started here; on the external clock, this side waits for the other one
+					// to start one, and only the cable knows when that is
+					if ((value & (Bit7 | Bit0)) == (Bit7 | Bit0) && (GetNextOutgoingTransferCycle() == MasterClock::kNever))
 					{
-						//printf("Serial output byte: %c (0x%02lX)\n", m_SB, m_SB);
-						printf("%c", SB);
-						SC &= ~Bit7;
-
-						// Read 0xFF, which is the default value in actual hardware
-						SB = 0xFF;
-                        
-                        if (SC & Bit0)
-                        {
-                            m_pendingOutboundTransfer = true;
-                        }
+						CaptureSerialOutput(SB);
+
+						if (m_pCable)
+						{
+							m_pCable->StartTransfer(m_cableSide, SB);
+						}
+						else
+						{
+							m_transferCycle = m_pClock->GetCycles() + LinkCable::kTransferCycles;
+						}
 					}
 				}
 				return true;
@@ -79,15 +145,46 @@ public:
 
 		SERVICE_MMR_RW(SB)
 		}
-	
+
 		return false;
 	}
 private:
+	Uint64 GetNextOutgoingTransferCycle() const
+	{
+		return m_pCable ? m_pCable->GetOutgoingTransferCycle(m_cableSide) : m_transferCycle;
+	}
+
+	void CaptureSerialOutput(Uint8 value)
+	{
+		if (m_serialOutput.size() >= kMaxSerialOutputSize)
+		{
+			m_serialOutput.erase(0, kMaxSerialOutputSize / 2);
+		}
+		m_serialOutput.push_back(static_cast<char>(value));
+
+		if (m_echoSerialOutput)
+		{
+			//printf("Serial output byte: %c (0x%02lX)\n", m_SB, m_SB);
+			printf("%c", value);
+		}
+	}
+
+	void CompleteTransfer(Uint8 value)
+	{
+		SB = value;
+		SC &= ~Bit7;
+		m_pCpu->SignalInterrupt(Bit3);
+	}
+
 	Uint8 SB;
 	Uint8 SC;
-    
-    float m_updateTimeLeft;
-    bool m_pendingOutboundTransfer;
+
+	Uint64 m_transferCycle; // when the transfer in progress completes, with no cable
+	std::string m_serialOutput;
+	bool m_echoSerialOutput;
 
     std::shared_ptr<Cpu> m_pCpu;
-};
\ No newline at end of file
+	std::shared_ptr<MasterClock> m_pClock;
+	std::shared_ptr<LinkCable> m_pCable;
+	int m_cableSide;
+};
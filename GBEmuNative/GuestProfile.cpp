@@ -0,0 +1,237 @@
+#include "GuestProfile.h"
+
+#include "MemoryBus.h"
+
+namespace
+{
+	// Positions are written as the function's address with its bank above it, as in the analyzer's mapped addresses
+	Uint32 GetPosition(Uint8 bank, Uint16 address)
+	{
+		return (static_cast<Uint32>(bank) << 16) | address;
+	}
+
+	void WriteFile(const std::string& data, const char* pFileName)
+	{
+		FILE* pFile = nullptr;
+		if ((fopen_s(&pFile, pFileName, "wb") != 0) || !pFile)
+		{
+			throw Exception("Can't open %s for writing", pFileName);
+		}
+		Janitor closeFile([&] { fclose(pFile); });
+
+		if (!data.empty() && (fwrite(data.data(), data.length(), 1, pFile) != 1))
+		{
+			throw Exception("Failed to write %s", pFileName);
+		}
+	}
+
+	// Just enough of the protocol buffer wire format for profile.proto: varints and length-delimited fields
+	class ProtobufWriter
+	{
+	public:
+		void WriteVarint(Uint64 value)
+		{
+			while (value >= 0x80)
+			{
+				m_data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+				value >>= 7;
+			}
+			m_data.push_back(static_cast<char>(value));
+		}
+
+		void WriteUint(int field, Uint64 value)
+		{
+			WriteVarint(static_cast<Uint64>(field) << 3);
+			WriteVarint(value);
+		}
+
+		void WriteBytes(int field, const std::string& bytes)
+		{
+			WriteVarint((static_cast<Uint64>(field) << 3) | 2);
+			WriteVarint(bytes.length());
+			m_data += bytes;
+		}
+
+		void WriteMessage(int field, const ProtobufWriter& message)
+		{
+			WriteBytes(field, message.m_data);
+		}
+
+		// A repeated scalar field, as one length-delimited run of varints
+		void WritePacked(int field, const std::vector<Uint64>& values)
+		{
+			ProtobufWriter packed;
+			for (auto value : values)
+			{
+				packed.WriteVarint(value);
+			}
+			WriteBytes(field, packed.m_data);
+		}
+
+		const std::string& GetData() const
+		{
+			return m_data;
+		}
+
+	private:
+		std::string m_data;
+	};
+}
+
+std::string GuestProfile::GetFunctionName(const Function& function)
+{
+	auto name = Format("%02X:%04X", function.bank, function.address);
+	if (function.isInterruptServiceRoutine)
+	{
+		switch (function.address)
+		{
+		case 0x40: name += " (VBlank interrupt)"; break;
+		case 0x48: name += " (STAT interrupt)"; break;
+		case 0x50: name += " (Timer interrupt)"; break;
+		case 0x58: name += " (Serial interrupt)"; break;
+		case 0x60: name += " (Joypad interrupt)"; break;
+		}
+	}
+	return name;
+}
+
+void GuestProfile::WriteCallgrind(const char* pFileName) const
+{
+	Uint64 totalCycles = 0;
+	Uint64 totalInstructions = 0;
+	std::vector<std::vector<Uint32>> callEdgesByCaller(functions.size());
+	for (const auto& function : functions)
+	{
+		totalCycles += function.exclusiveCycles;
+		totalInstructions += function.exclusiveInstructions;
+	}
+	for (Uint32 i = 0; i < callEdges.size(); ++i)
+	{
+		callEdgesByCaller[callEdges[i].caller].push_back(i);
+	}
+
+	std::string text = "# callgrind format\nversion: 1\ncreator: GBEmu\n";
+	text += Format("cmd: %s\n", romName.c_str());
+	text += "positions: instr\nevents: Cycles Instructions\n";
+	text += Format("summary: %llu %llu\n", totalCycles, totalInstructions);
+
+	// Names are given in full the first time a function comes up, and by number after that
+	std::vector<bool> isNamed(functions.size(), false);
+	auto getName = [&](Uint32 index)
+	{
+		if (isNamed[index])
+		{
+			return Format("(%u)", index + 1);
+		}
+		isNamed[index] = true;
+		return Format("(%u) %s", index + 1, GetFunctionName(functions[index]).c_str());
+	};
+
+	for (Uint32 index = 0; index < functions.size(); ++index)
+	{
+		const auto& function = functions[index];
+		text += "\nfn=" + getName(index) + "\n";
+		text += Format("0x%X %llu %llu\n", GetPosition(function.bank, function.address), function.exclusiveCycles, function.exclusiveInstructions);
+
+		for (auto edgeIndex : callEdgesByCaller[index])
+		{
+			const auto& edge = callEdges[edgeIndex];
+			const auto& callee = functions[edge.callee];
+			text += "cfn=" + getName(edge.callee) + "\n";
+			text += Format("calls=%llu 0x%X\n", edge.calls, GetPosition(callee.bank, callee.address));
+			text += Format("0x%X %llu %llu\n", GetPosition(edge.callSiteBank, edge.callSiteAddress), edge.inclusiveCycles, edge.inclusiveInstructions);
+		}
+	}
+
+	WriteFile(text, pFileName);
+}
+
+void GuestProfile::WritePprof(const char* pFileName) const
+{
+	// Field numbers from profile.proto
+	enum ProfileField { SampleType = 1, Sample = 2, Location = 4, FunctionField = 5, StringTable = 6, DurationNanos = 10, PeriodType = 11, Period = 12 };
+	enum ValueTypeField { Type = 1, Unit = 2 };
+	enum SampleField { LocationId = 1, Value = 2 };
+	enum LocationField { LocationIdField = 1, Address = 3, Line = 4 };
+	enum LineField { FunctionId = 1 };
+	enum FunctionFieldNumber { FunctionIdField = 1, Name = 2, SystemName = 3 };
+
+	ProtobufWriter profile;
+	std::vector<std::string> strings(1); // string_table[0] has to be empty
+	auto addString = [&](const std::string& s)
+	{
+		strings.push_back(s);
+		return static_cast<Uint64>(strings.size() - 1);
+	};
+
+	auto cyclesString = addString("cycles");
+	auto instructionsString = addString("instructions");
+	auto countString = addString("count");
+	for (auto type : { cyclesString, instructionsString })
+	{
+		ProtobufWriter valueType;
+		valueType.WriteUint(Type, type);
+		valueType.WriteUint(Unit, countString);
+		profile.WriteMessage(SampleType, valueType);
+	}
+
+	// One sample per call stack, its locations from the leaf up
+	Uint64 totalCycles = 0;
+	for (const auto& context : contexts)
+	{
+		if ((context.exclusiveCycles == 0) && (context.exclusiveInstructions == 0))
+		{
+			continue;
+		}
+		std::vector<Uint64> locationIds;
+		for (auto index = static_cast<Uint32>(&context - contexts.data()); index != kNone; index = contexts[index].parent)
+		{
+			locationIds.push_back(contexts[index].function + 1);
+		}
+
+		ProtobufWriter sample;
+		sample.WritePacked(LocationId, locationIds);
+		sample.WritePacked(Value, { context.exclusiveCycles, context.exclusiveInstructions });
+		profile.WriteMessage(Sample, sample);
+		totalCycles += context.exclusiveCycles;
+	}
+
+	// A location and a function for each function, with the same ids
+	for (Uint32 index = 0; index < functions.size(); ++index)
+	{
+		const auto& function = functions[index];
+
+		ProtobufWriter line;
+		line.WriteUint(FunctionId, index + 1);
+		ProtobufWriter location;
+		location.WriteUint(LocationIdField, index + 1);
+		location.WriteUint(Address, GetPosition(function.bank, function.address));
+		location.WriteMessage(Line, line);
+		profile.WriteMessage(Location, location);
+	}
+	for (Uint32 index = 0; index < functions.size(); ++index)
+	{
+		auto name = addString(GetFunctionName(functions[index]));
+		ProtobufWriter functionMessage;
+		functionMessage.WriteUint(FunctionIdField, index + 1);
+		functionMessage.WriteUint(Name, name);
+		functionMessage.WriteUint(SystemName, name);
+		profile.WriteMessage(FunctionField, functionMessage);
+	}
+
+	for (const auto& s : strings)
+	{
+		profile.WriteBytes(StringTable, s);
+	}
+
+	// Guest time, at the normal speed clock
+	const Uint64 cyclesPerSecond = MemoryBus::kCyclesPerSecond;
+	profile.WriteUint(DurationNanos, (totalCycles / cyclesPerSecond) * 1000000000ull + (totalCycles % cyclesPerSecond) * 1000000000ull / cyclesPerSecond);
+	ProtobufWriter periodType;
+	periodType.WriteUint(Type, cyclesString);
+	periodType.WriteUint(Unit, countString);
+	profile.WriteMessage(PeriodType, periodType);
+	profile.WriteUint(Period, 1);
+
+	WriteFile(profile.GetData(), pFileName);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <string>
+#include <vector>
+
+// Where guest code spends its time, by function, as measured by the analyzer: cycles and instructions spent in each
+// function itself (exclusive) and in it and everything it called (inclusive), how often each call site called each
+// function, and the cost of every distinct call stack.  It can be written out for KCachegrind (callgrind format) or pprof.
+struct GuestProfile
+{
+	static const Uint32 kNone = ~0u;
+
+	struct Function
+	{
+		Uint8 bank; // 0 outside the banked ROM window
+		Uint16 address;
+		bool isInterruptServiceRoutine;
+		Uint64 calls;
+		Uint64 exclusiveCycles;
+		Uint64 exclusiveInstructions;
+		Uint64 inclusiveCycles; // recursive calls are only counted once
+		Uint64 inclusiveInstructions;
+	};
+
+	struct CallEdge
+	{
+		Uint32 caller; // index in functions
+		Uint32 callee;
+		Uint8 callSiteBank;
+		Uint16 callSiteAddress;
+		Uint64 calls;
+		Uint64 inclusiveCycles;
+		Uint64 inclusiveInstructions;
+	};
+
+	// One path through the call graph from the bottom of the stack, with the cost of its last function along that path
+	struct Context
+	{
+		Uint32 parent; // kNone at the bottom
+		Uint32 function;
+		Uint64 exclusiveCycles;
+		Uint64 exclusiveInstructions;
+	};
+
+	std::string romName;
+	std::vector<Function> functions;
+	std::vector<CallEdge> callEdges;
+	std::vector<Context> contexts;
+
+	static std::string GetFunctionName(const Function& function);
+
+	// Text, readable by KCachegrind and callgrind_annotate
+	void WriteCallgrind(const char* pFileName) const;
+
+	// An uncompressed profile.proto, readable by pprof; samples are the call stacks, valued in cycles and instructions
+	void WritePprof(const char* pFileName) const;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Joypad.h"
+
+#include <memory>
+
+// Reads the host keyboard and joystick into a Joypad button mask.  This is front end code, sampled once per host frame and
+// passed to the emulator as input events, so the emulation itself makes no SDL input calls.
+class HostInput
+{
+public:
+	HostInput()
+	{
+		// Search for the specific knockoff USB NES pad I own, because it's awesome
+		for (int i = 0; i < SDL_NumJoysticks(); ++i)
+		{
+			std::shared_ptr<SDL_Joystick> pJoystick(SDL_JoystickOpen(i), SDL_JoystickClose);
+			std::string joystickName = SDL_JoystickName(pJoystick.get());
+			if (joystickName == "USB Gamepad ") // note the space
+			{
+				m_pJoystick = pJoystick;
+			}
+		}
+	}
+
+	Uint8 GetButtons() const
+	{
+		const auto pKeyState = SDL_GetKeyboardState(nullptr);
+
+		Uint8 buttons = 0;
+		if (pKeyState[SDL_SCANCODE_E]) buttons |= Joypad::A;
+		if (pKeyState[SDL_SCANCODE_R]) buttons |= Joypad::B;
+		if (pKeyState[SDL_SCANCODE_Q]) buttons |= Joypad::Select;
+		if (pKeyState[SDL_SCANCODE_W]) buttons |= Joypad::Start;
+		if (pKeyState[SDL_SCANCODE_RIGHT]) buttons |= Joypad::Right;
+		if (pKeyState[SDL_SCANCODE_LEFT]) buttons |= Joypad::Left;
+		if (pKeyState[SDL_SCANCODE_UP]) buttons |= Joypad::Up;
+		if (pKeyState[SDL_SCANCODE_DOWN]) buttons |= Joypad::Down;
+
+		if (m_pJoystick)
+		{
+			auto pJoystick = m_pJoystick.get();
+			if (SDL_JoystickGetButton(pJoystick, 1)) buttons |= Joypad::A;
+			if (SDL_JoystickGetButton(pJoystick, 2)) buttons |= Joypad::B;
+			if (SDL_JoystickGetButton(pJoystick, 8)) buttons |= Joypad::Select;
+			if (SDL_JoystickGetButton(pJoystick, 9)) buttons |= Joypad::Start;
+
+			// Right/left
+			auto axis0 = SDL_JoystickGetAxis(pJoystick, 0);
+			if (axis0 > 16384)
+			{
+				buttons |= Joypad::Right;
+			}
+			else if (axis0 < -16384)
+			{
+				buttons |= Joypad::Left;
+			}
+
+			// Up/down
+			auto axis4 = SDL_JoystickGetAxis(pJoystick, 4);
+			if (axis4 < -16384)
+			{
+				buttons |= Joypad::Up;
+			}
+			else if (axis4 > 16384)
+			{
+				buttons |= Joypad::Down;
+			}
+		}
+
+		return buttons;
+	}
+
+private:
+	std::shared_ptr<SDL_Joystick> m_pJoystick;
+};
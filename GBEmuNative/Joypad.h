@@ -2,8 +2,11 @@
 
 #include "IMemoryBusDevice.h"
 #include "MemoryBus.h"
+#include "MasterClock.h"
 
 #include <memory>
+#include <deque>
+#include <vector>
 
 class Joypad : public IMemoryBusDevice
 {
@@ -13,170 +16,110 @@ public:
 		P1_JOYP = 0xFF00, // Joypad
 	};
 
-	Joypad(const std::shared_ptr<Cpu>& cpu)
-		: m_pCpu(cpu)
+	// Button masks for input events; a set bit is a held button
+	enum Buttons
 	{
-		Reset();
-
-		auto numJoysticks = SDL_NumJoysticks();
+		Right = Bit0,
+		Left = Bit1,
+		Up = Bit2,
+		Down = Bit3,
+		A = Bit4,
+		B = Bit5,
+		Select = Bit6,
+		Start = Bit7,
+	};
 
-		// Search for the specific knockoff USB NES pad I own, because it's awesome
-		for (int i = 0; i < SDL_NumJoysticks(); ++i)
-		{
-			std::shared_ptr<SDL_Joystick> pJoystick(SDL_JoystickOpen(i), SDL_JoystickClose);
-			std::string joystickName = SDL_JoystickName(pJoystick.get());
-			if (joystickName == "USB Gamepad ") // note the space
-			{
-				m_pJoystick = pJoystick;
-			}
-		}
+	// Input is a queue of button states, each taking effect on a master clock cycle, fed by the front end or by code (bots,
+	// replays, tests).  P1_JOYP reads see whatever state is current at the time of the read, and the interrupt is raised on
+	// the cycle a selected line goes low, so the same events always play out the same way.
+	struct InputEvent
+	{
+		Uint64 cycle;
+		Uint8 buttons;
+	};
 
-		//for (;;)
-		//{
-		//	SDL_JoystickUpdate();
-
-		//	for (int i = 0; i < SDL_JoystickNumAxes(m_pJoystick.get()); ++i)
-		//	{
-		//		auto value = SDL_JoystickGetAxis(m_pJoystick.get(), i);
-		//		printf("axis %d: %d\n", i, value);
-		//	}
-
-		//	for (int i = 0; i < SDL_JoystickNumHats(m_pJoystick.get()); ++i)
-		//	{
-		//		auto value = SDL_JoystickGetHat(m_pJoystick.get(), i);
-		//		printf("hat %d: %d\n", i, value);
-		//	}
-
-		//	for (int i = 0; i < SDL_JoystickNumButtons(m_pJoystick.get()); ++i)
-		//	{
-		//		auto value = SDL_JoystickGetButton(m_pJoystick.get(), i);
-		//		printf("button %d: %d\n", i, value);
-		//	}
-		//	Sleep(100);
-		//}
+	Joypad(const std::shared_ptr<Cpu>& cpu, const std::shared_ptr<MasterClock>& clock)
+		: m_pCpu(cpu)
+		, m_pClock(clock)
+		, m_pRecording(nullptr)
+	{
+		Reset();
 	}
 
 	void Reset()
 	{
-		m_updateTimeLeft = 0.0f;
 		P1_JOYP = 0x0F;
-		m_lastP1_JOYP = 0xFF;
+		m_buttons = 0;
+		m_lastQueuedButtons = 0;
+		m_events.clear();
 	}
 
-	void Update(float seconds)
+	// Queues a button state to take effect on the given cycle.  Events have to be queued in order; one for a cycle that has
+	// already passed takes effect straight away.
+	void QueueInput(Uint64 cycle, Uint8 buttons)
 	{
-		m_updateTimeLeft += seconds;
-
-		bool forceUpdate = false;
-		if ((m_lastP1_JOYP & 0xF0) != (P1_JOYP & 0xF0))
+		cycle = SDL_max(cycle, m_pClock->GetCycles());
+		if (!m_events.empty())
 		{
-			forceUpdate = true;
+			SDL_assert(cycle >= m_events.back().cycle);
+			cycle = SDL_max(cycle, m_events.back().cycle);
 		}
-		m_lastP1_JOYP = P1_JOYP;
 
-		while ((m_updateTimeLeft > 0.0f) || forceUpdate)
-		{
-			if (m_updateTimeLeft > 0.0f)
-			{
-				m_updateTimeLeft -= 1.0f / 60.0f;
-			}
-			forceUpdate = false;
-
-			//SDL_JoystickUpdate();
+		InputEvent event = { cycle, buttons };
+		m_events.push_back(event);
+		m_lastQueuedButtons = buttons;
 
-			const auto pKeyState = SDL_GetKeyboardState(nullptr);
+		if (m_pRecording)
+		{
+			m_pRecording->push_back(event);
+		}
+	}
 
-			Uint8 oldValues = P1_JOYP & 0x0F;
-			
-			if ((P1_JOYP & Bit5) == 0)
-			{
-				// Buttons
-				SetBitValue(P1_JOYP, 0, pKeyState[SDL_SCANCODE_E] == 0); // A: P
-				SetBitValue(P1_JOYP, 1, pKeyState[SDL_SCANCODE_R] == 0); // B: O
-				SetBitValue(P1_JOYP, 2, pKeyState[SDL_SCANCODE_Q] == 0); // Select: Q
-				SetBitValue(P1_JOYP, 3, pKeyState[SDL_SCANCODE_W] == 0); // Start: W
+	// Appends every event queued from now on to the given vector, for recording movies; null stops recording
+	void SetInputRecording(std::vector<InputEvent>* pRecording)
+	{
+		m_pRecording = pRecording;
+	}
 
-				if (m_pJoystick)
-				{
-					// A
-					if (SDL_JoystickGetButton(m_pJoystick.get(), 1))
-					{
-						P1_JOYP &= ~Bit0;
-					}
-
-					// B
-					if (SDL_JoystickGetButton(m_pJoystick.get(), 2))
-					{
-						P1_JOYP &= ~Bit1;
-					}
-
-					// Select
-					if (SDL_JoystickGetButton(m_pJoystick.get(), 8))
-					{
-						P1_JOYP &= ~Bit2;
-					}
-
-					// Start
-					if (SDL_JoystickGetButton(m_pJoystick.get(), 9))
-					{
-						P1_JOYP &= ~Bit3;
-					}
-				}
-			}
-			
-			if ((P1_JOYP & Bit4) == 0)
-			{
-				// D-pad
-				SetBitValue(P1_JOYP, 0, pKeyState[SDL_SCANCODE_RIGHT] == 0);
-				SetBitValue(P1_JOYP, 1, pKeyState[SDL_SCANCODE_LEFT] == 0);
-				SetBitValue(P1_JOYP, 2, pKeyState[SDL_SCANCODE_UP] == 0);
-				SetBitValue(P1_JOYP, 3, pKeyState[SDL_SCANCODE_DOWN] == 0);
-				
-				if (m_pJoystick)
-				{
-					// Right/left
-					auto axis0 = SDL_JoystickGetAxis(m_pJoystick.get(), 0);
-					if (axis0 > 16384)
-					{
-						P1_JOYP &= ~Bit0;
-					}
-					else if (axis0 < -16384)
-					{
-						P1_JOYP &= ~Bit1;
-					}
-
-					// Up/down
-					auto axis4 = SDL_JoystickGetAxis(m_pJoystick.get(), 4);
-					if (axis4 < -16384)
-					{
-						P1_JOYP &= ~Bit2;
-					}
-					else if (axis4 > 16384)
-					{
-						P1_JOYP &= ~Bit3;
-					}
-				}
-			}
+	// Queues a button state for the current cycle, if it differs from the last one queued
+	void SetInput(Uint8 buttons)
+	{
+		if (buttons != m_lastQueuedButtons)
+		{
+			QueueInput(m_pClock->GetCycles(), buttons);
+		}
+	}
 
-			Uint8 newValues = P1_JOYP & 0x0F;
+	// The master clock cycle on or after which Update() needs calling, for the next queued input
+	Uint64 GetNextEventCycle() const
+	{
+		return m_events.empty() ? MasterClock::kNever : m_events.front().cycle;
+	}
 
-			// If any input lines went low, fire an interrupt
-			if ((oldValues ^ newValues) & ~newValues)
-			{
-				m_pCpu->SignalInterrupt(Bit4);
-			}
+	// Applies the input events that are due
+	void Update()
+	{
+		auto cycle = m_pClock->GetCycles();
+		while (!m_events.empty() && (m_events.front().cycle <= cycle))
+		{
+			m_buttons = m_events.front().buttons;
+			m_events.pop_front();
+			UpdateInputLines();
 		}
 	}
-	
+
 	virtual bool HandleRequest(MemoryRequestType requestType, Uint16 address, Uint8& value)
 	{
 		switch (address)
 		{
 		case Registers::P1_JOYP:
 			{
+				Update();
 				if (requestType == MemoryRequestType::Write)
 				{
+					// Selecting another row of buttons can pull lines low too
 					P1_JOYP = (P1_JOYP & 0x0F) | (value & 0xF0);
+					UpdateInputLines();
 				}
 				else
 				{
@@ -186,15 +129,41 @@ public:
 			}
 			break;
 		}
-	
+
 		return false;
 	}
 
 	Uint8 P1_JOYP;
 private:
-	float m_updateTimeLeft;
-	Uint8 m_lastP1_JOYP;
-	std::shared_ptr<SDL_Joystick> m_pJoystick;
+	// Works out the input lines (active low) from the held buttons and the rows selected, and fires the interrupt if any
+	// went low
+	void UpdateInputLines()
+	{
+		Uint8 pressed = 0;
+		if ((P1_JOYP & Bit5) == 0)
+		{
+			pressed |= m_buttons >> 4;
+		}
+		if ((P1_JOYP & Bit4) == 0)
+		{
+			pressed |= m_buttons & 0x0F;
+		}
+
+		Uint8 oldValues = P1_JOYP & 0x0F;
+		Uint8 newValues = ~pressed & 0x0F;
+		P1_JOYP = (P1_JOYP & 0xF0) | newValues;
+
+		if ((oldValues ^ newValues) & ~newValues)
+		{
+			m_pCpu->SignalInterrupt(Bit4);
+		}
+	}
 
 	std::shared_ptr<Cpu> m_pCpu;
-};
\ No newline at end of file
+	std::shared_ptr<MasterClock> m_pClock;
+
+	Uint8 m_buttons; // currently held
+	Uint8 m_lastQueuedButtons;
+	std::deque<InputEvent> m_events;
+	std::vector<InputEvent>* m_pRecording;
+};
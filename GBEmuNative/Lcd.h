@@ -3,6 +3,8 @@
 #include "IMemoryBusDevice.h"
 
 #include "Utils.h"
+#include "ScanlineRenderer.h"
+#include "LcdRenderWorker.h"
 
 class Lcd : public IMemoryBusDevice
 {
@@ -31,46 +33,93 @@ public:
 		ReadingOamAndVram,
 	};
 
-	static const int kScreenWidth = 160;
-	static const int kScreenHeight = 144;
+	static const int kScreenWidth = ScanlineRenderer::kScreenWidth;
+	static const int kScreenHeight = ScanlineRenderer::kScreenHeight;
 
-	static const int kVramBase = 0x8000;
-	static const int kVramSize = 0x2000;
+	static const int kVramBase = ScanlineRenderer::kVramBase;
+	static const int kVramSize = VideoMemory::kVramSize;
 
-	static const int kOamBase = 0xFE00;
-	static const int kOamSize = 0xFE9F - kOamBase + 1;
+	static const int kOamBase = ScanlineRenderer::kOamBase;
+	static const int kOamSize = VideoMemory::kOamSize;
+
+	static const int kTileMapBase = 0x9800; // tile data lives below this, the two 32x32 tile maps above
+
+	// PPU timing in dots (one dot per CPU clock cycle): every line, including the ten VBlank lines, is an 80-dot OAM scan, a
+	// pixel transfer of 172 dots plus penalties, and an HBlank taking up the rest of the 456
+	static const int kCyclesPerLine = 456;
+	static const int kLinesPerFrame = 154;
+	static const int kOamScanCycles = 80;
+	static const int kMinPixelTransferCycles = 172;
+	static const int kMaxPixelTransferCycles = 289;
+	static const int kWindowPenaltyCycles = 6;
+	static const int kMaxSpritesPerLine = 10;
+
+	// Frame skip value meaning that no frame is ever rendered; timing, interrupts and register behaviour are unaffected
+	static const int kSkipAllFrames = -1;
 
 	Lcd(const std::shared_ptr<MemoryBus>& memory, const std::shared_ptr<Cpu>& cpu, SDL_Renderer* pRenderer)
 		: m_pMemory(memory)
 		, m_pMemoryUnsafe(memory.get())
 		, m_pCpu(cpu)
 	{
-		if (!pRenderer)
+		// Without a renderer the LCD runs headless: frames are still produced in GetFrameBufferPixels(), but nothing is uploaded
+		if (pRenderer)
 		{
-			throw Exception("Couldn't create framebuffer texture");
+			m_pFrameBufferTexture.reset(SDL_CreateTexture(pRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, Lcd::kScreenWidth, Lcd::kScreenHeight), SDL_DestroyTexture);
+			if (!m_pFrameBufferTexture)
+			{
+				throw Exception("Couldn't create framebuffer texture");
+			}
 		}
-		auto createBufferFunc = [pRenderer]()
-		{
-			return std::shared_ptr<SDL_Texture>(SDL_CreateTexture(pRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, Lcd::kScreenWidth, Lcd::kScreenHeight), SDL_DestroyTexture);
-		};
-		m_pBackBuffer = createBufferFunc();
-		m_pFrontBuffer = createBufferFunc();
+
+		m_frameSkip = 0;
+		m_renderedFrameCount = 0;
+		m_reusedFrameCount = 0;
+		m_skippedFrameCount = 0;
+		m_frameBufferVersion = 0;
+		m_lastFrameUnchanged = false;
+		m_tileDataWriteCounter = 0;
+		m_presentPending = false;
+		m_verifyAsyncRendering = false;
+		m_asyncMismatchedFrameCount = 0;
+#if defined(_DEBUG)
+		m_verifyAsyncRendering = true;
+#endif
 
 		Reset();
 	}
 
+	~Lcd()
+	{
+		SetAsyncRendering(false);
+	}
+
 	void Reset()
 	{
-		m_updateTimeLeft = 0.0f;
+		m_cyclesUntilNextMode = 0;
+		m_cyclesPending = 0;
+		m_pixelTransferCycles = kMinPixelTransferCycles;
 		m_nextState = State::ReadingOam;
 		m_scanLine = 0;
 		m_wasLcdEnabledLastUpdate = true;
 		m_lastMode = 0;
+		m_framesSkippedSinceLastRender = 0;
+		BeginFrame();
 
 		RenderDisabledFrameBuffer();
+		m_lastFrameUnchanged = false;
 
-		memset(m_vram, 0xFD, sizeof(m_vram));
-		memset(m_oam, 0xFD, sizeof(m_oam));
+		memset(m_videoMemory.vram, 0xFD, sizeof(m_videoMemory.vram));
+		memset(m_videoMemory.oam, 0xFD, sizeof(m_videoMemory.oam));
+		// The write counter is never rewound, so every cell any renderer has cached is now stale
+		++m_tileDataWriteCounter;
+		for (int tile = 0; tile < VideoMemory::kTileDataCount; ++tile)
+		{
+			m_videoMemory.tileDataStamps[tile] = m_tileDataWriteCounter;
+		}
+		++m_vramGeneration;
+		++m_oamGeneration;
+		m_pVideoMemorySnapshot.reset();
 
 		LCDC = 0x91;
 		STAT = 0;
@@ -88,17 +137,140 @@ public:
 
 	SDL_Texture* GetFrontFrameBufferTexture() const
 	{
-		return m_pFrontBuffer.get();
+		return m_pFrameBufferTexture.get();
+	}
+
+	// The last completed frame, as 0xAARRGGBB pixels, kScreenWidth pixels per row
+	const Uint32* GetFrameBufferPixels() const
+	{
+		return m_frameBuffer;
+	}
+
+	// Bumped every time the presented frame's pixels actually change; presenters and encoders can skip work while it holds still
+	Uint32 GetFrameBufferVersion() const
+	{
+		return m_frameBufferVersion;
+	}
+
+	bool WasLastFrameUnchanged() const
+	{
+		return m_lastFrameUnchanged;
 	}
 
-	void Update(float seconds)
+	// Number of frames skipped for every frame rendered (0 renders every frame), or kSkipAllFrames.  Skipped frames go
+	// through exactly the same mode, STAT, LY and interrupt sequence; only pixel generation and the frame buffer upload are elided.
+	void SetFrameSkip(int framesSkippedPerRenderedFrame)
 	{
-		const float timeStep = 1.0f / MemoryBus::kCyclesPerSecond;
+		SDL_assert((framesSkippedPerRenderedFrame >= 0) || (framesSkippedPerRenderedFrame == kSkipAllFrames));
+		m_frameSkip = framesSkippedPerRenderedFrame;
+		m_framesSkippedSinceLastRender = 0;
+	}
 
-		// Documentation on the exact timing here quotes various numbers.
-		m_updateTimeLeft += seconds;
+	int GetFrameSkip() const
+	{
+		return m_frameSkip;
+	}
 
-		while (m_updateTimeLeft > 0.0f)
+	// Running totals of frames that reached VBlank: rendered frames had at least one line whose inputs changed, reused frames
+	// were identical to what was already in the frame buffer, and skipped frames were elided by the frame skip policy.
+	Uint32 GetRenderedFrameCount() const
+	{
+		return m_renderedFrameCount;
+	}
+
+	Uint32 GetReusedFrameCount() const
+	{
+		return m_reusedFrameCount;
+	}
+
+	Uint32 GetSkippedFrameCount() const
+	{
+		return m_skippedFrameCount;
+	}
+
+	// Called at every VBlank, once the frame's pixels (if it was rendered synchronously) are in GetFrameBufferPixels()
+	void SetFrameCallback(const std::function<void()>& callback)
+	{
+		m_frameCallback = callback;
+	}
+
+	// With asynchronous rendering on, the emulation thread only records each visible line's ScanlineInputs (plus a shared,
+	// immutable copy of video memory, taken only when VRAM or OAM changed since the last copy) and a worker thread
+	// rasterizes them while emulation continues.  The finished frame is picked up at the start of the next frame, ten
+	// VBlank lines later, so presentation lags by a fraction of a millisecond of emulated time; the pixels are identical.
+	void SetAsyncRendering(bool enabled)
+	{
+		if (enabled == IsAsyncRendering())
+		{
+			return;
+		}
+
+		if (enabled)
+		{
+			m_pRenderWorker.reset(new LcdRenderWorker());
+			memcpy(m_pRenderWorker->GetFrameBufferPixels(), m_frameBuffer, sizeof(m_frameBuffer));
+			memcpy(m_verifyFrameBuffer, m_frameBuffer, sizeof(m_frameBuffer));
+		}
+		else
+		{
+			// Lines of the frame in progress may still be in flight; bring them back so synchronous rendering carries on from them
+			CollectAsyncRendering();
+			m_pRenderWorker.reset();
+			m_pVideoMemorySnapshot.reset();
+		}
+	}
+
+	bool IsAsyncRendering() const
+	{
+		return m_pRenderWorker != nullptr;
+	}
+
+	// In verification mode (the default in debug builds) every line handed to the worker is also rendered synchronously
+	// into a reference buffer, and each collected frame is compared against it.
+	void SetVerifyAsyncRendering(bool enabled)
+	{
+		if (enabled && !m_verifyAsyncRendering)
+		{
+			// Start the reference from whatever the worker has drawn so far
+			CollectAsyncRendering();
+			memcpy(m_verifyFrameBuffer, m_frameBuffer, sizeof(m_frameBuffer));
+		}
+		m_verifyAsyncRendering = enabled;
+	}
+
+	Uint32 GetAsyncMismatchedFrameCount() const
+	{
+		return m_asyncMismatchedFrameCount;
+	}
+
+	// Waits for the worker to rasterize the lines queued so far and takes them as the frame buffer, so that from the frame
+	// callback an asynchronously rendered frame can be read as a synchronous one can
+	void FinishAsyncRendering()
+	{
+		CollectAsyncRendering();
+	}
+
+	void Update(int cycles)
+	{
+		// Nothing observable happens between mode changes, so until the next one comes due the time is only banked, and is
+		// spent by the update that reaches it, or before a write that moves the next one
+		m_cyclesPending += cycles;
+		if (m_cyclesPending >= m_cyclesUntilNextMode)
+		{
+			UpdatePendingCycles();
+		}
+	}
+
+	void UpdatePendingCycles()
+	{
+		auto cycles = m_cyclesPending;
+		m_cyclesPending = 0;
+
+		// Each mode change is processed once the dots of the mode before it have all elapsed; whatever an instruction
+		// overshot by is carried into the next mode, so frames are exactly 70224 cycles long.
+		m_cyclesUntilNextMode -= cycles;
+
+		while (m_cyclesUntilNextMode <= 0)
 		{
 			int mode = 0;
 			bool isLcdEnabled = (LCDC & Bit7) != 0;
@@ -111,10 +283,16 @@ public:
 						++m_scanLine;
 						++LY;
 
-						if (m_scanLine > 153)
+						if (m_scanLine >= kLinesPerFrame)
 						{
 							m_scanLine = 0;
+						}
+
+						// Line 0 starts from LY 0 both on wrapping and when the LCD is turned on
+						if (m_scanLine == 0)
+						{
 							LY = 0;
+							BeginFrame();
 						}
 
 						if (LY == LYC)
@@ -131,26 +309,27 @@ public:
 							STAT &= ~Bit2;
 						}
 
-						RenderScanline();
+						if (m_renderCurrentFrame)
+						{
+							RenderScanline();
+						}
 
-						//m_updateTimeLeft -= 0.000019f;
-						m_updateTimeLeft -= 80 * timeStep;
+						m_cyclesUntilNextMode += kOamScanCycles;
 						mode = 2;
 						m_nextState = State::ReadingOamAndVram;
 					}
 					break;
 				case State::ReadingOamAndVram:
 					{
-						//m_updateTimeLeft -= 0.000041f;
-						m_updateTimeLeft -= 172 * timeStep;
+						m_pixelTransferCycles = GetPixelTransferCycles();
+						m_cyclesUntilNextMode += m_pixelTransferCycles;
 						mode = 3;
 						m_nextState = State::HBlank;
 					}
 					break;
 				case State::HBlank:
 					{
-						//m_updateTimeLeft -= 0.0000486f;
-						m_updateTimeLeft -= 204 * timeStep;
+						m_cyclesUntilNextMode += kCyclesPerLine - kOamScanCycles - m_pixelTransferCycles;
 						mode = 0;
 						m_nextState = State::ReadingOam;
 					}
@@ -182,7 +361,7 @@ public:
 						}
 						// Always fire the blank into IF
 						m_pCpu->SignalInterrupt(Bit0);
-						SwapFrameBuffers();
+						EndFrame();
 						break;
 					case 2:
 						// Reading OAM interrupt
@@ -201,7 +380,7 @@ public:
 				// LCD is disabled
 				mode = 1;
 				m_lastMode = 1;
-				m_updateTimeLeft = 0.0f;
+				m_cyclesUntilNextMode = 0;
 				m_scanLine = -1;
 				LY = 0;
 				m_nextState = State::ReadingOam;
@@ -215,23 +394,57 @@ public:
 
 			// Mode is the lower two bits of the STAT register
 			STAT = (STAT & ~(Bit1 | Bit0)) | (mode);
+
+			if (!isLcdEnabled)
+			{
+				break;
+			}
 		}
 	}
 
-	void RenderDisabledFrameBuffer()
+	// Length of mode 3 on the current line.  The fine scroll discards SCX & 7 pixels first, the fetcher restarts when it
+	// reaches the window, and each sprite on the line stalls it for 6 to 11 dots depending on its alignment to the tile grid.
+	int GetPixelTransferCycles() const
 	{
-		void* pVoidPixels;
-		int pitch;
-		SDL_LockTexture(m_pBackBuffer.get(), NULL, &pVoidPixels, &pitch);
+		int cycles = kMinPixelTransferCycles + (SCX & 7);
+
+		if (m_scanLine < kScreenHeight)
+		{
+			if ((LCDC & Bit5) && (WY <= m_scanLine) && (WX <= 166))
+			{
+				cycles += kWindowPenaltyCycles;
+			}
+
+			if (LCDC & Bit1)
+			{
+				int spriteHeight = (LCDC & Bit2) ? 16 : 8;
+				int spriteCount = 0;
+				for (int spriteIndex = 0; (spriteIndex < 40) && (spriteCount < kMaxSpritesPerLine); ++spriteIndex)
+				{
+					const Uint8* pSprite = &m_videoMemory.oam[spriteIndex * 4];
+					int spriteY = pSprite[0] - 16;
+					if ((m_scanLine >= spriteY) && (m_scanLine < spriteY + spriteHeight))
+					{
+						cycles += 11 - SDL_min(5, (pSprite[1] + SCX) & 7);
+						++spriteCount;
+					}
+				}
+			}
+		}
 
-		char* pPixels = reinterpret_cast<char*>(pVoidPixels);
+		return SDL_min(cycles, kMaxPixelTransferCycles);
+	}
+
+	void RenderDisabledFrameBuffer()
+	{
+		CollectAsyncRendering();
 
 		//@TODO: replace with a memset or something, but in the meantime this allows for patterns to help debugging
 		for (Sint16 x = 0; x < kScreenWidth; ++x)
 		{
 			for (Sint16 y = 0; y < kScreenHeight; ++y)
 			{
-				Uint32* pARGB = reinterpret_cast<Uint32*>(pPixels + y * pitch + x * 4);
+				Uint32* pARGB = &m_frameBuffer[y * kScreenWidth + x];
 				
 				Uint8 r = 0xFF;
 				Uint8 g = 0xFF; //0x00;
@@ -239,287 +452,179 @@ public:
 				*pARGB = 0xFF000000 | (r << 16) | (g << 8) | b;
 			}
 		}
-		
-		SDL_UnlockTexture(m_pBackBuffer.get());
-		SwapFrameBuffers();
-	}
 
-	Uint8 ReadVram(Uint16 address)
-	{
-		Uint16 offset = address - kVramBase;
-		SDL_assert(offset < kVramSize);
+		for (int line = 0; line < kScreenHeight; ++line)
+		{
+			m_lineInputsValid[line] = false;
+		}
+
+		if (m_pRenderWorker)
+		{
+			memcpy(m_pRenderWorker->GetFrameBufferPixels(), m_frameBuffer, sizeof(m_frameBuffer));
+			memcpy(m_verifyFrameBuffer, m_frameBuffer, sizeof(m_frameBuffer));
+		}
 
-		return m_vram[offset];
+		PresentFrameBuffer();
 	}
 
-	Uint8 ReadOam(Uint16 address)
+	ScanlineInputs GetCurrentScanlineInputs() const
 	{
-		Uint16 offset = address - kOamBase;
-		SDL_assert(offset < kOamSize);
-
-		return m_oam[offset];
+		ScanlineInputs inputs;
+		inputs.vramGeneration = m_vramGeneration;
+		inputs.oamGeneration = m_oamGeneration;
+		inputs.LCDC = LCDC;
+		inputs.SCX = SCX;
+		inputs.SCY = SCY;
+		inputs.WX = WX;
+		inputs.WY = WY;
+		inputs.BGP = BGP;
+		inputs.OBP0 = OBP0;
+		inputs.OBP1 = OBP1;
+		return inputs;
 	}
 
-	Uint8 GetTileIndexAtXY(Uint16 tileMapBaseAddress, int x, int y)
+	void RenderScanline()
 	{
-		// Tiles are 8x8; see which tile we're in
-		Uint8 tileMapX = x / 8;
-		Uint8 tileMapY = y / 8;
+		if (LY < kScreenHeight)
+		{
+			// A line whose inputs match the ones it was last rendered with would come out identical, so keep the pixels
+			auto inputs = GetCurrentScanlineInputs();
+			if (m_lineInputsValid[LY] && (m_lineInputs[LY] == inputs))
+			{
+				return;
+			}
+			m_lineInputs[LY] = inputs;
+			m_lineInputsValid[LY] = true;
+			m_currentFrameChanged = true;
 
-		// Tile maps are 32x32
-		Uint16 tileOffset = tileMapY * 32 + tileMapX;
+			if (m_pRenderWorker)
+			{
+				if (!m_pVideoMemorySnapshot || (m_snapshotVramGeneration != m_vramGeneration) || (m_snapshotOamGeneration != m_oamGeneration))
+				{
+					m_pVideoMemorySnapshot = std::make_shared<const VideoMemory>(m_videoMemory);
+					m_snapshotVramGeneration = m_vramGeneration;
+					m_snapshotOamGeneration = m_oamGeneration;
+				}
 
-		Uint8 tileIndex = ReadVram(tileMapBaseAddress + tileOffset);
-		
-		return tileIndex;
+				LcdRenderWorker::LineJob job;
+				job.line = LY;
+				job.inputs = inputs;
+				job.pVideoMemory = m_pVideoMemorySnapshot;
+				m_pRenderWorker->SubmitLine(std::move(job));
+
+				if (m_verifyAsyncRendering)
+				{
+					m_renderer.RenderScanline(inputs, LY, m_videoMemory, &m_verifyFrameBuffer[LY * kScreenWidth]);
+				}
+			}
+			else
+			{
+				m_renderer.RenderScanline(inputs, LY, m_videoMemory, &m_frameBuffer[LY * kScreenWidth]);
+			}
+		}
 	}
 
-	Uint8 GetTileDataPixelColorIndex(Uint16 baseTileDataAddress, Sint16 tileIndex, int x, int y)
+	// Waits for the worker to drain and takes its pixels as the frame buffer, presenting them if a frame was completed
+	void CollectAsyncRendering()
 	{
-		// Fetch the pixel's color index from the tile data
-		Uint8 tileDataX = x % 8;
-		Uint8 tileDataY = y % 8;
-		Uint8 tileDataShift = 7 - tileDataX;
-		Uint8 tileDataMask = 1 << tileDataShift;
+		if (!m_pRenderWorker)
+		{
+			return;
+		}
 
-		// Each tile's data occupies 16 bytes, and each row of tile data occupies two bytes
-		Uint16 tileDataAddress = baseTileDataAddress + tileIndex * 16 + tileDataY * 2;
+		m_pRenderWorker->WaitUntilIdle();
+		memcpy(m_frameBuffer, m_pRenderWorker->GetFrameBufferPixels(), sizeof(m_frameBuffer));
 
-		Uint8 tileRowLsb = (ReadVram(tileDataAddress) & tileDataMask) >> tileDataShift;
-		Uint8 tileRowMsb = (ReadVram(tileDataAddress + 1) & tileDataMask) >> tileDataShift;
+		if (m_verifyAsyncRendering && (memcmp(m_frameBuffer, m_verifyFrameBuffer, sizeof(m_frameBuffer)) != 0))
+		{
+			++m_asyncMismatchedFrameCount;
+			SDL_assert(!"Asynchronous rendering diverged from synchronous rendering");
+		}
 
-		Uint8 colorIndex = (tileRowMsb << 1) | tileRowLsb;
+		if (m_presentPending)
+		{
+			m_presentPending = false;
+			PresentFrameBuffer();
+		}
+	}
 
-		return colorIndex;
+	void PresentFrameBuffer()
+	{
+		if (m_pFrameBufferTexture)
+		{
+			SDL_UpdateTexture(m_pFrameBufferTexture.get(), NULL, m_frameBuffer, kScreenWidth * sizeof(Uint32));
+		}
+		++m_frameBufferVersion;
 	}
 
-	Uint8 GetLuminosityForColorIndex(Uint8 paletteRegister, Uint8 colorIndex)
+	void BeginFrame()
 	{
-		// Translate the color index to an actual color using the palette registers
-		Uint8 shadeShift = 2 * colorIndex;
-		Uint8 shadeMask = 0x3 << shadeShift;
-		Uint8 shade = (paletteRegister & shadeMask) >> shadeShift;
+		// The previous frame's lines were queued during the previous frame; the worker has had the whole of VBlank to finish them
+		CollectAsyncRendering();
 
-		Uint8 luminosity = (3 - shade) * 0x55;
-		
-		return luminosity;
+		// Decide up front whether this frame's pixels will be consumed, so that a frame is never half-rendered
+		if (m_frameSkip == kSkipAllFrames)
+		{
+			m_renderCurrentFrame = false;
+		}
+		else
+		{
+			m_renderCurrentFrame = (m_framesSkippedSinceLastRender >= m_frameSkip);
+		}
+		m_currentFrameChanged = false;
 	}
 
-	void RenderScanline()
+	void EndFrame()
 	{
-		if (LY < kScreenHeight)
+		if (m_renderCurrentFrame)
 		{
-			void* pPixels;
-			int pitch;
-			SDL_LockTexture(m_pBackBuffer.get(), NULL, &pPixels, &pitch);
-
-			Uint32* pARGB = reinterpret_cast<Uint32*>(static_cast<Uint8*>(pPixels) + LY * pitch);
-
-			static int c = 0;
-			for (int screenX = 0; screenX < kScreenWidth; ++screenX)
+			m_framesSkippedSinceLastRender = 0;
+			m_lastFrameUnchanged = !m_currentFrameChanged;
+			if (m_currentFrameChanged)
 			{
-				Uint8 a = 0xFF;
-				Uint8 r = 0xFF;
-				Uint8 g = 0xFF;
-				Uint8 b = 0xFF;
-				Uint8 luminosity = 0;
-
-				bool backgroundIsTransparent = false;
-
-				if (LCDC & Bit0)
+				if (m_pRenderWorker)
 				{
-					// Background is active
-					Uint16 x = (SCX + screenX) % 256;
-					Uint16 y = (SCY + m_scanLine) % 256;
-
-					Uint16 tileMapBaseAddress = (LCDC & Bit3) ? 0x9C00 : 0x9800;
-					Sint16 tileIndex = GetTileIndexAtXY(tileMapBaseAddress, x, y);
-
-					// Find the tile data
-					Uint16 baseTileDataAddress = 0;
-					if (LCDC & Bit4)
-					{
-						baseTileDataAddress = 0x8000;
-					}
-					else
-					{
-						baseTileDataAddress = 0x9000; // tile data starts at 0x8800, but it's indexed using signed values so tile 0 is at 0x9000
-						if (tileIndex > 127)
-						{
-							tileIndex -= 256;
-						}
-					}
-
-					auto colorIndex = GetTileDataPixelColorIndex(baseTileDataAddress, tileIndex, x, y);
-
-					backgroundIsTransparent = (colorIndex == 0);
-					
-					luminosity = GetLuminosityForColorIndex(BGP, colorIndex);
+					m_presentPending = true;
 				}
-
-				static bool enableWindow = true;
-				if (enableWindow && (LCDC & Bit5))
+				else
 				{
-					// Window is active - always displayed above background
-					Sint16 x = screenX - (WX - 7);
-					Sint16 y = m_scanLine - WY;
-
-					if ((x >= 0) && (x < 160) && (y >= 0) && (y < 144))
-					{
-						Uint16 tileMapBaseAddress = (LCDC & Bit6) ? 0x9C00 : 0x9800;
-						Sint8 tileIndex = GetTileIndexAtXY(tileMapBaseAddress, x, y); // Window tiles are always signed
-
-						// Find the tile data
-						Uint16 baseTileDataAddress = 0x9000;
-						auto colorIndex = GetTileDataPixelColorIndex(baseTileDataAddress, tileIndex, x, y);
-
-						backgroundIsTransparent = (colorIndex == 0);
-
-						luminosity = GetLuminosityForColorIndex(BGP, colorIndex);
-					}
+					PresentFrameBuffer();
 				}
-
-                if (LCDC & Bit1)
-                {
-                    // Sprites are active
-                    bool sprites8x16 = ((LCDC & Bit2) != 0);
-
-                    Sint16 bestBaseX;
-                    int bestIndex = -1;
-                    Uint8 bestLuminosity;
-                    Uint8 bestAttributes;
-
-                    // Find the best sprite hit for this pixel
-                    for (int spriteIndex = 0; spriteIndex < 40; ++spriteIndex)
-                    {
-                        Uint16 spriteBaseAddress = 0xFE00 + spriteIndex * 4;
-                        Sint16 spriteBaseX = ReadOam(spriteBaseAddress + 1) - 8;
-                        Sint16 spriteBaseY = ReadOam(spriteBaseAddress + 0) - 16;
-
-                        Sint16 x = screenX - spriteBaseX;
-
-                        Sint16 y = m_scanLine - spriteBaseY;
-
-                        if ((x < 0) || (x >= 8))
-                        {
-                            continue;
-                        }
-
-                        if (y >= 16)
-                        {
-                            continue;
-                        }
-
-                        Uint8 tileIndex = ReadOam(spriteBaseAddress + 2);
-                        Uint8 attributes = ReadOam(spriteBaseAddress + 3);
-
-                        bool verticalFlip = ((attributes & Bit6) != 0);
-
-                        if (sprites8x16)
-                        {
-                            if (y >= 8)
-                            {
-                                y -= 8;
-
-                                if (!verticalFlip)
-                                {
-                                    tileIndex |= 1;
-                                }
-                                else
-                                {
-                                    tileIndex &= ~1;
-                                }
-                            }
-                            else
-                            {
-                                if (!verticalFlip)
-                                {
-                                    tileIndex &= ~1;
-                                }
-                                else
-                                {
-                                    tileIndex |= 1;
-                                }
-                            }
-                        }
-
-                        if ((y < 0) || (y >= 8))
-                        {
-                            continue;
-                        }
-
-                        // Horizontal flip
-						if (attributes & Bit5)
-						{
-							x = 7 - x;
-						}
-
-                        // Vertical flip
-						if (verticalFlip)
-						{
-							y = 7 - y;
-						}
-						
-                        auto colorIndex = GetTileDataPixelColorIndex(0x8000, tileIndex, x, y);
-                        if (colorIndex != 0)
-						{
-							if ((bestIndex < 0) || (spriteBaseX < bestBaseX))
-							{
-								bestBaseX = spriteBaseX;
-								bestIndex = spriteIndex;
-                                Uint8 palette = ((attributes & Bit4) != 0) ? OBP1 : OBP0;
-                                bestLuminosity = GetLuminosityForColorIndex(palette, colorIndex);;
-								bestAttributes = attributes;
-							}
-						}
-					}
-
-					if (bestIndex >= 0)
-					{
-						if (bestAttributes & Bit7)
-						{
-							// Sprite is behind background, it only shows if the background is transparent
-							if (backgroundIsTransparent)
-							{
-								luminosity = bestLuminosity;
-							}
-						}
-						else
-						{
-							// Sprite is in front of background, it always shows
-							luminosity = bestLuminosity;
-						}
-					}
-				}
-
-				r = luminosity;
-				g = luminosity;
-				b = luminosity;
-
-				*pARGB = 0xFF000000 | (r << 16) | (g << 8) | b;
-
-				++pARGB;
+				++m_renderedFrameCount;
 			}
-			++c;
-
-			if (LY == 0)
+			else
 			{
-				++c;
+				++m_reusedFrameCount;
 			}
-
-			SDL_UnlockTexture(m_pBackBuffer.get());
 		}
-	}
+		else
+		{
+			// Nothing else to do: VRAM and OAM live in this device and are always up to date, so the next rendered frame
+			// does not depend on anything a skipped frame would have produced.
+			++m_framesSkippedSinceLastRender;
+			++m_skippedFrameCount;
+		}
 
-	void SwapFrameBuffers()
-	{
-		std::swap(m_pFrontBuffer, m_pBackBuffer);
+		GetAnalyzer()->OnPostFrame();
+
+		if (m_frameCallback)
+		{
+			m_frameCallback();
+		}
 	}
 
 	virtual bool HandleRequest(MemoryRequestType requestType, Uint16 address, Uint8& value)
 	{
-		if (ServiceMemoryRangeRequest(requestType, address, value, kVramBase, kVramSize, m_vram))
+		if (ServiceMemoryRangeRequest(requestType, address, value, kVramBase, kVramSize, m_videoMemory.vram))
 		{
+			if (requestType == MemoryRequestType::Write)
+			{
+				++m_vramGeneration;
+				if (address < kTileMapBase)
+				{
+					m_videoMemory.tileDataStamps[(address - kVramBase) / 16] = ++m_tileDataWriteCounter;
+				}
+			}
 			GetAnalyzer()->OnPostVramAccess(requestType, address, value);
 			//if (TraceLog::IsEnabled())
 			//{
@@ -527,8 +632,12 @@ public:
 			//}
 			return true;
 		}
-		else if (ServiceMemoryRangeRequest(requestType, address, value, kOamBase, kOamSize, m_oam))
+		else if (ServiceMemoryRangeRequest(requestType, address, value, kOamBase, kOamSize, m_videoMemory.oam))
 		{
+			if (requestType == MemoryRequestType::Write)
+			{
+				++m_oamGeneration;
+			}
 			GetAnalyzer()->OnPostOamAccess(requestType, address, value);
 			//if (TraceLog::IsEnabled())
 			//{
@@ -540,7 +649,25 @@ public:
 		{
 			switch (address)
 			{
-			SERVICE_MMR_RW(LCDC)
+			case Registers::LCDC:
+				{
+					if (requestType == MemoryRequestType::Read)
+					{
+						value = LCDC;
+					}
+					else
+					{
+						// Turning the LCD off or on takes effect on this cycle rather than at the next mode change, so LY,
+						// the STAT mode and the LY=LYC flag are updated at the end of this instruction
+						UpdatePendingCycles();
+						if ((value ^ LCDC) & Bit7)
+						{
+							m_cyclesUntilNextMode = 0;
+						}
+						LCDC = value;
+					}
+					return true;
+				}
 
 			case Registers::STAT:
 				{
@@ -606,14 +733,43 @@ public:
 		return false;
 	}
 private:
-	float m_updateTimeLeft;
+	int m_cyclesUntilNextMode;
+	int m_cyclesPending; // banked by Update() until the next mode change
+	int m_pixelTransferCycles;
 	State m_nextState;
 	int m_scanLine;
 	bool m_wasLcdEnabledLastUpdate;
 	int m_lastMode;
 
-	Uint8 m_vram[kVramSize];
-	Uint8 m_oam[kOamSize];
+	int m_frameSkip;
+	int m_framesSkippedSinceLastRender;
+	bool m_renderCurrentFrame;
+	bool m_currentFrameChanged;
+	bool m_lastFrameUnchanged;
+	Uint32 m_renderedFrameCount;
+	Uint32 m_reusedFrameCount;
+	Uint32 m_skippedFrameCount;
+	std::function<void()> m_frameCallback;
+
+	Uint32 m_frameBuffer[kScreenWidth * kScreenHeight];
+	Uint32 m_frameBufferVersion;
+	ScanlineInputs m_lineInputs[kScreenHeight]; // what each line of m_frameBuffer was last rendered from
+	bool m_lineInputsValid[kScreenHeight];
+	Uint32 m_vramGeneration = 0;
+	Uint32 m_oamGeneration = 0;
+
+	VideoMemory m_videoMemory;
+	Uint32 m_tileDataWriteCounter; // source of VideoMemory::tileDataStamps; only ever increases
+	ScanlineRenderer m_renderer;
+
+	std::unique_ptr<LcdRenderWorker> m_pRenderWorker; // null when rendering synchronously
+	std::shared_ptr<const VideoMemory> m_pVideoMemorySnapshot; // the copy lines are currently being queued against
+	Uint32 m_snapshotVramGeneration;
+	Uint32 m_snapshotOamGeneration;
+	bool m_presentPending; // a completed frame is still with the worker
+	bool m_verifyAsyncRendering;
+	Uint32 m_asyncMismatchedFrameCount;
+	Uint32 m_verifyFrameBuffer[kScreenWidth * kScreenHeight];
 
 	Uint8 LCDC;
 	Uint8 STAT;
@@ -631,6 +787,5 @@ private:
 	std::shared_ptr<MemoryBus> m_pMemory;
 	MemoryBus* m_pMemoryUnsafe;
 	std::shared_ptr<Cpu> m_pCpu;
-	std::shared_ptr<SDL_Texture> m_pBackBuffer;
-	std::shared_ptr<SDL_Texture> m_pFrontBuffer;
+	std::shared_ptr<SDL_Texture> m_pFrameBufferTexture;
 };
\ No newline at end of file
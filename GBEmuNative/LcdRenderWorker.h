@@ -0,0 +1,102 @@
+#pragma once
+
+#include "ScanlineRenderer.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// Rasterizes scanlines on a dedicated thread.  The emulation thread queues each visible line as it is reached, together
+// with the register values it latched and a reference to an immutable copy of video memory, and carries on emulating;
+// the worker draws into its own frame buffer.  Nothing the worker touches is shared with the emulation thread except
+// the queue, and its frame buffer is only read back once the worker is idle.
+class LcdRenderWorker
+{
+public:
+	struct LineJob
+	{
+		int line;
+		ScanlineInputs inputs;
+		std::shared_ptr<const VideoMemory> pVideoMemory;
+	};
+
+	LcdRenderWorker()
+		: m_isBusy(false)
+		, m_quit(false)
+	{
+		memset(m_frameBuffer, 0xFF, sizeof(m_frameBuffer));
+		m_thread = std::thread([this]() { ThreadMain(); });
+	}
+
+	~LcdRenderWorker()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_workAvailable.notify_one();
+		m_thread.join();
+	}
+
+	void SubmitLine(LineJob&& job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back(std::move(job));
+		}
+		m_workAvailable.notify_one();
+	}
+
+	void WaitUntilIdle()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_workDone.wait(lock, [this]() { return m_queue.empty() && !m_isBusy; });
+	}
+
+	// Only valid to use between WaitUntilIdle() and the next SubmitLine()
+	Uint32* GetFrameBufferPixels()
+	{
+		return m_frameBuffer;
+	}
+
+private:
+	void ThreadMain()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;)
+		{
+			m_workAvailable.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+			if (m_quit)
+			{
+				break;
+			}
+
+			LineJob job = std::move(m_queue.front());
+			m_queue.pop_front();
+			m_isBusy = true;
+			lock.unlock();
+
+			m_renderer.RenderScanline(job.inputs, job.line, *job.pVideoMemory, &m_frameBuffer[job.line * ScanlineRenderer::kScreenWidth]);
+			job.pVideoMemory.reset();
+
+			lock.lock();
+			m_isBusy = false;
+			if (m_queue.empty())
+			{
+				m_workDone.notify_all();
+			}
+		}
+	}
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_workDone;
+	std::deque<LineJob> m_queue;
+	bool m_isBusy;
+	bool m_quit;
+
+	ScanlineRenderer m_renderer;
+	Uint32 m_frameBuffer[ScanlineRenderer::kScreenWidth * ScanlineRenderer::kScreenHeight];
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "MasterClock.h"
+#include "Utils.h"
+
+#include <memory>
+
+// The wire between two GameLinkPorts, for two emulated Game Boys in one process.  A transfer is a byte each way, clocked by
+// the side that started it (the master, on its internal clock) for kTransferCycles, and exchanged on the cycle it completes,
+// on both sides: the other side (normally waiting on the external clock) receives the master's byte then, and the master
+// receives whatever the other side had in SB at that point.
+//
+// The two sides are not stepped together.  Each runs freely, up to a window of cycles ahead of the other (see GameBoyPair),
+// and posts a transfer here when it starts one.  As long as the window is under a transfer's length, the other side cannot
+// have got past the cycle the transfer completes on by the time it is posted, so it always sees the byte arrive on the
+// right cycle.  The only place a side has to wait is at the end of a transfer it started, for the other side to catch up
+// and supply its byte; those waits are counted as stalls.
+class LinkCable
+{
+public:
+	// 8 bits at 8192Hz
+	static const Uint64 kTransferCycles = 4096;
+
+	struct Statistics
+	{
+		Uint32 transferCount;
+		Uint32 stallCount; // times a side stopped to wait for the other
+		Uint32 lateTransferCount; // transfers posted after the other side had passed their completion cycle
+		Uint64 lateCycles; // total cycles those were late by
+	};
+
+	LinkCable()
+	{
+		m_sides[0].pClock = nullptr;
+		m_sides[1].pClock = nullptr;
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (auto& side : m_sides)
+		{
+			ResetSide(side);
+		}
+		memset(&m_statistics, 0, sizeof(m_statistics));
+	}
+
+	void Connect(int side, const std::shared_ptr<MasterClock>& clock)
+	{
+		SDL_assert((side == 0) || (side == 1));
+		m_sides[side].pClock = clock;
+	}
+
+	// Drops the transfers to and from a side, when it is reset
+	void ResetSide(int side)
+	{
+		ResetSide(m_sides[side]);
+		// A transfer the other side started now finds nobody listening
+		auto& other = m_sides[1 - side];
+		if (other.transferring && !other.delivered)
+		{
+			other.delivered = true;
+			other.reply = 0xFF;
+		}
+	}
+
+	// Called by the master when it starts a transfer
+	void StartTransfer(int side, Uint8 value)
+	{
+		auto& self = m_sides[side];
+		auto& other = m_sides[1 - side];
+		SDL_assert(!self.transferring);
+
+		self.transferring = true;
+		self.delivered = false;
+		self.cycle = self.pClock->GetCycles() + kTransferCycles;
+		self.value = value;
+
+		// Only possible with a window wider than a transfer: the byte arrives as soon as the other side next looks
+		auto otherCycles = other.pClock ? other.pClock->GetCycles() : 0;
+		if (otherCycles > self.cycle)
+		{
+			++m_statistics.lateTransferCount;
+			m_statistics.lateCycles += otherCycles - self.cycle;
+		}
+	}
+
+	// The cycle of the next transfer arriving at the given side, or MasterClock::kNever
+	Uint64 GetIncomingTransferCycle(int side) const
+	{
+		const auto& other = m_sides[1 - side];
+		return (other.transferring && !other.delivered) ? other.cycle : MasterClock::kNever;
+	}
+
+	// Completes the arriving transfer at the receiving side: hands over the master's byte, and takes the receiver's reply
+	// (0xFF if it is not listening for one)
+	Uint8 ReceiveTransfer(int side, Uint8 reply)
+	{
+		auto& other = m_sides[1 - side];
+		SDL_assert(other.transferring && !other.delivered);
+		other.delivered = true;
+		other.reply = reply;
+		return other.value;
+	}
+
+	// The cycle the side's own transfer completes on, or MasterClock::kNever
+	Uint64 GetOutgoingTransferCycle(int side) const
+	{
+		const auto& self = m_sides[side];
+		return self.transferring ? self.cycle : MasterClock::kNever;
+	}
+
+	// Completes the side's own transfer if the other side has received it, giving the other side's byte
+	bool TryCompleteTransfer(int side, Uint8& value)
+	{
+		auto& self = m_sides[side];
+		SDL_assert(self.transferring);
+		if (!self.delivered)
+		{
+			return false;
+		}
+
+		self.transferring = false;
+		value = self.reply;
+		++m_statistics.transferCount;
+		return true;
+	}
+
+	void OnStall()
+	{
+		++m_statistics.stallCount;
+	}
+
+	const Statistics& GetStatistics() const
+	{
+		return m_statistics;
+	}
+
+private:
+	struct Side
+	{
+		std::shared_ptr<MasterClock> pClock;
+		bool transferring; // a transfer this side started is in progress
+		bool delivered; // the other side has received it
+		Uint64 cycle; // when it completes
+		Uint8 value; // this side's byte
+		Uint8 reply; // the other side's byte, once delivered
+	};
+
+	static void ResetSide(Side& side)
+	{
+		side.transferring = false;
+		side.delivered = false;
+		side.cycle = MasterClock::kNever;
+		side.value = 0xFF;
+		side.reply = 0xFF;
+	}
+
+	Side m_sides[2];
+	Statistics m_statistics;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Utils.h"
+
+// Counts every CPU cycle since power on.  Devices whose state is a function of time, like the timer, work it out from this
+// when accessed instead of being stepped after every instruction.  64 bits never wrap in practice.
+class MasterClock
+{
+public:
+	// For event cycles that are not scheduled
+	static const Uint64 kNever = ~static_cast<Uint64>(0);
+
+	MasterClock()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_cycles = 0;
+	}
+
+	void Advance(int cycles)
+	{
+		m_cycles += cycles;
+	}
+
+	Uint64 GetCycles() const
+	{
+		return m_cycles;
+	}
+
+private:
+	Uint64 m_cycles;
+};
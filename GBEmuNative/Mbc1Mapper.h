@@ -55,6 +55,7 @@ public:
 			if (IsAddressInRange(address, kRomFixedBankBase, kRomFixedBankSize))
 			{
 				value = m_pRomBytes[address - kRomFixedBankBase];
+				GetRomCoverage()->OnRomRead(address - kRomFixedBankBase);
 				return true;
 			}
 			else if (IsAddressInRange(address, kRomSwitchedBankBase, kRomSwitchedBankSize))
@@ -62,6 +63,7 @@ public:
 				auto offset = address - kRomSwitchedBankBase;
 				auto baseAddress = GetEffectiveRomBankIndex() * kRomSwitchedBankSize;
 				value = m_pRomBytes[baseAddress + offset];
+				GetRomCoverage()->OnRomRead(baseAddress + offset);
 				return true;
 			}
 			else if (IsAddressInRange(address, kRamBankBase, kRamBankSize))
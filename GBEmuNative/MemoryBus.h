@@ -1,6 +1,7 @@
 #pragma once
 
 #include "IMemoryBusDevice.h"
+#include "RomCoverage.h"
 #include "Utils.h"
 
 #include "SDL.h"
@@ -8,8 +9,6 @@
 #include <memory>
 #include <vector>
 
-extern float g_totalCyclesExecuted;
-
 namespace MemoryDeviceStatus
 {
 	enum Type
@@ -31,6 +30,13 @@ public:
 	{
 		Reset();
 		m_devicesLocked = false;
+		m_pRomCoverage = nullptr;
+	}
+
+	// Safe reads are peeks by the debugger and tracer, so are kept out of the coverage
+	void SetRomCoverage(RomCoverage* pRomCoverage)
+	{
+		m_pRomCoverage = pRomCoverage;
 	}
 
 	void AddDevice(std::shared_ptr<IMemoryBusDevice> pDevice)
@@ -70,8 +76,7 @@ public:
 
 		if (dataBreakpointActive && (address == dataBreakpointAddress))
 		{
-			static volatile int x = 3;
-			++x;
+			++m_dataBreakpointHitCount;
 		}
 
 		SDL_assert(m_devicesLocked);
@@ -97,6 +102,7 @@ public:
 	
 	bool SafeRead8(Uint16 address, Uint8& value)
 	{
+		RomCoverage::SuspendScope suspendCoverage(m_pRomCoverage);
 		bool success = true;
 		value = Read8(address, false, &success);
 		return success;
@@ -104,8 +110,9 @@ public:
 
 	Uint8 SafeRead8(Uint16 address)
 	{
-		bool success = true;
-		return Read8(address, false, &success);
+		Uint8 value = 0;
+		SafeRead8(address, value);
+		return value;
 	}
 
 	Uint16 Read16(Uint16 address)
@@ -116,6 +123,7 @@ public:
 
 	bool SafeRead16(Uint16 address, Uint16& value)
 	{
+		RomCoverage::SuspendScope suspendCoverage(m_pRomCoverage);
 		auto low = Uint8(0);
 		auto successLow = SafeRead8(address, low);
 		auto high = Uint8(0);
@@ -135,8 +143,7 @@ public:
 	{
 		if (dataBreakpointActive && (address == dataBreakpointAddress))
 		{
-			static volatile int x = 3;
-			++x;
+			++m_dataBreakpointHitCount;
 		}
 
 		SDL_assert(m_devicesLocked);
@@ -161,6 +168,7 @@ private:
 
 	static bool dataBreakpointActive;
 	static Uint16 dataBreakpointAddress;
+	volatile int m_dataBreakpointHitCount = 0; // somewhere to put a breakpoint; per bus, so that machines on different threads don't share it
 
 	void EnsureDeviceIsProbed(Uint16 address)
 	{
@@ -202,6 +210,7 @@ private:
 	}
 
 	Analyzer* m_pAnalyzer;
+	RomCoverage* m_pRomCoverage;
 
 	bool m_devicesLocked;
 	std::vector<std::shared_ptr<IMemoryBusDevice>> m_devices;
@@ -1,10 +1,20 @@
 #pragma once
 
 #include "IMemoryBusDevice.h"
+#include "RomCoverage.h"
 
 class MemoryMapper : public IMemoryBusDevice
 {
 public:
 	virtual void Reset() = 0;
 	virtual Uint8 GetActiveBank() = 0;
+
+	// Told of every ROM read, by offset in the ROM
+	void SetRomCoverage(RomCoverage* pRomCoverage) { m_pRomCoverage = pRomCoverage; }
+
+protected:
+	RomCoverage* GetRomCoverage() const { SDL_assert(m_pRomCoverage != nullptr); return m_pRomCoverage; }
+
+private:
+	RomCoverage* m_pRomCoverage = nullptr;
 };
\ No newline at end of file
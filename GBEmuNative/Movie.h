@@ -0,0 +1,207 @@
+#pragma once
+
+#include "Joypad.h"
+#include "Utils.h"
+
+#include <stdio.h>
+#include <vector>
+
+// An input movie: what is needed to replay a session exactly.  Emulation is deterministic given the ROM, the state it starts
+// from and the input, so that is all a movie holds, with the input as joypad events, each a button mask and the master clock
+// cycle it took effect on.
+//
+// File layout:
+//   "GBMV", then a version byte
+//   ROM hash, 8 bytes little-endian
+//   Start state, 1 byte: 0 is power-on; other values are reserved for embedded save states
+//   Length in cycles, varint
+//   Event count, varint
+//   For each event: cycles since the previous event (or the start), varint; button mask, 1 byte
+//
+// Varints are LEB128: 7 bits a byte, low bits first, with the top bit set on all but the last byte.  With input changing
+// every second or so, a delta takes three bytes and an event four, so an hour of play is some tens of KB at most.
+class Movie
+{
+public:
+	enum class StartState
+	{
+		PowerOn = 0,
+	};
+
+	static const Uint32 kMagic = 0x564D4247; // "GBMV" little-endian
+	static const Uint8 kVersion = 2; // 1 hashed ROMs a 64-bit word at a time
+	static const Uint64 kHashSeed = 0xCBF29CE484222325ULL;
+
+	Movie(Uint64 romHash = 0)
+		: m_romHash(romHash)
+		, m_startState(StartState::PowerOn)
+		, m_lengthCycles(0)
+	{
+	}
+
+	Uint64 GetRomHash() const
+	{
+		return m_romHash;
+	}
+
+	StartState GetStartState() const
+	{
+		return m_startState;
+	}
+
+	Uint64 GetLengthCycles() const
+	{
+		return m_lengthCycles;
+	}
+
+	void SetLengthCycles(Uint64 lengthCycles)
+	{
+		m_lengthCycles = lengthCycles;
+	}
+
+	std::vector<Joypad::InputEvent>& GetEvents()
+	{
+		return m_events;
+	}
+
+	const std::vector<Joypad::InputEvent>& GetEvents() const
+	{
+		return m_events;
+	}
+
+	void Save(const char* pFileName) const
+	{
+		std::vector<Uint8> data;
+		for (int i = 0; i < 4; ++i)
+		{
+			data.push_back(static_cast<Uint8>(kMagic >> (i * 8)));
+		}
+		data.push_back(static_cast<Uint8>(kVersion));
+		for (int i = 0; i < 8; ++i)
+		{
+			data.push_back(static_cast<Uint8>(m_romHash >> (i * 8)));
+		}
+		data.push_back(static_cast<Uint8>(m_startState));
+		WriteVarint(data, m_lengthCycles);
+		WriteVarint(data, m_events.size());
+
+		Uint64 lastCycle = 0;
+		for (const auto& event : m_events)
+		{
+			WriteVarint(data, event.cycle - lastCycle);
+			data.push_back(event.buttons);
+			lastCycle = event.cycle;
+		}
+
+		FILE* pFile = nullptr;
+		if ((fopen_s(&pFile, pFileName, "wb") != 0) || !pFile)
+		{
+			throw Exception("Couldn't open movie file for writing: %s", pFileName);
+		}
+		bool succeeded = (fwrite(data.data(), data.size(), 1, pFile) == 1);
+		succeeded = (fclose(pFile) == 0) && succeeded;
+		if (!succeeded)
+		{
+			throw Exception("Couldn't write movie file: %s", pFileName);
+		}
+	}
+
+	static Movie Load(const char* pFileName)
+	{
+		std::vector<Uint8> data;
+		LoadFileAsByteArray(data, pFileName);
+
+		size_t offset = 0;
+		auto readByte = [&]() -> Uint8
+		{
+			if (offset >= data.size())
+			{
+				throw Exception("Truncated movie file: %s", pFileName);
+			}
+			return data[offset++];
+		};
+		auto readVarint = [&]() -> Uint64
+		{
+			Uint64 value = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				Uint8 byte = readByte();
+				value |= static_cast<Uint64>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0)
+				{
+					return value;
+				}
+			}
+			throw Exception("Bad varint in movie file: %s", pFileName);
+		};
+
+		for (int i = 0; i < 4; ++i)
+		{
+			if (readByte() != static_cast<Uint8>(kMagic >> (i * 8)))
+			{
+				throw Exception("Not a movie file: %s", pFileName);
+			}
+		}
+		auto version = readByte();
+		if (version != kVersion)
+		{
+			throw Exception("Unsupported movie version %d: %s", version, pFileName);
+		}
+
+		Uint64 romHash = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			romHash |= static_cast<Uint64>(readByte()) << (i * 8);
+		}
+
+		Movie movie(romHash);
+		auto startState = readByte();
+		if (startState != static_cast<Uint8>(StartState::PowerOn))
+		{
+			throw Exception("Unsupported movie start state %d: %s", startState, pFileName);
+		}
+		movie.m_lengthCycles = readVarint();
+
+		auto numEvents = readVarint();
+		Uint64 cycle = 0;
+		for (Uint64 i = 0; i < numEvents; ++i)
+		{
+			cycle += readVarint();
+			Joypad::InputEvent event = { cycle, readByte() };
+			movie.m_events.push_back(event);
+		}
+
+		return movie;
+	}
+
+	// 64-bit FNV-1a, a byte at a time, for ROM identity and frame checksums.  Chain calls by passing the previous result as the
+	// hash; hashing data in pieces gives the same result as hashing it all at once.  ROM hashes are the same on any host, but
+	// frame buffers and other multi-byte values are hashed as they lie in memory, so those only compare between hosts of one
+	// byte order.
+	static Uint64 Hash(const void* pData, size_t size, Uint64 hash = kHashSeed)
+	{
+		static const Uint64 prime = 0x100000001B3ULL;
+		const Uint8* pBytes = static_cast<const Uint8*>(pData);
+		for (; size > 0; --size, ++pBytes)
+		{
+			hash = (hash ^ *pBytes) * prime;
+		}
+		return hash;
+	}
+
+private:
+	static void WriteVarint(std::vector<Uint8>& data, Uint64 value)
+	{
+		while (value >= 0x80)
+		{
+			data.push_back(static_cast<Uint8>(value | 0x80));
+			value >>= 7;
+		}
+		data.push_back(static_cast<Uint8>(value));
+	}
+
+	Uint64 m_romHash;
+	StartState m_startState;
+	Uint64 m_lengthCycles;
+	std::vector<Joypad::InputEvent> m_events;
+};
@@ -0,0 +1,80 @@
+#include "RomCoverage.h"
+
+void RomCoverage::Save(const char* pFileName) const
+{
+	SDL_assert(IsEnabled());
+
+	FILE* pFile = nullptr;
+	if ((fopen_s(&pFile, pFileName, "wb") != 0) || !pFile)
+	{
+		throw Exception("Can't open %s for writing", pFileName);
+	}
+	Janitor closeFile([&] { fclose(pFile); });
+
+	// The planes are little-endian words, so their bytes are already in file order
+	auto magic = kMagic;
+	auto version = kVersion;
+	auto romSize = static_cast<Uint32>(m_romSize);
+	auto planeSize = (m_romSize + 7) / 8;
+	auto success = (fwrite(&magic, sizeof(magic), 1, pFile) == 1)
+		&& (fwrite(&version, sizeof(version), 1, pFile) == 1)
+		&& (fwrite(&romSize, sizeof(romSize), 1, pFile) == 1);
+	for (const auto& plane : m_planes)
+	{
+		success = success && ((planeSize == 0) || (fwrite(plane.data(), planeSize, 1, pFile) == 1));
+	}
+	if (!success)
+	{
+		throw Exception("Failed to write %s", pFileName);
+	}
+}
+
+std::string RomCoverage::GetSummary() const
+{
+	SDL_assert(IsEnabled());
+
+	struct Counts
+	{
+		size_t code = 0; // opcodes and operands
+		size_t data = 0;
+		size_t codeAndData = 0;
+		size_t untouched = 0;
+	};
+
+	auto getLine = [](const char* pName, const Counts& counts, size_t size)
+	{
+		return Format("%-6s %8u code (%5.1f%%) %8u data (%5.1f%%) %8u both (%5.1f%%) %8u untouched (%5.1f%%)\n", pName,
+			static_cast<Uint32>(counts.code), 100.0 * counts.code / size, static_cast<Uint32>(counts.data), 100.0 * counts.data / size,
+			static_cast<Uint32>(counts.codeAndData), 100.0 * counts.codeAndData / size, static_cast<Uint32>(counts.untouched), 100.0 * counts.untouched / size);
+	};
+
+	const auto& opcodes = m_planes[static_cast<int>(Access::Opcode)];
+	const auto& operands = m_planes[static_cast<int>(Access::Operand)];
+	const auto& data = m_planes[static_cast<int>(Access::Data)];
+
+	std::string summary;
+	Counts total;
+	for (size_t bankOffset = 0; bankOffset < m_romSize; bankOffset += kBankSize)
+	{
+		Counts bank;
+		auto bankEnd = SDL_min(bankOffset + kBankSize, m_romSize);
+		for (auto offset = bankOffset; offset < bankEnd; ++offset)
+		{
+			auto bit = 1u << (offset % 32);
+			auto isCode = ((opcodes[offset / 32] | operands[offset / 32]) & bit) != 0;
+			auto isData = (data[offset / 32] & bit) != 0;
+			bank.code += (isCode && !isData) ? 1 : 0;
+			bank.data += (isData && !isCode) ? 1 : 0;
+			bank.codeAndData += (isCode && isData) ? 1 : 0;
+			bank.untouched += (!isCode && !isData) ? 1 : 0;
+		}
+		summary += getLine(Format("%02X", static_cast<int>(bankOffset / kBankSize)).c_str(), bank, bankEnd - bankOffset);
+
+		total.code += bank.code;
+		total.data += bank.data;
+		total.codeAndData += bank.codeAndData;
+		total.untouched += bank.untouched;
+	}
+	summary += getLine("total", total, m_romSize);
+	return summary;
+}
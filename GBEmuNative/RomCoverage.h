@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <string>
+#include <vector>
+
+#define ENABLE_ROM_COVERAGE 0
+
+// Which ROM bytes the guest has executed as opcodes, fetched as operands or read as data, by offset in the ROM file, so per
+// bank: the mappers report each read with its ROM offset, and the CPU says which kind of read it is while fetching.  Every
+// other read, by the CPU or by DMA, is data; peeks by the debugger and tracer are not recorded.  A byte can be more than one
+// of these, as when code is copied to RAM or checksummed.  With ENABLE_ROM_COVERAGE off, all of this compiles away.
+//
+// File layout:
+//   "GBCV", then a version byte
+//   ROM size in bytes, 4 bytes little-endian
+//   Three bit planes, for opcodes, operands and data in that order, of (ROM size + 7) / 8 bytes each; the bit for ROM offset
+//   n is bit n % 8 of byte n / 8, and bank b covers offsets b * 4000h to b * 4000h + 3FFFh
+class RomCoverage
+{
+public:
+	enum class Access
+	{
+		Opcode,
+		Operand,
+		Data,
+		Count
+	};
+
+	static const Uint32 kMagic = 0x56434247; // "GBCV" little-endian
+	static const Uint8 kVersion = 1;
+	static const Uint32 kBankSize = 0x4000;
+
+	// Reads made while one of these is in scope are not recorded, for the debugger and tracer to peek at memory through the
+	// mappers without the guest having read anything
+	class SuspendScope
+	{
+	public:
+		explicit SuspendScope(RomCoverage* pRomCoverage)
+			: m_pRomCoverage(pRomCoverage)
+		{
+			if (m_pRomCoverage)
+			{
+				++m_pRomCoverage->m_suspendCount;
+			}
+		}
+
+		~SuspendScope()
+		{
+			if (m_pRomCoverage)
+			{
+				--m_pRomCoverage->m_suspendCount;
+			}
+		}
+
+	private:
+		SuspendScope(const SuspendScope&) = delete;
+		SuspendScope& operator=(const SuspendScope&) = delete;
+
+		RomCoverage* m_pRomCoverage;
+	};
+
+	explicit RomCoverage(size_t romSize)
+		: m_romSize(romSize)
+		, m_access(Access::Data)
+		, m_suspendCount(0)
+	{
+#if ENABLE_ROM_COVERAGE
+		for (auto& plane : m_planes)
+		{
+			plane.assign((romSize + 31) / 32, 0);
+		}
+#endif
+	}
+
+	static bool IsEnabled()
+	{
+		return ENABLE_ROM_COVERAGE != 0;
+	}
+
+	// Forgets what has been read so far
+	void Clear()
+	{
+		for (auto& plane : m_planes)
+		{
+			std::fill(plane.begin(), plane.end(), 0);
+		}
+	}
+
+	// What the ROM reads that follow are, until set again
+	void SetAccess(Access access)
+	{
+#if ENABLE_ROM_COVERAGE
+		m_access = access;
+#endif
+	}
+
+	void OnRomRead(size_t romOffset)
+	{
+#if ENABLE_ROM_COVERAGE
+		SDL_assert(romOffset < m_romSize);
+		if (m_suspendCount == 0)
+		{
+			m_planes[static_cast<int>(m_access)][romOffset / 32] |= 1u << (romOffset % 32);
+		}
+#endif
+	}
+
+	void Save(const char* pFileName) const;
+
+	// One line per bank with its bytes of code, data, both and neither, then the totals
+	std::string GetSummary() const;
+
+private:
+	size_t m_romSize;
+	Access m_access;
+	int m_suspendCount; // SuspendScope nesting
+	std::vector<Uint32> m_planes[static_cast<int>(Access::Count)]; // a bit per ROM byte; empty with ENABLE_ROM_COVERAGE off
+};
@@ -34,6 +34,7 @@ public:
 			else
 			{
 				value = m_pRom->GetRom()[address - kRomBase];
+				GetRomCoverage()->OnRomRead(address - kRomBase);
 				return true;
 			}
 		}
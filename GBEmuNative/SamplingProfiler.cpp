@@ -0,0 +1,41 @@
+#include "SamplingProfiler.h"
+
+#include <map>
+#include <string>
+
+void SamplingProfiler::WriteFoldedStacks(const char* pFileName) const
+{
+	// Counted by stack first, so that each distinct one is formatted once
+	std::map<std::vector<Uint32>, Uint32> stackCounts;
+	std::vector<Uint32> stack;
+	for (size_t i = 0; i < m_samples.size(); )
+	{
+		auto numKeys = m_samples[i] + 1;
+		stack.assign(m_samples.begin() + i + 1, m_samples.begin() + i + 1 + numKeys);
+		++stackCounts[stack];
+		i += 1 + numKeys;
+	}
+
+	FILE* pFile = nullptr;
+	if ((fopen_s(&pFile, pFileName, "wb") != 0) || !pFile)
+	{
+		throw Exception("Can't open %s for writing", pFileName);
+	}
+	Janitor closeFile([&] { fclose(pFile); });
+
+	std::string text;
+	for (const auto& stackCount : stackCounts)
+	{
+		for (size_t i = 0; i < stackCount.first.size(); ++i)
+		{
+			auto key = stackCount.first[i];
+			text += Format((i == 0) ? "%02X:%04X" : ";%02X:%04X", key >> 16, key & 0xFFFF);
+		}
+		text += Format(" %u\n", stackCount.second);
+	}
+
+	if (!text.empty() && (fwrite(text.data(), text.length(), 1, pFile) != 1))
+	{
+		throw Exception("Failed to write %s", pFileName);
+	}
+}
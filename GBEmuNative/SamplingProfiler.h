@@ -0,0 +1,140 @@
+#pragma once
+
+#include "MasterClock.h"
+#include "MemoryMapper.h"
+#include "Utils.h"
+
+#include <memory>
+#include <vector>
+
+// Samples where the guest is every so many cycles: the bank and PC, and the call stack that led there.  Unlike the analyzer
+// it needs no special build and costs little enough to leave on while playing: the CPU keeps a shadow call stack as it
+// calls, takes interrupts and returns, and a sample is a copy of it into a buffer allocated up front.  Samples that don't fit
+// are dropped and counted.  The samples are written out as folded stacks, one line per distinct stack with its count, as
+// read by flamegraph.pl, speedscope and inferno.
+class SamplingProfiler
+{
+public:
+	// Frames deeper than this are counted, so that returns stay balanced, but not sampled
+	static const int kMaxDepth = 32;
+
+	SamplingProfiler(const std::shared_ptr<MemoryMapper>& pMapper, const std::shared_ptr<MasterClock>& pClock, Uint32 cyclesPerSample, size_t bufferWords)
+		: m_pMapper(pMapper)
+		, m_pClock(pClock)
+		, m_cyclesPerSample(cyclesPerSample)
+		, m_numSamples(0)
+		, m_numDroppedSamples(0)
+	{
+		if (cyclesPerSample == 0)
+		{
+			throw Exception("The sampling period has to be at least one cycle");
+		}
+		m_samples.reserve(bufferWords);
+		Reset();
+	}
+
+	// The clock and the CPU restart with the emulator; the samples taken so far are kept
+	void Reset()
+	{
+		m_depth = 0;
+		m_nextSampleCycle = m_pClock->GetCycles() + m_cyclesPerSample;
+	}
+
+	Uint64 GetNextSampleCycle() const
+	{
+		return m_nextSampleCycle;
+	}
+
+	// After the return address is pushed, at the given stack pointer
+	void OnCall(Uint16 address, Uint16 SP)
+	{
+		// Frames whose return address is no longer on the stack were left without a RET, as when code drops its return address
+		// and jumps back to a caller's caller
+		while ((m_depth > 0) && (m_depth <= kMaxDepth) && (m_stack[m_depth - 1].SP <= SP))
+		{
+			--m_depth;
+		}
+
+		if (m_depth < kMaxDepth)
+		{
+			auto& frame = m_stack[m_depth];
+			frame.key = GetKey(address);
+			frame.SP = SP;
+		}
+		++m_depth;
+	}
+
+	// Before the return address is popped, from the given stack pointer
+	void OnReturn(Uint16 SP)
+	{
+		if (m_depth > kMaxDepth)
+		{
+			--m_depth;
+			return;
+		}
+
+		// A RET with no matching call, as used to jump to a pushed address, leaves the stack as it is
+		while ((m_depth > 0) && (m_stack[m_depth - 1].SP <= SP))
+		{
+			--m_depth;
+		}
+	}
+
+	// Due when the clock reaches GetNextSampleCycle()
+	void Sample(Uint16 PC)
+	{
+		m_nextSampleCycle += m_cyclesPerSample;
+
+		// A sample is its depth, the entry points of the functions on the stack from the bottom, and the PC
+		auto depth = SDL_min(m_depth, kMaxDepth);
+		if (m_samples.size() + depth + 2 > m_samples.capacity())
+		{
+			++m_numDroppedSamples;
+			return;
+		}
+		m_samples.push_back(depth);
+		for (int i = 0; i < depth; ++i)
+		{
+			m_samples.push_back(m_stack[i].key);
+		}
+		m_samples.push_back(GetKey(PC));
+		++m_numSamples;
+	}
+
+	Uint32 GetNumSamples() const
+	{
+		return m_numSamples;
+	}
+
+	Uint32 GetNumDroppedSamples() const
+	{
+		return m_numDroppedSamples;
+	}
+
+	// "<bank>:<address>" frames from the bottom of the stack to the PC, separated by semicolons, and the number of samples
+	void WriteFoldedStacks(const char* pFileName) const;
+
+private:
+	struct Frame
+	{
+		Uint32 key;
+		Uint16 SP;
+	};
+
+	// The bank in the top 8 bits, for the banked window at 4000h-7FFFh only
+	Uint32 GetKey(Uint16 address) const
+	{
+		auto isBanked = (address >= 0x4000) && (address < 0x8000);
+		return isBanked ? ((m_pMapper->GetActiveBank() << 16) | address) : address;
+	}
+
+	std::shared_ptr<MemoryMapper> m_pMapper;
+	std::shared_ptr<MasterClock> m_pClock;
+	Uint32 m_cyclesPerSample;
+	Uint64 m_nextSampleCycle;
+	Frame m_stack[kMaxDepth];
+	int m_depth;
+	std::vector<Uint32> m_samples; // never grows past its initial capacity
+	Uint32 m_numSamples;
+	Uint32 m_numDroppedSamples;
+};
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "Utils.h"
+
+// Everything a visible scanline's pixels depend on, other than its index.  VRAM and OAM are summarized by write generations.
+struct ScanlineInputs
+{
+	Uint32 vramGeneration;
+	Uint32 oamGeneration;
+	Uint8 LCDC;
+	Uint8 SCX;
+	Uint8 SCY;
+	Uint8 WX;
+	Uint8 WY;
+	Uint8 BGP;
+	Uint8 OBP0;
+	Uint8 OBP1;
+
+	bool operator==(const ScanlineInputs& other) const
+	{
+		return (vramGeneration == other.vramGeneration) && (oamGeneration == other.oamGeneration)
+			&& (LCDC == other.LCDC) && (SCX == other.SCX) && (SCY == other.SCY) && (WX == other.WX) && (WY == other.WY)
+			&& (BGP == other.BGP) && (OBP0 == other.OBP0) && (OBP1 == other.OBP1);
+	}
+};
+
+// The memory the rasterizer reads.  Plain data so that it can be copied wholesale into a snapshot for another thread.
+struct VideoMemory
+{
+	static const int kVramSize = 0x2000;
+	static const int kOamSize = 0xA0;
+	static const int kTileDataCount = 384;
+
+	Uint8 vram[kVramSize];
+	Uint8 oam[kOamSize];
+	Uint32 tileDataStamps[kTileDataCount]; // write stamp of each tile's data, for the background layer cache
+};
+
+// Turns one line's ScanlineInputs and the video memory into ARGB pixels.  Holds no emulation state, only the background
+// layer cache, so several instances (one per thread) produce identical output from identical inputs.
+class ScanlineRenderer
+{
+public:
+	static const int kScreenWidth = 160;
+	static const int kScreenHeight = 144;
+
+	static const int kVramBase = 0x8000;
+	static const int kOamBase = 0xFE00;
+
+	static const int kTileMapCellCount = 32 * 32;
+	static const int kBackgroundLayerSize = 256;
+
+	ScanlineRenderer()
+		: m_pVideoMemory(nullptr)
+	{
+		InvalidateBackgroundLayers();
+	}
+
+	void InvalidateBackgroundLayers()
+	{
+		for (int tileMap = 0; tileMap < 2; ++tileMap)
+		{
+			for (int cell = 0; cell < kTileMapCellCount; ++cell)
+			{
+				m_backgroundLayerCellTiles[tileMap][cell] = kInvalidTileDataIndex;
+				m_backgroundLayerCellStamps[tileMap][cell] = 0;
+			}
+		}
+	}
+
+	void RenderScanline(const ScanlineInputs& inputs, int line, const VideoMemory& videoMemory, Uint32* pARGB)
+	{
+		SDL_assert((line >= 0) && (line < kScreenHeight));
+		m_pVideoMemory = &videoMemory;
+
+		// SCX, SCY and BGP are sampled once here, at the start of the line, which is what latches mid-frame register changes per line
+		Uint8 backgroundColorIndices[kScreenWidth];
+		Uint8 backgroundLuminosities[4];
+		if (inputs.LCDC & Bit0)
+		{
+			CopyBackgroundLayerScanline(inputs.LCDC, (inputs.LCDC & Bit3) ? 1 : 0, inputs.SCX, (inputs.SCY + line) % 256, backgroundColorIndices);
+
+			for (Uint8 colorIndex = 0; colorIndex < 4; ++colorIndex)
+			{
+				backgroundLuminosities[colorIndex] = GetLuminosityForColorIndex(inputs.BGP, colorIndex);
+			}
+		}
+
+		for (int screenX = 0; screenX < kScreenWidth; ++screenX)
+		{
+			Uint8 a = 0xFF;
+			Uint8 r = 0xFF;
+			Uint8 g = 0xFF;
+			Uint8 b = 0xFF;
+			Uint8 luminosity = 0;
+
+			bool backgroundIsTransparent = false;
+
+			if (inputs.LCDC & Bit0)
+			{
+				// Background is active
+				auto colorIndex = backgroundColorIndices[screenX];
+
+				backgroundIsTransparent = (colorIndex == 0);
+				
+				luminosity = backgroundLuminosities[colorIndex];
+			}
+
+			static bool enableWindow = true;
+			if (enableWindow && (inputs.LCDC & Bit5))
+			{
+				// Window is active - always displayed above background
+				Sint16 x = screenX - (inputs.WX - 7);
+				Sint16 y = line - inputs.WY;
+
+				if ((x >= 0) && (x < 160) && (y >= 0) && (y < 144))
+				{
+					Uint16 tileMapBaseAddress = (inputs.LCDC & Bit6) ? 0x9C00 : 0x9800;
+					Sint8 tileIndex = GetTileIndexAtXY(tileMapBaseAddress, x, y); // Window tiles are always signed
+
+					// Find the tile data
+					Uint16 baseTileDataAddress = 0x9000;
+					auto colorIndex = GetTileDataPixelColorIndex(baseTileDataAddress, tileIndex, x, y);
+
+					backgroundIsTransparent = (colorIndex == 0);
+
+					luminosity = GetLuminosityForColorIndex(inputs.BGP, colorIndex);
+				}
+			}
+
+            if (inputs.LCDC & Bit1)
+            {
+                // Sprites are active
+                bool sprites8x16 = ((inputs.LCDC & Bit2) != 0);
+
+                Sint16 bestBaseX;
+                int bestIndex = -1;
+                Uint8 bestLuminosity;
+                Uint8 bestAttributes;
+
+                // Find the best sprite hit for this pixel
+                for (int spriteIndex = 0; spriteIndex < 40; ++spriteIndex)
+                {
+                    Uint16 spriteBaseAddress = 0xFE00 + spriteIndex * 4;
+                    Sint16 spriteBaseX = ReadOam(spriteBaseAddress + 1) - 8;
+                    Sint16 spriteBaseY = ReadOam(spriteBaseAddress + 0) - 16;
+
+                    Sint16 x = screenX - spriteBaseX;
+
+                    Sint16 y = line - spriteBaseY;
+
+                    if ((x < 0) || (x >= 8))
+                    {
+                        continue;
+                    }
+
+                    if (y >= 16)
+                    {
+                        continue;
+                    }
+
+                    Uint8 tileIndex = ReadOam(spriteBaseAddress + 2);
+                    Uint8 attributes = ReadOam(spriteBaseAddress + 3);
+
+                    bool verticalFlip = ((attributes & Bit6) != 0);
+
+                    if (sprites8x16)
+                    {
+                        if (y >= 8)
+                        {
+                            y -= 8;
+
+                            if (!verticalFlip)
+                            {
+                                tileIndex |= 1;
+                            }
+                            else
+                            {
+                                tileIndex &= ~1;
+                            }
+                        }
+                        else
+                        {
+                            if (!verticalFlip)
+                            {
+                                tileIndex &= ~1;
+                            }
+                            else
+                            {
+                                tileIndex |= 1;
+                            }
+                        }
+                    }
+
+                    if ((y < 0) || (y >= 8))
+                    {
+                        continue;
+                    }
+
+                    // Horizontal flip
+					if (attributes & Bit5)
+					{
+						x = 7 - x;
+					}
+
+                    // Vertical flip
+					if (verticalFlip)
+					{
+						y = 7 - y;
+					}
+					
+                    auto colorIndex = GetTileDataPixelColorIndex(0x8000, tileIndex, x, y);
+                    if (colorIndex != 0)
+					{
+						if ((bestIndex < 0) || (spriteBaseX < bestBaseX))
+						{
+							bestBaseX = spriteBaseX;
+							bestIndex = spriteIndex;
+                            Uint8 palette = ((attributes & Bit4) != 0) ? inputs.OBP1 : inputs.OBP0;
+                            bestLuminosity = GetLuminosityForColorIndex(palette, colorIndex);;
+							bestAttributes = attributes;
+						}
+					}
+				}
+
+				if (bestIndex >= 0)
+				{
+					if (bestAttributes & Bit7)
+					{
+						// Sprite is behind background, it only shows if the background is transparent
+						if (backgroundIsTransparent)
+						{
+							luminosity = bestLuminosity;
+						}
+					}
+					else
+					{
+						// Sprite is in front of background, it always shows
+						luminosity = bestLuminosity;
+					}
+				}
+			}
+
+			r = luminosity;
+			g = luminosity;
+			b = luminosity;
+
+			*pARGB = 0xFF000000 | (r << 16) | (g << 8) | b;
+
+			++pARGB;
+		}
+
+		m_pVideoMemory = nullptr;
+	}
+
+private:
+	Uint8 ReadVram(Uint16 address) const
+	{
+		Uint16 offset = address - kVramBase;
+		SDL_assert(offset < VideoMemory::kVramSize);
+
+		return m_pVideoMemory->vram[offset];
+	}
+
+	Uint8 ReadOam(Uint16 address) const
+	{
+		Uint16 offset = address - kOamBase;
+		SDL_assert(offset < VideoMemory::kOamSize);
+
+		return m_pVideoMemory->oam[offset];
+	}
+
+	Uint8 GetTileIndexAtXY(Uint16 tileMapBaseAddress, int x, int y) const
+	{
+		// Tiles are 8x8; see which tile we're in
+		Uint8 tileMapX = x / 8;
+		Uint8 tileMapY = y / 8;
+
+		// Tile maps are 32x32
+		Uint16 tileOffset = tileMapY * 32 + tileMapX;
+
+		Uint8 tileIndex = ReadVram(tileMapBaseAddress + tileOffset);
+		
+		return tileIndex;
+	}
+
+	Uint8 GetTileDataPixelColorIndex(Uint16 baseTileDataAddress, Sint16 tileIndex, int x, int y) const
+	{
+		// Fetch the pixel's color index from the tile data
+		Uint8 tileDataX = x % 8;
+		Uint8 tileDataY = y % 8;
+		Uint8 tileDataShift = 7 - tileDataX;
+		Uint8 tileDataMask = 1 << tileDataShift;
+
+		// Each tile's data occupies 16 bytes, and each row of tile data occupies two bytes
+		Uint16 tileDataAddress = baseTileDataAddress + tileIndex * 16 + tileDataY * 2;
+
+		Uint8 tileRowLsb = (ReadVram(tileDataAddress) & tileDataMask) >> tileDataShift;
+		Uint8 tileRowMsb = (ReadVram(tileDataAddress + 1) & tileDataMask) >> tileDataShift;
+
+		Uint8 colorIndex = (tileRowMsb << 1) | tileRowLsb;
+
+		return colorIndex;
+	}
+
+	static Uint8 GetLuminosityForColorIndex(Uint8 paletteRegister, Uint8 colorIndex)
+	{
+		// Translate the color index to an actual color using the palette registers
+		Uint8 shadeShift = 2 * colorIndex;
+		Uint8 shadeMask = 0x3 << shadeShift;
+		Uint8 shade = (paletteRegister & shadeMask) >> shadeShift;
+
+		Uint8 luminosity = (3 - shade) * 0x55;
+		
+		return luminosity;
+	}
+
+	static Uint16 GetBackgroundTileDataIndex(Uint8 LCDC, Uint8 tileIndex)
+	{
+		// Indexes the 384 tiles of tile data from 0x8000; with LCDC bit 4 clear, tile 0 is at 0x9000 and indices are signed
+		return (LCDC & Bit4) ? tileIndex : static_cast<Uint16>(256 + static_cast<Sint8>(tileIndex));
+	}
+
+	void RenderBackgroundLayerCell(int tileMap, int cellX, int cellY, Uint16 tileDataIndex)
+	{
+		Uint8* pCell = &m_backgroundLayers[tileMap][(cellY * 8 * kBackgroundLayerSize) + (cellX * 8)];
+		const Uint8* pTileData = &m_pVideoMemory->vram[tileDataIndex * 16];
+
+		for (int row = 0; row < 8; ++row)
+		{
+			Uint8 tileRowLsb = pTileData[row * 2];
+			Uint8 tileRowMsb = pTileData[row * 2 + 1];
+			for (int x = 0; x < 8; ++x)
+			{
+				Uint8 tileDataShift = 7 - x;
+				pCell[x] = (((tileRowMsb >> tileDataShift) & 1) << 1) | ((tileRowLsb >> tileDataShift) & 1);
+			}
+			pCell += kBackgroundLayerSize;
+		}
+	}
+
+	void CopyBackgroundLayerScanline(Uint8 LCDC, int tileMap, Uint8 scrollX, Uint8 layerY, Uint8* pColorIndices)
+	{
+		// Bring the row of cells this line crosses up to date.  A cell is stale if the tile map now points it at a different
+		// tile (tile map write or LCDC bit 4 change) or if that tile's data was written since the cell was drawn.
+		const Uint8* pTileMap = &m_pVideoMemory->vram[((tileMap != 0) ? 0x9C00 : 0x9800) - kVramBase];
+		int cellY = layerY / 8;
+		for (int cellX = 0; cellX < 32; ++cellX)
+		{
+			int cell = cellY * 32 + cellX;
+			Uint16 tileDataIndex = GetBackgroundTileDataIndex(LCDC, pTileMap[cell]);
+			if ((m_backgroundLayerCellTiles[tileMap][cell] != tileDataIndex) || (m_backgroundLayerCellStamps[tileMap][cell] != m_pVideoMemory->tileDataStamps[tileDataIndex]))
+			{
+				RenderBackgroundLayerCell(tileMap, cellX, cellY, tileDataIndex);
+				m_backgroundLayerCellTiles[tileMap][cell] = tileDataIndex;
+				m_backgroundLayerCellStamps[tileMap][cell] = m_pVideoMemory->tileDataStamps[tileDataIndex];
+			}
+		}
+
+		// The line is then a 160-pixel window into the 256-pixel layer row, wrapping around at most once
+		const Uint8* pLayerRow = &m_backgroundLayers[tileMap][layerY * kBackgroundLayerSize];
+		int firstSpan = SDL_min(kScreenWidth, kBackgroundLayerSize - scrollX);
+		memcpy(pColorIndices, pLayerRow + scrollX, firstSpan);
+		memcpy(pColorIndices + firstSpan, pLayerRow, kScreenWidth - firstSpan);
+	}
+
+	const VideoMemory* m_pVideoMemory; // only valid during RenderScanline
+
+	// Background layer cache: each tile map pre-rendered as a 256x256 bitmap of color indices (pre-palette, so BGP changes
+	// and sprite priority still work per pixel).  Each cell remembers which tile it was drawn from, and the write stamp that
+	// tile's data had at the time.
+	static const Uint16 kInvalidTileDataIndex = 0xFFFF;
+	Uint8 m_backgroundLayers[2][kBackgroundLayerSize * kBackgroundLayerSize];
+	Uint16 m_backgroundLayerCellTiles[2][kTileMapCellCount];
+	Uint32 m_backgroundLayerCellStamps[2][kTileMapCellCount];
+};
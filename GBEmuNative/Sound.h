@@ -3,12 +3,15 @@
 #include "IMemoryBusDevice.h"
 
 #include "Utils.h"
+#include "BlipBuffer.h"
+#include "SpscRingBuffer.h"
+#include "WavWriter.h"
 
 #include <math.h>
-
-#ifdef NDEBUG
-#pragma optimize("", off)
-#endif
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 //#define FORCENOINLINE __declspec(noinline)
 
@@ -360,17 +363,24 @@ public:
 			m_samplePosition = 0;
 		}
 
-		void Tick()
+		int GetCyclesUntilNextStep() const
+		{
+			return m_frequencyTimerCounter;
+		}
+
+		// Same as calling a per-cycle tick the given number of times, but only does work at each step of the waveform
+		void Advance(int cycles)
 		{
 			SDL_assert(m_frequencyTimerCounter > 0);
-			--m_frequencyTimerCounter;
-			if (m_frequencyTimerCounter == 0)
+			while (cycles >= m_frequencyTimerCounter)
 			{
+				cycles -= m_frequencyTimerCounter;
 				ResetTimerPeriodFromFrequency();
-				
+
 				// The generator has eight steps
 				m_samplePosition = (m_samplePosition + 1) % 8;
 			}
+			m_frequencyTimerCounter -= cycles;
 		}
 
 		Sint16 GetOutput() const
@@ -403,9 +413,16 @@ public:
 		NoiseGenerator(const Uint8& NRx3)
 			: m_NRx3(NRx3)
 		{
+			SeedRandom();
 			Reset();
 		}
 
+		// Not part of Reset, which happens on every trigger
+		void SeedRandom()
+		{
+			m_randomState = 1;
+		}
+
 		Uint8 GetClockShift() const
 		{
 			return (m_NRx3 & 0xF0) >> 4;
@@ -421,10 +438,13 @@ public:
 			return m_NRx3 & 0x7;
 		}
 
-		Uint16 GetTimerPeriod() const
+		Uint32 GetTimerPeriod() const
 		{
 			static Uint16 baseDivisors[] = {8, 16, 32, 48, 64, 80, 96, 112};
-			return baseDivisors[GetDivisorCode()] << GetClockShift();
+			Uint16 period = baseDivisors[GetDivisorCode()] << GetClockShift();
+
+			// The period is truncated to 16 bits; a period that truncates to 0 counts down through the whole 16-bit range
+			return (period != 0) ? period : 0x10000;
 		}
 
 		void ResetTimerPeriodFromFrequency()
@@ -438,11 +458,18 @@ public:
 			m_lfsr = 0xFFFF;
 		}
 
-		void Tick()
+		int GetCyclesUntilNextStep() const
+		{
+			return static_cast<int>(m_frequencyTimerCounter);
+		}
+
+		// Same as calling a per-cycle tick the given number of times, but only does work at each shift of the LFSR
+		void Advance(int cycles)
 		{
-			--m_frequencyTimerCounter;
-			if (m_frequencyTimerCounter == 0)
+			SDL_assert(m_frequencyTimerCounter > 0);
+			while (static_cast<Uint32>(cycles) >= m_frequencyTimerCounter)
 			{
+				cycles -= m_frequencyTimerCounter;
 				ResetTimerPeriodFromFrequency();
 				
 				// Documented implementation sounds further from the hardware than just a call to rand()
@@ -455,8 +482,9 @@ public:
 				}
 
 				// Crush the above with a simple pseudorandom call - at high enough frequencies this sounds very similar to actual hardware... not true to the hardware, but it sounds better than the above
-				m_lfsr = rand() % 2;
+				m_lfsr = NextRandom() % 2;
 			}
+			m_frequencyTimerCounter -= cycles;
 		}
 
 		Sint16 GetOutput() const
@@ -465,10 +493,19 @@ public:
 		}
 		
 	private:
+		// The same sequence as the C runtime's rand(), but with state of its own, so that output only depends on what this APU
+		// has done; rand() is shared with the rest of the process and isn't safe to call from the synthesis thread
+		Uint16 NextRandom()
+		{
+			m_randomState = m_randomState * 214013 + 2531011;
+			return (m_randomState >> 16) & 0x7FFF;
+		}
+
 		const Uint8& m_NRx3;
 
 		Uint16 m_lfsr;
-		Uint16 m_frequencyTimerCounter;
+		Uint32 m_frequencyTimerCounter;
+		Uint32 m_randomState;
 	};
 
 	class WavetableGenerator
@@ -519,12 +556,18 @@ public:
 			m_samplePosition = 0;
 		}
 
-		void Tick()
+		int GetCyclesUntilNextStep() const
+		{
+			return m_frequencyTimerCounter;
+		}
+
+		// Same as calling a per-cycle tick the given number of times, but only does work at each step through wave RAM
+		void Advance(int cycles)
 		{
 			SDL_assert(m_frequencyTimerCounter > 0);
-			--m_frequencyTimerCounter;
-			if (m_frequencyTimerCounter == 0)
+			while (cycles >= m_frequencyTimerCounter)
 			{
+				cycles -= m_frequencyTimerCounter;
 				ResetTimerPeriodFromFrequency();
 
 				m_samplePosition = (m_samplePosition + 1) % 32;
@@ -533,6 +576,7 @@ public:
 				m_output = sample >> GetVolumeShift(); // 0-15
 				m_output = MIN_GENERATOR_OUTPUT + (m_output * ((MAX_GENERATOR_OUTPUT - MIN_GENERATOR_OUTPUT) / 15));
 			}
+			m_frequencyTimerCounter -= cycles;
 		}
 
 		Sint16 GetOutput() const
@@ -552,23 +596,266 @@ public:
 		const Uint8* m_pWaveRam;
 	};
 	
+	// A stereo pair of band-limited synthesizers, along with the levels they were last set to
+	class StereoSynth
+	{
+	public:
+		StereoSynth(int maxSamplesPerFrame, BlipBuffer::Quality quality)
+			: m_leftBlipBuffer(maxSamplesPerFrame, quality)
+			, m_rightBlipBuffer(maxSamplesPerFrame, quality)
+		{
+			Clear();
+		}
+
+		void Clear()
+		{
+			m_leftBlipBuffer.Clear();
+			m_rightBlipBuffer.Clear();
+			m_leftLevel = 0;
+			m_rightLevel = 0;
+		}
+
+		void SetRates(double clockRate, double sampleRate)
+		{
+			m_leftBlipBuffer.SetRates(clockRate, sampleRate);
+			m_rightBlipBuffer.SetRates(clockRate, sampleRate);
+		}
+
+		// Records a delta for each side whose level differs from the last one set
+		void SetLevels(Uint32 time, Sint16 leftLevel, Sint16 rightLevel)
+		{
+			if (leftLevel != m_leftLevel)
+			{
+				m_leftBlipBuffer.AddDelta(time, leftLevel - m_leftLevel);
+				m_leftLevel = leftLevel;
+			}
+			if (rightLevel != m_rightLevel)
+			{
+				m_rightBlipBuffer.AddDelta(time, rightLevel - m_rightLevel);
+				m_rightLevel = rightLevel;
+			}
+		}
+
+		void EndFrame(Uint32 clocks)
+		{
+			m_leftBlipBuffer.EndFrame(clocks);
+			m_rightBlipBuffer.EndFrame(clocks);
+		}
+
+		// Reads interleaved stereo samples, returning the number of sample pairs
+		int ReadSamples(Sint16* pSamples, int maxSamples)
+		{
+			return BlipBuffer::ReadStereoSamples(m_leftBlipBuffer, m_rightBlipBuffer, pSamples, maxSamples);
+		}
+
+	private:
+		BlipBuffer m_leftBlipBuffer;
+		BlipBuffer m_rightBlipBuffer;
+		Sint16 m_leftLevel;
+		Sint16 m_rightLevel;
+	};
+
+	static const int kNumChannels = 4;
+
 	static const int kWaveRamBase = 0xFF30;
 	static const int kWaveRamSize = 0xFF3F - kWaveRamBase + 1;
 
-	static const int kDeviceFrequency = 44100;
+	static const int kDefaultOutputFrequency = 44100;
+	static const int kMinOutputFrequency = 8000;
+	static const int kMaxOutputFrequency = 96000;
 	static const int kDeviceNumChannels = 2;
-	static const int kDeviceNumBufferSamples = 1024; // below 1024, things start to get dicey with xaudio on my hardware
+	static const int kDeviceNumBufferSamples = 512; // 1024 was needed before the feed rate tracked the device; see UpdateRateControl()
 	static const int kDeviceBufferNumMonoSamples = kDeviceNumChannels * kDeviceNumBufferSamples;
 	static const int kDeviceBufferByteSize = kDeviceBufferNumMonoSamples * sizeof(Sint16);
 
+	// Interleaved samples queued between the emulation thread and the audio callback.  Rate control aims to keep a buffer and
+	// a half queued, leaving room on both sides for the callback's bursty consumption.
+	static const int kSampleQueueNumMonoSamples = kDeviceBufferNumMonoSamples * 4;
+	static const int kTargetQueueNumMonoSamples = kDeviceBufferNumMonoSamples + kDeviceBufferNumMonoSamples / 2;
+
+	static const int kCyclesPerSequencerTick = 8192; // 512Hz frame sequencer
+
+	// Output is synthesized from amplitude deltas in frames of this many cycles (256 a second), then queued in one go
+	static const int kCyclesPerSoundFrame = 16384;
+
+	// Output rate and synthesis quality.  Any rate in range is synthesized directly; Fast halves the synthesis cost per
+	// amplitude change for a softer cutoff, for low-bandwidth or low-power use.  Without a device, output only goes anywhere
+	// while being captured with StartWavCapture().  Threaded synthesis moves the generators and output onto a thread of their
+	// own; see SynthesisThread.
+	struct OutputSettings
+	{
+		OutputSettings()
+			: frequency(kDefaultOutputFrequency)
+			, quality(BlipBuffer::Quality::High)
+			, openDevice(true)
+			, threadedSynthesis(false)
+			, stepEveryCycle(false)
+		{
+		}
+
+		int frequency;
+		BlipBuffer::Quality quality;
+		bool openDevice;
+		bool threadedSynthesis;
+		bool stepEveryCycle; // reference stepping, many times slower, to check the output against
+	};
+
+	static int GetMaxSamplesPerSoundFrame(int frequency)
+	{
+		// With rate control headroom
+		return static_cast<int>((static_cast<Sint64>(kCyclesPerSoundFrame) * frequency) / MemoryBus::kCyclesPerSecond) + 4;
+	}
+
+	// With threaded synthesis, this APU only keeps what the CPU can read back up to date: the registers, wave RAM, and the
+	// length counters and sweep that NR52's status bits come from, all of which only depend on register writes and the
+	// frame sequencer.  A second, complete APU runs on a thread of its own, replaying each register write at the cycle it was
+	// made on, and does all the synthesis and output.  Since it sees the same writes at the same cycles, its output is
+	// identical to running inline.
+	//
+	// Writes and time markers reach the thread through a lock-free queue; the emulation thread only waits if it gets a whole
+	// queue ahead.
+	class SynthesisThread
+	{
+	public:
+		struct Event
+		{
+			Uint64 cycle;
+			Uint16 address; // kAdvanceOnly for a time marker
+			Uint8 value;
+		};
+
+		static const Uint16 kAdvanceOnly = 0;
+		static const size_t kEventQueueSize = 1 << 16;
+		static const size_t kEventBatchSize = 256;
+
+		SynthesisThread(const OutputSettings& outputSettings)
+			: m_pCore(new Sound(outputSettings))
+			, m_eventQueue(kEventQueueSize)
+			, m_coreCycle(0)
+			, m_numEventsSubmitted(0)
+			, m_numEventsCompleted(0)
+			, m_isWaiting(false)
+			, m_quit(false)
+		{
+			m_thread = std::thread([this]() { ThreadMain(); });
+		}
+
+		~SynthesisThread()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_quit = true;
+			}
+			m_workAvailable.notify_one();
+			m_thread.join();
+		}
+
+		// Only safe to call into between WaitUntilIdle() and the next Submit(), apart from the statistics getters
+		Sound& GetCore()
+		{
+			return *m_pCore;
+		}
+
+		const Sound& GetCore() const
+		{
+			return *m_pCore;
+		}
+
+		void Submit(Uint64 cycle, Uint16 address, Uint8 value)
+		{
+			Event event = { cycle, address, value };
+			while (m_eventQueue.Write(&event, 1) == 0)
+			{
+				std::this_thread::yield();
+			}
+			++m_numEventsSubmitted;
+
+			if (m_isWaiting)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_workAvailable.notify_one();
+			}
+		}
+
+		void WaitUntilIdle()
+		{
+			while (m_numEventsCompleted.load(std::memory_order_acquire) != m_numEventsSubmitted)
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		// Restarts the timeline along with a reset of the core; only valid while idle
+		void ResetCycle()
+		{
+			m_coreCycle = 0;
+		}
+
+	private:
+		void ThreadMain()
+		{
+			Event events[kEventBatchSize];
+			while (!m_quit)
+			{
+				size_t numEvents = m_eventQueue.Read(events, kEventBatchSize);
+				if (numEvents == 0)
+				{
+					// The timeout covers a wakeup lost between the queue being found empty and the wait starting
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_isWaiting = true;
+					m_workAvailable.wait_for(lock, std::chrono::milliseconds(1), [this]() { return m_quit || (m_eventQueue.GetAvailable() > 0); });
+					m_isWaiting = false;
+					continue;
+				}
+
+				for (size_t i = 0; i < numEvents; ++i)
+				{
+					const auto& event = events[i];
+					if (event.cycle > m_coreCycle)
+					{
+						m_pCore->Update(static_cast<int>(event.cycle - m_coreCycle));
+						m_coreCycle = event.cycle;
+					}
+
+					if (event.address != kAdvanceOnly)
+					{
+						Uint8 value = event.value;
+						m_pCore->HandleRequest(MemoryRequestType::Write, event.address, value);
+					}
+				}
+
+				m_numEventsCompleted.store(m_numEventsCompleted.load(std::memory_order_relaxed) + numEvents, std::memory_order_release);
+			}
+		}
+
+		std::unique_ptr<Sound> m_pCore;
+		SpscRingBuffer<Event> m_eventQueue;
+		Uint64 m_coreCycle; // synthesis thread only
+		Uint64 m_numEventsSubmitted; // emulation thread only
+		std::atomic<Uint64> m_numEventsCompleted;
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_workAvailable;
+		std::atomic<bool> m_isWaiting;
+		std::atomic<bool> m_quit;
+	};
+
+	// Time markers are sent to the synthesis thread this often (about a millisecond), so that it runs close behind
+	static const int kCyclesPerSynthesisBatch = 4096;
+
 	static void AudioCallback(void* userdata, Uint8* pStream8, int numBytes)
 	{
 		Sint16* pStream16 = reinterpret_cast<Sint16*>(pStream8);
 		reinterpret_cast<Sound*>(userdata)->FillStreamBuffer(pStream16, numBytes);
 	}
 	
-	Sound()
-		: m_ch1Sweep(NR10, NR13, NR14, m_ch1LengthCounter)
+	Sound(const OutputSettings& outputSettings = OutputSettings())
+		: m_deviceId(0)
+		, m_outputFrequency(outputSettings.frequency)
+		, m_outputQuality(outputSettings.quality)
+		, m_stepEveryCycle(outputSettings.stepEveryCycle)
+		, m_ch1Sweep(NR10, NR13, NR14, m_ch1LengthCounter)
 		, m_ch1Generator(NR11, NR13, NR14)
 		, m_ch1LengthCounter(NR11, NR14, false)
 		, m_ch1VolumeEnvelope(NR12)
@@ -580,14 +867,31 @@ public:
 		, m_ch4Generator(NR43)
 		, m_ch4LengthCounter(NR41, NR44, false)
 		, m_ch4VolumeEnvelope(NR42)
+		, m_mixSynth(GetMaxSamplesPerSoundFrame(outputSettings.frequency), outputSettings.quality)
+		, m_soundFrameSamples(GetMaxSamplesPerSoundFrame(outputSettings.frequency) * kDeviceNumChannels)
+		, m_sampleQueue(kSampleQueueNumMonoSamples)
+		, m_synthesisCycle(0)
+		, m_lastSubmittedCycle(0)
 	{
-		if (SDL_GetNumAudioDevices(0) > 0)
+		if ((m_outputFrequency < kMinOutputFrequency) || (m_outputFrequency > kMaxOutputFrequency))
+		{
+			throw Exception("Unsupported audio output rate: %d", m_outputFrequency);
+		}
+
+		if (outputSettings.threadedSynthesis)
+		{
+			// The APU on the synthesis thread owns the output; this one becomes the shadow the CPU reads back from
+			OutputSettings coreSettings = outputSettings;
+			coreSettings.threadedSynthesis = false;
+			m_pSynthesisThread.reset(new SynthesisThread(coreSettings));
+		}
+		else if (outputSettings.openDevice && (SDL_GetNumAudioDevices(0) > 0))
 		{
 			// Get default audio device
 			auto deviceName = SDL_GetAudioDeviceName(0, 0);
 
 			SDL_AudioSpec desiredSpec;
-			desiredSpec.freq = kDeviceFrequency;
+			desiredSpec.freq = m_outputFrequency;
 			desiredSpec.format = AUDIO_S16SYS;
 			desiredSpec.channels = kDeviceNumChannels;
 			desiredSpec.samples = kDeviceNumBufferSamples;
@@ -613,6 +917,8 @@ public:
 
 	~Sound()
 	{
+		m_pSynthesisThread.reset();
+
 		if (m_deviceId != 0)
 		{
 			SDL_CloseAudioDevice(m_deviceId);
@@ -621,9 +927,6 @@ public:
 
 	void Reset()
 	{
-		m_updateTimeLeft = 0.0f;
-		m_sampleTimeLeft = 0.0f;
-
 		NR10 = 0x80;
 		NR11 = 0xBF;
 		NR12 = 0xF3;
@@ -650,22 +953,32 @@ public:
 		NR51 = 0xF3;
 		NR52 = 0xF1;
 
+		if (m_pSynthesisThread)
+		{
+			SynchronizeSynthesisThread().Reset();
+			m_pSynthesisThread->ResetCycle();
+		}
+		m_synthesisCycle = 0;
+		m_lastSubmittedCycle = 0;
+
 		if (m_deviceId != 0)
 		{
 			SDL_LockAudioDevice(m_deviceId);
 		}
 
-		m_nextBackBufferToTransfer = 0;
-		memset(m_backBuffers, 0, sizeof(m_backBuffers));
-		// Start in the middle of the second back buffer
-		m_numMonoSamplesAvailable = kDeviceBufferNumMonoSamples + kDeviceBufferNumMonoSamples / 2;
+		// Start with the target amount of silence queued, as latency headroom
+		m_sampleQueue.Reset();
+		std::vector<Sint16> silence(kTargetQueueNumMonoSamples, 0);
+		m_sampleQueue.Write(silence.data(), silence.size());
+		m_lastLeftSample = 0;
+		m_lastRightSample = 0;
+		m_underrunCount = 0;
+		m_overrunCount = 0;
 
 		m_audioDeviceActive = false;
 		m_masterCounter = 0;
 		m_sequencerCounter = 0;
 
-		m_sampleTimeStep = 1.0f / kDeviceFrequency;
-
 		m_ch1Generator.Reset();
 		m_ch1LengthCounter.ResetLength();
 		m_ch1VolumeEnvelope.Reset();
@@ -677,6 +990,7 @@ public:
 		m_ch3Generator.Reset();
 		m_ch3LengthCounter.ResetLength();
 
+		m_ch4Generator.SeedRandom();
 		m_ch4Generator.Reset();
 		m_ch4LengthCounter.ResetLength();
 		m_ch4VolumeEnvelope.Reset();
@@ -686,16 +1000,25 @@ public:
 			SDL_UnlockAudioDevice(m_deviceId);
 		}
 
+		ClearSynths();
+		m_averageQueueFill = static_cast<float>(kTargetQueueNumMonoSamples);
+		SetRateRatio(1.0f);
+		m_soundFrameCycle = 0;
+		m_cyclesPending = 0;
+		m_cyclesUntilNextChange = 0;
+		m_registersWritten = true;
+		UpdateMixGains();
+
 		m_tracelogDumpTimer = 0.0f;
 		m_traceLog.clear();
 	}
 
-	void OnMasterTick()
+	void AdvanceGenerators(int cycles)
 	{
-		m_ch1Generator.Tick();
-		m_ch2Generator.Tick();
-		m_ch3Generator.Tick();
-		m_ch4Generator.Tick();
+		m_ch1Generator.Advance(cycles);
+		m_ch2Generator.Advance(cycles);
+		m_ch3Generator.Advance(cycles);
+		m_ch4Generator.Advance(cycles);
 	}
 
 	void OnLengthTick()
@@ -737,120 +1060,437 @@ public:
 		}
 	}
 
-	void Update(float seconds)
+	void Update(int cycles)
 	{
-		if (!m_deviceId)
+		if (m_pSynthesisThread)
 		{
+			UpdateShadow(cycles);
 			return;
 		}
 
-		m_updateTimeLeft += seconds;
-		m_sampleTimeLeft += seconds;
-		m_tracelogDumpTimer += seconds;
+		// With nowhere for samples to go, as when replaying a movie or running test ROMs headless, only the state the CPU can
+		// read back needs to move on
+		if (!m_deviceId && !m_pWavWriter)
+		{
+			AdvanceFrameSequencer(cycles);
+			return;
+		}
+
+		m_tracelogDumpTimer += static_cast<float>(cycles) / MemoryBus::kCyclesPerSecond;
+
+		// Nothing can change the output before the next audible generator step, sequencer tick or end of the sound frame, so
+		// until one of those comes due the time is only banked, and is spent by the update that reaches it, or before the next
+		// register write
+		if (!m_registersWritten && !m_stepEveryCycle && (m_cyclesPending + cycles < m_cyclesUntilNextChange))
+		{
+			m_cyclesPending += cycles;
+			return;
+		}
 
-		const float timeStep = 1.0f / MemoryBus::kCyclesPerSecond;
+		Synthesize(m_cyclesPending + cycles);
+		m_cyclesPending = 0;
 
-		while (m_updateTimeLeft > 0.0f)
+		if (false && (m_deviceId != 0) && (m_tracelogDumpTimer > 0.0f))
 		{
-			m_masterCounter = (m_masterCounter + 1) % 8192;
-			if (m_masterCounter == 0)
+			FILE* pFile = nullptr;
+			fopen_s(&pFile, "soundlog.txt", "a");
+
+			SDL_LockAudioDevice(m_deviceId);
+			fwrite(m_traceLog.data(), m_traceLog.size(), 1, pFile);
+			SDL_UnlockAudioDevice(m_deviceId);
+
+			fclose(pFile);
+
+			m_tracelogDumpTimer -= 2.0f;
+		}
+	}
+
+	// Advances the generators and records the changes in the output
+	void Synthesize(int cycles)
+	{
+		// Register writes since the last update take effect at its start, which is the cycle they were made on
+		if (m_registersWritten)
+		{
+			m_registersWritten = false;
+			UpdateMixGains();
+			UpdateOutputLevels();
+		}
+
+		// The output only changes when an audible generator steps or the frame sequencer ticks, so the generators are advanced
+		// in bulk from one of those to the next and each change is recorded as a delta at the cycle it happened on.  The
+		// reference stepping goes one cycle at a time instead, through the same code.
+		while (cycles > 0)
+		{
+			int cyclesUntilSequencerTick = kCyclesPerSequencerTick - m_masterCounter;
+			int cyclesUntilFrameEnd = kCyclesPerSoundFrame - m_soundFrameCycle;
+			int step = SDL_min(cycles, SDL_min(cyclesUntilSequencerTick, SDL_min(cyclesUntilFrameEnd, GetCyclesUntilNextAudibleStep())));
+			if (m_stepEveryCycle)
 			{
+				step = 1;
+			}
+
+			m_masterCounter += step;
+			if (m_masterCounter == kCyclesPerSequencerTick)
+			{
+				// The sequencer acts before the generators on the cycle it ticks
+				AdvanceGenerators(step - 1);
+				m_masterCounter = 0;
 				m_sequencerCounter = (m_sequencerCounter + 1) % 8;
 				OnSequencerTick();
+				AdvanceGenerators(1);
+			}
+			else
+			{
+				AdvanceGenerators(step);
 			}
 
-			OnMasterTick();
+			m_soundFrameCycle += step;
+			UpdateOutputLevels();
 
-			if (!m_audioDeviceActive)
+			if (m_soundFrameCycle == kCyclesPerSoundFrame)
 			{
-				m_sampleTimeLeft = 0.0f;
+				EndSoundFrame();
 			}
 
-			if (m_sampleTimeLeft > 0.0f)
+			cycles -= step;
+		}
+
+		m_cyclesUntilNextChange = SDL_min(kCyclesPerSequencerTick - m_masterCounter, SDL_min(kCyclesPerSoundFrame - m_soundFrameCycle, GetCyclesUntilNextAudibleStep()));
+	}
+
+	void SynthesizePendingCycles()
+	{
+		if (m_cyclesPending > 0)
+		{
+			auto cycles = m_cyclesPending;
+			m_cyclesPending = 0;
+			Synthesize(cycles);
+		}
+	}
+
+	// Threaded synthesis: runs the frame sequencer, which is all that the CPU-visible state depends on besides register
+	// writes, and passes the time on to the synthesis thread every so often
+	void UpdateShadow(int cycles)
+	{
+		AdvanceFrameSequencer(cycles);
+
+		m_synthesisCycle += cycles;
+		if (m_synthesisCycle - m_lastSubmittedCycle >= kCyclesPerSynthesisBatch)
+		{
+			SubmitSynthesisEvent(SynthesisThread::kAdvanceOnly, 0);
+		}
+	}
+
+	// Length counters, sweep and envelopes, without synthesizing anything
+	void AdvanceFrameSequencer(int cycles)
+	{
+		m_masterCounter += cycles;
+		while (m_masterCounter >= kCyclesPerSequencerTick)
+		{
+			m_masterCounter -= kCyclesPerSequencerTick;
+			m_sequencerCounter = (m_sequencerCounter + 1) % 8;
+			OnSequencerTick();
+		}
+	}
+
+	void SubmitSynthesisEvent(Uint16 address, Uint8 value)
+	{
+		m_pSynthesisThread->Submit(m_synthesisCycle, address, value);
+		m_lastSubmittedCycle = m_synthesisCycle;
+	}
+
+	// Brings the synthesis thread up to the present and waits for it to get there, after which the core can be used directly
+	Sound& SynchronizeSynthesisThread()
+	{
+		SubmitSynthesisEvent(SynthesisThread::kAdvanceOnly, 0);
+		m_pSynthesisThread->WaitUntilIdle();
+		return m_pSynthesisThread->GetCore();
+	}
+
+	bool IsThreadedSynthesis() const
+	{
+		return m_pSynthesisThread != nullptr;
+	}
+
+	// Cycles until the next step of any generator whose channel is currently making sound
+	int GetCyclesUntilNextAudibleStep() const
+	{
+		int cycles = kCyclesPerSoundFrame;
+		if (m_ch1LengthCounter.IsChannelEnabled() && (m_ch1VolumeEnvelope.GetVolume() != 0))
+		{
+			cycles = SDL_min(cycles, m_ch1Generator.GetCyclesUntilNextStep());
+		}
+		if (m_ch2LengthCounter.IsChannelEnabled() && (m_ch2VolumeEnvelope.GetVolume() != 0))
+		{
+			cycles = SDL_min(cycles, m_ch2Generator.GetCyclesUntilNextStep());
+		}
+		if (m_ch3LengthCounter.IsChannelEnabled() && m_ch3Generator.IsEnabled())
+		{
+			cycles = SDL_min(cycles, m_ch3Generator.GetCyclesUntilNextStep());
+		}
+		if (m_ch4LengthCounter.IsChannelEnabled() && (m_ch4VolumeEnvelope.GetVolume() != 0))
+		{
+			cycles = SDL_min(cycles, m_ch4Generator.GetCyclesUntilNextStep());
+		}
+		return cycles;
+	}
+
+	// Each channel's output, ready for mixing; ch1 is first
+	void ComputeChannelValues(Sint16 (&channelValues)[kNumChannels]) const
+	{
+		channelValues[0] = m_ch1LengthCounter.GetGatedSample(m_ch1VolumeEnvelope.GetAttenuatedSample(m_ch1Generator.GetOutput()));
+		channelValues[1] = m_ch2LengthCounter.GetGatedSample(m_ch2VolumeEnvelope.GetAttenuatedSample(m_ch2Generator.GetOutput()));
+		channelValues[2] = m_ch3LengthCounter.GetGatedSample(m_ch3Generator.GetOutput());
+		channelValues[3] = m_ch4LengthCounter.GetGatedSample(m_ch4VolumeEnvelope.GetAttenuatedSample(m_ch4Generator.GetOutput()));
+
+		static int const preMixShift = 2;
+		for (int channel = 0; channel < kNumChannels; ++channel)
+		{
+			channelValues[channel] >>= preMixShift;
+		}
+	}
+
+	void ComputeOutputLevels(Sint16& leftValue, Sint16& rightValue) const
+	{
+		Sint16 channelValues[kNumChannels];
+		ComputeChannelValues(channelValues);
+		MixChannelValues(channelValues, leftValue, rightValue);
+	}
+
+	// Each channel's gain on each side: its NR50 volume if NR51 routes it there, or 0, and 0 for everything while the APU is
+	// off.  These only change on register writes, so they are worked out then, and mixing is a multiply-accumulate.
+	void UpdateMixGains()
+	{
+		bool enabled = (NR52 & Bit7) != 0;
+		Sint16 leftVolume = (NR50 >> 4) & 0x7;
+		Sint16 rightVolume = (NR50 >> 0) & 0x7;
+
+		// NR51 has a bit per channel for each side: right in the low nybble, left in the high
+		for (int channel = 0; channel < kNumChannels; ++channel)
+		{
+			m_mixGains[channel] = (enabled && (NR51 & (Bit4 << channel))) ? leftVolume : 0;
+			m_mixGains[kNumChannels + channel] = (enabled && (NR51 & (Bit0 << channel))) ? rightVolume : 0;
+		}
+	}
+
+	void MixChannelValues(const Sint16 (&channelValues)[kNumChannels], Sint16& leftValue, Sint16& rightValue) const
+	{
+#if BLIP_BUFFER_USE_SSE2
+		// The channels against the left gains in the low half and the right gains in the high half, which one multiply-add
+		// reduces to pairs of sums, and one more add finishes off
+		__m128i values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(channelValues));
+		__m128i sums = _mm_madd_epi16(_mm_unpacklo_epi64(values, values), _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_mixGains)));
+		sums = _mm_add_epi32(sums, _mm_srli_epi64(sums, 32));
+		Sint32 leftSum = _mm_cvtsi128_si32(sums);
+		Sint32 rightSum = _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#else
+		Sint32 leftSum = 0;
+		Sint32 rightSum = 0;
+		for (int channel = 0; channel < kNumChannels; ++channel)
+		{
+			leftSum += channelValues[channel] * m_mixGains[channel];
+			rightSum += channelValues[channel] * m_mixGains[kNumChannels + channel];
+		}
+#endif
+
+		leftValue = static_cast<Sint16>(leftSum / 0xF);
+		rightValue = static_cast<Sint16>(rightSum / 0xF);
+	}
+
+	// A single channel's contribution to the mix
+	void MixChannelValue(const Sint16 (&channelValues)[kNumChannels], int channel, Sint16& leftValue, Sint16& rightValue) const
+	{
+		leftValue = static_cast<Sint16>((channelValues[channel] * m_mixGains[channel]) / 0xF);
+		rightValue = static_cast<Sint16>((channelValues[channel] * m_mixGains[kNumChannels + channel]) / 0xF);
+	}
+
+	void UpdateOutputLevels()
+	{
+		Sint16 channelValues[kNumChannels];
+		ComputeChannelValues(channelValues);
+
+		Sint16 leftValue;
+		Sint16 rightValue;
+		MixChannelValues(channelValues, leftValue, rightValue);
+		m_mixSynth.SetLevels(m_soundFrameCycle, leftValue, rightValue);
+
+		if (!m_stemSynths.empty())
+		{
+			for (int channel = 0; channel < kNumChannels; ++channel)
 			{
-				// Put a sound sample into the backbuffer
+				MixChannelValue(channelValues, channel, leftValue, rightValue);
+				m_stemSynths[channel]->SetLevels(m_soundFrameCycle, leftValue, rightValue);
+			}
+		}
+	}
 
-				SDL_LockAudioDevice(m_deviceId);
+	// Ends the sound frame at the current cycle, which is normally kCyclesPerSoundFrame, and sends its samples on
+	void EndSoundFrame()
+	{
+		m_mixSynth.EndFrame(m_soundFrameCycle);
+		for (auto& pStemSynth : m_stemSynths)
+		{
+			pStemSynth->EndFrame(m_soundFrameCycle);
+		}
+		m_soundFrameCycle = 0;
 
-				if (m_numMonoSamplesAvailable < (kDeviceBufferNumMonoSamples * 2))
-				{
-					Uint16* pCurrentSample = (m_numMonoSamplesAvailable >= kDeviceBufferNumMonoSamples)
-						? &m_backBuffers[(m_nextBackBufferToTransfer + 1) % 2][m_numMonoSamplesAvailable - kDeviceBufferNumMonoSamples]
-						: &m_backBuffers[m_nextBackBufferToTransfer][m_numMonoSamplesAvailable];
-
-					Sint16 ch1Value = m_ch1LengthCounter.GetGatedSample(m_ch1VolumeEnvelope.GetAttenuatedSample(m_ch1Generator.GetOutput()));
-					Sint16 ch2Value = m_ch2LengthCounter.GetGatedSample(m_ch2VolumeEnvelope.GetAttenuatedSample(m_ch2Generator.GetOutput()));
-					Sint16 ch3Value = m_ch3LengthCounter.GetGatedSample(m_ch3Generator.GetOutput());
-					Sint16 ch4Value = m_ch4LengthCounter.GetGatedSample(m_ch4VolumeEnvelope.GetAttenuatedSample(m_ch4Generator.GetOutput()));
-
-                    // Sine wave test. As of Dec 2018, all known sound glitches are caused by an insufficient feed rate (as
-                    // evidenced by this simple sine wave test), which is caused by enforcing vsync.
-                    // If we eventually make the vsync wait asynchronous, we should service the sound device while waiting.
-					//static float f = 0.0f;
-					//f += m_sampleTimeStep;
-					//ch1Value = sinf(f * 220.0f * 2 * 3.14f) * 4000.0f;
-					//ch2Value = 0;
-					//ch3Value = 0;
-					//ch4Value = 0;
-
-					static int const preMixShift = 2;
-					ch1Value >>= preMixShift;
-					ch2Value >>= preMixShift;
-					ch3Value >>= preMixShift;
-					ch4Value >>= preMixShift;
-
-					Sint16 leftValue = 0;
-					Sint16 rightValue = 0;
-
-					if (NR52 & Bit7)
-					{
-						if (NR51 & Bit7) leftValue += ch4Value;
-						if (NR51 & Bit6) leftValue += ch3Value;
-						if (NR51 & Bit5) leftValue += ch2Value;
-						if (NR51 & Bit4) leftValue += ch1Value;
-						if (NR51 & Bit3) rightValue += ch4Value;
-						if (NR51 & Bit2) rightValue += ch3Value;
-						if (NR51 & Bit1) rightValue += ch2Value;
-						if (NR51 & Bit0) rightValue += ch1Value;
-					}
+		Sint16* pSamples = m_soundFrameSamples.data();
+		int maxSamples = static_cast<int>(m_soundFrameSamples.size()) / kDeviceNumChannels;
+		int numSamples = m_mixSynth.ReadSamples(pSamples, maxSamples);
 
-					Sint16 leftVolume = (NR50 >> 4) & 0x7;
-					leftValue = (static_cast<Sint32>(leftValue) * leftVolume) / 0xF;
-					Sint16 rightVolume = (NR50 >> 0) & 0x7;
-					rightValue = (static_cast<Sint32>(rightValue) * rightVolume) / 0xF;
+		if (m_pWavWriter)
+		{
+			m_pWavWriter->Write(pSamples, numSamples * kDeviceNumChannels);
+			for (size_t stem = 0; stem < m_stemSynths.size(); ++stem)
+			{
+				numSamples = m_stemSynths[stem]->ReadSamples(pSamples, maxSamples);
+				m_stemWavWriters[stem]->Write(pSamples, numSamples * kDeviceNumChannels);
+			}
+			return;
+		}
 
-					*pCurrentSample++ = leftValue;
-					*pCurrentSample++ = rightValue; 
+		if (!m_audioDeviceActive)
+		{
+			return;
+		}
 
-					//printf("Producer: %d mono samples available; adding 2. ", m_numMonoSamplesAvailable);
-					m_numMonoSamplesAvailable += 2;
-				}
-				else
-				{
-					//printf("Sound device overstuff!  Skipping sample.");
-				}
+		// Queue the whole frame at once; whatever doesn't fit is dropped
+		size_t numMonoSamples = numSamples * kDeviceNumChannels;
+		if (m_sampleQueue.Write(pSamples, numMonoSamples) < numMonoSamples)
+		{
+			++m_overrunCount;
+		}
 
-				SDL_UnlockAudioDevice(m_deviceId);
+		UpdateRateControl();
+	}
 
-				m_sampleTimeLeft -= m_sampleTimeStep;
+	// Dynamic rate control.  Emulation is paced by the host clock and the device by its own, and the two never agree exactly,
+	// so a fixed rate slowly drains or floods the queue.  Instead, the rate the APU is resampled to is nudged, in proportion to
+	// how far the (smoothed) queue fill is from the target, by at most 0.5% either way, which is not audible as a pitch change.
+	void UpdateRateControl()
+	{
+		static const float maxRateAdjustment = 0.005f;
+		static const float fillAveragingRate = 0.05f;
+		m_averageQueueFill = m_averageQueueFill + (static_cast<float>(m_sampleQueue.GetAvailable()) - m_averageQueueFill) * fillAveragingRate;
+
+		float error = (m_averageQueueFill - kTargetQueueNumMonoSamples) / kTargetQueueNumMonoSamples;
+		error = SDL_max(-1.0f, SDL_min(error, 1.0f));
+		SetRateRatio(1.0f - error * maxRateAdjustment);
+	}
+
+	void SetRateRatio(float ratio)
+	{
+		m_rateRatio = ratio;
+		m_mixSynth.SetRates(MemoryBus::kCyclesPerSecond, m_outputFrequency * ratio);
+		for (auto& pStemSynth : m_stemSynths)
+		{
+			pStemSynth->SetRates(MemoryBus::kCyclesPerSecond, m_outputFrequency * ratio);
+		}
+	}
+
+	void ClearSynths()
+	{
+		m_mixSynth.Clear();
+		for (auto& pStemSynth : m_stemSynths)
+		{
+			pStemSynth->Clear();
+		}
+	}
+
+	// Sends output to a 16-bit stereo WAV file instead of the device, at whatever speed it is emulated, until
+	// StopWavCapture().  With channel stems, each channel also goes to a file of its own, named after the main one with
+	// .ch1 to .ch4 before the extension.  Capture starts on a fresh sound frame at exactly the output rate.
+	void StartWavCapture(const char* pFileName, bool channelStems)
+	{
+		if (m_pSynthesisThread)
+		{
+			SynchronizeSynthesisThread().StartWavCapture(pFileName, channelStems);
+			return;
+		}
+
+		StopWavCapture();
+
+		m_pWavWriter.reset(new WavWriter(pFileName, m_outputFrequency, kDeviceNumChannels));
+		if (channelStems)
+		{
+			std::string fileName(pFileName);
+			auto extension = fileName.rfind('.');
+			if ((extension == std::string::npos) || (fileName.find_first_of("/\\", extension) != std::string::npos))
+			{
+				extension = fileName.size();
+			}
+
+			for (int channel = 0; channel < kNumChannels; ++channel)
+			{
+				std::string stemFileName = fileName.substr(0, extension) + Format(".ch%d", channel + 1) + fileName.substr(extension);
+				m_stemWavWriters.emplace_back(new WavWriter(stemFileName.c_str(), m_outputFrequency, kDeviceNumChannels));
+				m_stemSynths.emplace_back(new StereoSynth(GetMaxSamplesPerSoundFrame(m_outputFrequency), m_outputQuality));
 			}
-			
-			m_updateTimeLeft -= timeStep;
 		}
 
-		if (false && (m_deviceId != 0) && (m_tracelogDumpTimer > 0.0f))
+		ClearSynths();
+		SetRateRatio(1.0f);
+		m_soundFrameCycle = 0;
+		m_registersWritten = true;
+	}
+
+	// Writes out what has been synthesized of the current sound frame and closes the capture files
+	void StopWavCapture()
+	{
+		if (m_pSynthesisThread)
 		{
-			FILE* pFile = nullptr;
-			fopen_s(&pFile, "soundlog.txt", "a");
+			SynchronizeSynthesisThread().StopWavCapture();
+			return;
+		}
 
-			SDL_LockAudioDevice(m_deviceId);
-			fwrite(m_traceLog.data(), m_traceLog.size(), 1, pFile);
-			SDL_UnlockAudioDevice(m_deviceId);
+		if (!m_pWavWriter)
+		{
+			return;
+		}
 
-			fclose(pFile);
+		SynthesizePendingCycles();
+		if (m_soundFrameCycle > 0)
+		{
+			EndSoundFrame();
+		}
 
-			m_tracelogDumpTimer -= 2.0f;
+		m_pWavWriter->Close();
+		for (auto& pStemWavWriter : m_stemWavWriters)
+		{
+			pStemWavWriter->Close();
 		}
+		m_pWavWriter.reset();
+		m_stemWavWriters.clear();
+		m_stemSynths.clear();
+	}
+
+	bool IsCapturingWav() const
+	{
+		return m_pSynthesisThread ? m_pSynthesisThread->GetCore().IsCapturingWav() : (m_pWavWriter != nullptr);
+	}
+
+	// Output samples produced per device sample consumed; above 1 while the queue is running low
+	float GetRateRatio() const
+	{
+		return m_pSynthesisThread ? m_pSynthesisThread->GetCore().GetRateRatio() : m_rateRatio.load();
+	}
+
+	// Smoothed amount of audio queued for the device, in milliseconds
+	float GetQueuedMilliseconds() const
+	{
+		return m_pSynthesisThread ? m_pSynthesisThread->GetCore().GetQueuedMilliseconds() : (m_averageQueueFill.load() * 1000.0f / (m_outputFrequency * kDeviceNumChannels));
+	}
+
+	// Number of times the audio callback found fewer samples queued than it needed
+	Uint32 GetUnderrunCount() const
+	{
+		return m_pSynthesisThread ? m_pSynthesisThread->GetCore().GetUnderrunCount() : m_underrunCount.load();
+	}
+
+	// Number of sound frames that did not entirely fit in the queue
+	Uint32 GetOverrunCount() const
+	{
+		return m_pSynthesisThread ? m_pSynthesisThread->GetCore().GetOverrunCount() : m_overrunCount.load();
 	}
 
 	void FillStreamBuffer(Sint16* pBuffer, int numBytes)
@@ -859,31 +1499,24 @@ public:
 
 		m_audioDeviceActive = true;
 
-		if (m_numMonoSamplesAvailable >= kDeviceBufferNumMonoSamples)
+		// Take whatever is queued.  On underrun the rest of the buffer holds the last sample, which is quieter than dropping to 0.
+		int numMonoSamples = numBytes / sizeof(Sint16);
+		int numMonoSamplesRead = static_cast<int>(m_sampleQueue.Read(pBuffer, numMonoSamples));
+		if (numMonoSamplesRead >= kDeviceNumChannels)
 		{
-			//auto samplesInBuffer = m_numMonoSamplesAvailable - kDeviceBufferNumMonoSamples;
-			
-			//// If more than 75% full, drop frequency a bit; if less than 25% full, increase a bit.  This accounts for timekeeping drift between the sound card and this program.
-			//const float timeStepScale = 1.001f;
-			//const int max min
-			//if (samplesInBuffer >= (kDeviceBufferNumMonoSamples * 3 / 4))
-			//{
-			//	m_sampleTimeStep *= timeStepScale;
-			//}
-			//else if (samplesInBuffer >= (kDeviceBufferNumMonoSamples * 1 / 4))
-			//{
-			//	m_sampleTimeStep /= timeStepScale;
-			//}
-
-			//printf("Consumer: %d mono samples available; taking %d. ", m_numMonoSamplesAvailable, kDeviceBufferNumMonoSamples);
-			memcpy(pBuffer, m_backBuffers[m_nextBackBufferToTransfer], kDeviceBufferByteSize);
-			m_nextBackBufferToTransfer = (m_nextBackBufferToTransfer + 1) % 2;
-			m_numMonoSamplesAvailable -= kDeviceBufferNumMonoSamples;
+			m_lastLeftSample = pBuffer[numMonoSamplesRead - 2];
+			m_lastRightSample = pBuffer[numMonoSamplesRead - 1];
 		}
-		else
+
+		if (numMonoSamplesRead < numMonoSamples)
 		{
 			//printf("Sound device starvation!\n");
-			memset(pBuffer, 0, kDeviceBufferByteSize);
+			++m_underrunCount;
+			for (int sample = numMonoSamplesRead; sample < numMonoSamples; sample += kDeviceNumChannels)
+			{
+				pBuffer[sample] = m_lastLeftSample;
+				pBuffer[sample + 1] = m_lastRightSample;
+			}
 		}
 
 		//	static float lpf = 0.0f;
@@ -900,6 +1533,18 @@ public:
 
 	virtual bool HandleRequest(MemoryRequestType requestType, Uint16 address, Uint8& value)
 	{
+		if (requestType == MemoryRequestType::Write)
+		{
+			// The write takes effect on this cycle, after the time up to it
+			SynthesizePendingCycles();
+			m_registersWritten = true;
+
+			if (m_pSynthesisThread)
+			{
+				SubmitSynthesisEvent(address, value);
+			}
+		}
+
 		if (ServiceMemoryRangeRequest(requestType, address, value, kWaveRamBase, kWaveRamSize, m_waveRam))
 		{
 			return true;
@@ -1225,20 +1870,16 @@ public:
 		return false;
 	}
 
-#ifdef NDEBUG
-#pragma optimize("", on)
-#endif
-
 private:
-	float m_updateTimeLeft;
-	float m_sampleTimeLeft;
 
 	SDL_AudioDeviceID m_deviceId;
+	int m_outputFrequency;
+	BlipBuffer::Quality m_outputQuality;
+	bool m_stepEveryCycle;
 
-	bool m_audioDeviceActive;
+	std::atomic<bool> m_audioDeviceActive; // set by the audio callback
 	Uint16 m_masterCounter;
 	Uint16 m_sequencerCounter;
-	float m_sampleTimeStep;
 
 	FrequencySweep m_ch1Sweep;
 	SquareWaveGenerator m_ch1Generator;
@@ -1255,6 +1896,18 @@ private:
 	NoiseGenerator m_ch4Generator;
 	LengthCounter m_ch4LengthCounter;
 	VolumeEnvelope m_ch4VolumeEnvelope;
+
+	StereoSynth m_mixSynth;
+	Sint16 m_mixGains[kNumChannels * 2]; // left, then right
+	std::vector<Sint16> m_soundFrameSamples; // interleaved
+	int m_soundFrameCycle;
+	int m_cyclesPending; // banked by Update() while the output can't change
+	int m_cyclesUntilNextChange; // in the output, as of the last synthesis
+	bool m_registersWritten;
+
+	std::unique_ptr<WavWriter> m_pWavWriter;
+	std::vector<std::unique_ptr<WavWriter>> m_stemWavWriters;
+	std::vector<std::unique_ptr<StereoSynth>> m_stemSynths; // only while capturing stems
 	
 	Uint8 NR10;
 	Uint8 NR11;
@@ -1284,9 +1937,17 @@ private:
 
 	Uint8 m_waveRam[kWaveRamSize];
 
-	Uint32 m_numMonoSamplesAvailable;
-	Uint8 m_nextBackBufferToTransfer;
-	Uint16 m_backBuffers[2][kDeviceBufferNumMonoSamples];
+	SpscRingBuffer<Sint16> m_sampleQueue;
+	Sint16 m_lastLeftSample; // audio callback only
+	Sint16 m_lastRightSample; // audio callback only
+	std::atomic<Uint32> m_underrunCount;
+	std::atomic<Uint32> m_overrunCount;
+	std::atomic<float> m_averageQueueFill; // mono samples; atomic, like the counters, for reading from the emulation thread while threaded
+	std::atomic<float> m_rateRatio;
+
+	std::unique_ptr<SynthesisThread> m_pSynthesisThread;
+	Uint64 m_synthesisCycle; // emulation thread's cycle count, that events are stamped with
+	Uint64 m_lastSubmittedCycle;
 
 	std::string m_traceLog;
 	float m_tracelogDumpTimer;
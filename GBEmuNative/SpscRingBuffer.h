@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <atomic>
+
+// Lock-free ring buffer for exactly one producer thread and one consumer thread.  The producer only ever stores the head
+// and the consumer only ever stores the tail; each publishes with a release store after touching the elements, and reads
+// the other's index with an acquire load.  The indices run freely and are masked on use, so the capacity must be a power of
+// two, and full and empty are told apart without giving up a slot.
+template <typename T>
+class SpscRingBuffer
+{
+public:
+	SpscRingBuffer(size_t capacity)
+		: m_buffer(capacity)
+		, m_mask(capacity - 1)
+		, m_head(0)
+		, m_tail(0)
+	{
+		SDL_assert((capacity != 0) && ((capacity & m_mask) == 0));
+	}
+
+	size_t GetCapacity() const
+	{
+		return m_buffer.size();
+	}
+
+	// A snapshot; exact only when called from the producer or consumer while the other side is idle
+	size_t GetAvailable() const
+	{
+		return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+	}
+
+	// Producer side.  Writes as many of the elements as fit and returns how many that was.
+	size_t Write(const T* pElements, size_t count)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		size_t tail = m_tail.load(std::memory_order_acquire);
+		count = SDL_min(count, GetCapacity() - (head - tail));
+
+		CopyIn(head, pElements, count);
+		m_head.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer side.  Reads up to count elements and returns how many were available.
+	size_t Read(T* pElements, size_t count)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		size_t head = m_head.load(std::memory_order_acquire);
+		count = SDL_min(count, head - tail);
+
+		CopyOut(tail, pElements, count);
+		m_tail.store(tail + count, std::memory_order_release);
+		return count;
+	}
+
+	// Not thread safe: only call while neither side is running
+	void Reset()
+	{
+		m_head.store(0, std::memory_order_relaxed);
+		m_tail.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	// At most two spans, split where the ring wraps
+	void CopyIn(size_t index, const T* pElements, size_t count)
+	{
+		size_t start = index & m_mask;
+		size_t firstSpan = SDL_min(count, GetCapacity() - start);
+		std::copy(pElements, pElements + firstSpan, m_buffer.begin() + start);
+		std::copy(pElements + firstSpan, pElements + count, m_buffer.begin());
+	}
+
+	void CopyOut(size_t index, T* pElements, size_t count) const
+	{
+		size_t start = index & m_mask;
+		size_t firstSpan = SDL_min(count, GetCapacity() - start);
+		std::copy(m_buffer.begin() + start, m_buffer.begin() + start + firstSpan, pElements);
+		std::copy(m_buffer.begin(), m_buffer.begin() + (count - firstSpan), pElements + firstSpan);
+	}
+
+	std::vector<T> m_buffer;
+	size_t m_mask;
+
+	// Padding keeps the two indices, which are stored by different threads, off each other's cache lines
+	static const size_t kCacheLineSize = 64;
+	char m_padding0[kCacheLineSize];
+	std::atomic<size_t> m_head;
+	char m_padding1[kCacheLineSize - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> m_tail;
+	char m_padding2[kCacheLineSize - sizeof(std::atomic<size_t>)];
+};
@@ -0,0 +1,356 @@
+#pragma once
+
+#include "GameBoy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs test ROMs headless, as many at once as there are cores, and judges each from what it sends out of the serial port:
+// blargg's tests print "Passed" or "Failed", and mooneye-gb's send the Fibonacci bytes 3, 5, 8, 13, 21, 34 on success and
+// six 0x42s on failure.  A ROM that stops at a jump to itself without giving a result, or that is still running when its
+// budget of emulated time runs out, is reported as such rather than waited on.
+class TestRomRunner
+{
+public:
+	enum class Outcome
+	{
+		Passed,
+		Failed,
+		NoResult, // stopped without reporting a result
+		TimedOut,
+		Error, // could not be loaded or run, e.g. an unsupported cartridge type or opcode
+	};
+
+	struct Result
+	{
+		std::string romFileName;
+		Outcome outcome;
+		std::string serialOutput;
+		std::string error;
+		float emulatedSeconds;
+		float hostSeconds;
+	};
+
+	static const char* GetOutcomeName(Outcome outcome)
+	{
+		switch (outcome)
+		{
+		case Outcome::Passed: return "passed";
+		case Outcome::Failed: return "failed";
+		case Outcome::NoResult: return "no result";
+		case Outcome::TimedOut: return "timed out";
+		case Outcome::Error: return "error";
+		}
+		return "?";
+	}
+
+	// All .gb and .gbc files under a directory, in its subdirectories too, sorted by path
+	static std::vector<std::string> FindRoms(const std::string& directory)
+	{
+		std::vector<std::string> romFileNames;
+		FindRoms(directory, romFileNames);
+		std::sort(romFileNames.begin(), romFileNames.end());
+		return romFileNames;
+	}
+
+	static Result RunRom(const std::string& romFileName, float budgetSeconds)
+	{
+		// Emulated time between looking at the serial output, and how long to keep going once a result is in, for the
+		// details that follow it
+		static const float secondsPerCheck = 0.1f;
+		static const float secondsAfterResult = 1.0f;
+
+		Result result;
+		result.romFileName = romFileName;
+		result.outcome = Outcome::TimedOut;
+		result.emulatedSeconds = 0.0f;
+
+		auto startMicroseconds = GetMicroseconds();
+		try
+		{
+			Sound::OutputSettings audioSettings;
+			audioSettings.openDevice = false;
+			GameBoy gb(romFileName.c_str(), nullptr, audioSettings);
+			gb.SetFrameSkip(Lcd::kSkipAllFrames);
+			gb.SetSerialEcho(false);
+
+			auto resultSeconds = -1.0f;
+			size_t lastSerialOutputSize = 0;
+			auto wasAtSelfJump = false;
+			auto numChecks = SDL_max(static_cast<int>(budgetSeconds / secondsPerCheck + 0.5f), 1);
+			for (int check = 1; check <= numChecks; ++check)
+			{
+				gb.Update(secondsPerCheck);
+				result.emulatedSeconds = check * secondsPerCheck;
+
+				const auto& serialOutput = gb.GetSerialOutput();
+				if (resultSeconds < 0.0f)
+				{
+					auto outcome = MatchResult(serialOutput);
+					if (outcome != Outcome::NoResult)
+					{
+						result.outcome = outcome;
+						resultSeconds = result.emulatedSeconds;
+					}
+				}
+
+				// Done once parked on a jump to itself with nothing more to say, for two checks running
+				auto isAtSelfJump = gb.IsAtSelfJump() && (serialOutput.size() == lastSerialOutputSize);
+				if ((isAtSelfJump && wasAtSelfJump) || ((resultSeconds >= 0.0f) && (result.emulatedSeconds - resultSeconds >= secondsAfterResult)))
+				{
+					if (resultSeconds < 0.0f)
+					{
+						result.outcome = Outcome::NoResult;
+					}
+					break;
+				}
+				wasAtSelfJump = isAtSelfJump;
+				lastSerialOutputSize = serialOutput.size();
+			}
+
+			result.serialOutput = gb.GetSerialOutput();
+		}
+		catch (const Exception& e)
+		{
+			result.outcome = Outcome::Error;
+			result.error = e.GetMessage();
+		}
+		catch (const std::exception& e)
+		{
+			result.outcome = Outcome::Error;
+			result.error = e.what();
+		}
+		result.hostSeconds = (GetMicroseconds() - startMicroseconds) / 1000000.0f;
+
+		return result;
+	}
+
+	// Runs the ROMs on a number of threads (0 for one per core), reporting each result through the callback as it comes in,
+	// from whichever thread ran it, one at a time.  Results are returned in the order of the ROMs.
+	static std::vector<Result> RunRoms(const std::vector<std::string>& romFileNames, float budgetSeconds, int numThreads,
+		const std::function<void(const Result&)>& onResult)
+	{
+		if (numThreads <= 0)
+		{
+			numThreads = SDL_max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+		}
+		numThreads = SDL_min(numThreads, static_cast<int>(romFileNames.size()));
+
+		std::vector<Result> results(romFileNames.size());
+		std::atomic<size_t> nextRomIndex(0);
+		std::mutex resultMutex;
+		auto runRoms = [&]()
+		{
+			for (;;)
+			{
+				auto romIndex = nextRomIndex++;
+				if (romIndex >= romFileNames.size())
+				{
+					break;
+				}
+
+				results[romIndex] = RunRom(romFileNames[romIndex], budgetSeconds);
+				if (onResult)
+				{
+					std::lock_guard<std::mutex> lock(resultMutex);
+					onResult(results[romIndex]);
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (int i = 0; i < numThreads; ++i)
+		{
+			threads.emplace_back(runRoms);
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		return results;
+	}
+
+	static void WriteJsonReport(const std::vector<Result>& results, const char* pFileName)
+	{
+		std::string report = "{\n  \"results\": [\n";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const auto& result = results[i];
+			report += Format("    {\"rom\": \"%s\", \"outcome\": \"%s\", \"emulatedSeconds\": %.1f, \"hostSeconds\": %.3f, ",
+				EscapeJson(result.romFileName).c_str(), GetOutcomeName(result.outcome), result.emulatedSeconds, result.hostSeconds);
+			report += "\"serialOutput\": \"" + EscapeJson(result.serialOutput) + "\", \"error\": \"" + EscapeJson(result.error) + "\"}";
+			report += (i + 1 < results.size()) ? ",\n" : "\n";
+		}
+		report += "  ],\n";
+		report += Format("  \"passed\": %d,\n  \"total\": %d\n}\n", CountPassed(results), static_cast<int>(results.size()));
+
+		WriteReport(report, pFileName);
+	}
+
+	static void WriteJUnitReport(const std::vector<Result>& results, const char* pFileName)
+	{
+		auto totalSeconds = 0.0f;
+		int numFailures = 0;
+		int numErrors = 0;
+		for (const auto& result : results)
+		{
+			totalSeconds += result.hostSeconds;
+			numFailures += ((result.outcome == Outcome::Failed) || (result.outcome == Outcome::NoResult) || (result.outcome == Outcome::TimedOut)) ? 1 : 0;
+			numErrors += (result.outcome == Outcome::Error) ? 1 : 0;
+		}
+
+		std::string report = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+		report += Format("<testsuite name=\"test-roms\" tests=\"%d\" failures=\"%d\" errors=\"%d\" time=\"%.3f\">\n",
+			static_cast<int>(results.size()), numFailures, numErrors, totalSeconds);
+		for (const auto& result : results)
+		{
+			report += Format("  <testcase name=\"%s\" time=\"%.3f\">\n", EscapeXml(result.romFileName).c_str(), result.hostSeconds);
+			if (result.outcome == Outcome::Error)
+			{
+				report += "    <error message=\"" + EscapeXml(result.error) + "\"/>\n";
+			}
+			else if (result.outcome != Outcome::Passed)
+			{
+				report += Format("    <failure message=\"%s\"/>\n", GetOutcomeName(result.outcome));
+			}
+			report += "    <system-out>" + EscapeXml(result.serialOutput) + "</system-out>\n";
+			report += "  </testcase>\n";
+		}
+		report += "</testsuite>\n";
+
+		WriteReport(report, pFileName);
+	}
+
+	static int CountPassed(const std::vector<Result>& results)
+	{
+		return static_cast<int>(std::count_if(results.begin(), results.end(), [](const Result& result) { return result.outcome == Outcome::Passed; }));
+	}
+
+private:
+	static void FindRoms(const std::string& directory, std::vector<std::string>& romFileNames)
+	{
+		WIN32_FIND_DATAA findData;
+		auto hFind = FindFirstFileA((directory + "\\*").c_str(), &findData);
+		if (hFind == INVALID_HANDLE_VALUE)
+		{
+			throw Exception("Couldn't list directory: %s", directory.c_str());
+		}
+
+		do
+		{
+			std::string name = findData.cFileName;
+			auto path = directory + "\\" + name;
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				if ((name != ".") && (name != ".."))
+				{
+					FindRoms(path, romFileNames);
+				}
+			}
+			else if (HasExtension(name, ".gb") || HasExtension(name, ".gbc"))
+			{
+				romFileNames.push_back(path);
+			}
+		} while (FindNextFileA(hFind, &findData));
+
+		FindClose(hFind);
+	}
+
+	static bool HasExtension(const std::string& name, const char* pExtension)
+	{
+		auto extensionLength = strlen(pExtension);
+		return (name.length() > extensionLength) && (_stricmp(name.c_str() + name.length() - extensionLength, pExtension) == 0);
+	}
+
+	static Outcome MatchResult(const std::string& serialOutput)
+	{
+		static const char mooneyePassed[] = { 3, 5, 8, 13, 21, 34 };
+		static const char mooneyeFailed[] = { 0x42, 0x42, 0x42, 0x42, 0x42, 0x42 };
+
+		if ((serialOutput.find("Passed") != std::string::npos) || (serialOutput.find(mooneyePassed, 0, sizeof(mooneyePassed)) != std::string::npos))
+		{
+			return Outcome::Passed;
+		}
+		if ((serialOutput.find("Failed") != std::string::npos) || (serialOutput.find(mooneyeFailed, 0, sizeof(mooneyeFailed)) != std::string::npos))
+		{
+			return Outcome::Failed;
+		}
+		return Outcome::NoResult;
+	}
+
+	static std::string EscapeJson(const std::string& text)
+	{
+		std::string result;
+		for (auto c : text)
+		{
+			auto u = static_cast<Uint8>(c);
+			if ((c == '"') || (c == '\\'))
+			{
+				result += '\\';
+				result += c;
+			}
+			else if (c == '\n')
+			{
+				result += "\\n";
+			}
+			else if ((u < 0x20) || (u >= 0x7F))
+			{
+				result += Format("\\u%04x", u);
+			}
+			else
+			{
+				result += c;
+			}
+		}
+		return result;
+	}
+
+	static std::string EscapeXml(const std::string& text)
+	{
+		std::string result;
+		for (auto c : text)
+		{
+			auto u = static_cast<Uint8>(c);
+			switch (c)
+			{
+			case '&': result += "&amp;"; break;
+			case '<': result += "&lt;"; break;
+			case '>': result += "&gt;"; break;
+			case '"': result += "&quot;"; break;
+			case '\n': result += c; break;
+			default:
+				// XML 1.0 has no way to carry most control characters at all
+				if ((u < 0x20) || (u >= 0x7F))
+				{
+					result += Format("\\x%02X", u);
+				}
+				else
+				{
+					result += c;
+				}
+				break;
+			}
+		}
+		return result;
+	}
+
+	static void WriteReport(const std::string& report, const char* pFileName)
+	{
+		FILE* pFile = nullptr;
+		if ((fopen_s(&pFile, pFileName, "wb") != 0) || !pFile)
+		{
+			throw Exception("Couldn't open report file for writing: %s", pFileName);
+		}
+		bool succeeded = (fwrite(report.data(), report.size(), 1, pFile) == 1);
+		succeeded = (fclose(pFile) == 0) && succeeded;
+		if (!succeeded)
+		{
+			throw Exception("Couldn't write report file: %s", pFileName);
+		}
+	}
+};
@@ -2,6 +2,7 @@
 
 #include "IMemoryBusDevice.h"
 #include "Cpu.h"
+#include "MasterClock.h"
 
 class Timer : public IMemoryBusDevice
 {
@@ -16,91 +17,196 @@ public:
 
 	static int const kDivFrequency = 16384;
 
-	Timer(const std::shared_ptr<Cpu>& cpu)
+	// The timer is modelled as the hardware builds it: a 16-bit system counter that counts every cycle, with DIV as its top
+	// byte, and TIMA counting falling edges of the counter bit TAC selects (ANDed with the enable bit).  Nothing about that
+	// needs stepping: the system counter is the master clock less the cycle DIV was last reset on, and the number of falling
+	// edges of a bit between two counter values is how many times the counter crossed a multiple of twice that bit.  So
+	// TIMA is only brought up to date when accessed, or at its next overflow, which is worked out in advance so that the
+	// interrupt is raised on time.
+	Timer(const std::shared_ptr<Cpu>& cpu, const std::shared_ptr<MasterClock>& clock)
 		: m_pCpu(cpu)
+		, m_pClock(clock)
 	{
 		Reset();
 	}
 
 	void Reset()
 	{
-		m_DivTicksRemaining = 0.0f;
-		m_TimaTicksRemaining = 0.0f;
+		m_counterResetCycle = m_pClock->GetCycles();
+		m_timaCycle = m_counterResetCycle;
 
-		DIV = 0;
 		TIMA = 0;
 		TMA = 0;
 		TAC = 0;
+
+		ScheduleOverflow();
 	}
 
-	void Update(float seconds)
+	// The master clock cycle on or after which Update() needs calling, for the overflow interrupt
+	Uint64 GetNextEventCycle() const
 	{
-		m_DivTicksRemaining += seconds * kDivFrequency;
-		while (m_DivTicksRemaining > 1.0f)
-		{
-			++DIV;
-			m_DivTicksRemaining -= 1.0f;
-		}
+		return m_overflowCycle;
+	}
+
+	void Update()
+	{
+		Synchronize();
+		ScheduleOverflow();
+	}
 
-		// If the timer is enabled
-		if (TAC & Bit2)
+	virtual bool HandleRequest(MemoryRequestType requestType, Uint16 address, Uint8& value)
+	{
+		switch (address)
 		{
-			int frequency = 0;
-			switch (TAC & 0x3)
+		case Registers::DIV:
 			{
-			case 0: frequency = 4096; break;
-			case 1: frequency = 262144; break;
-			case 2: frequency = 65536; break;
-			case 3: frequency = 16384; break;
+				if (requestType == MemoryRequestType::Write)
+				{
+					// Resetting the counter is a falling edge if the selected bit was set
+					Synchronize();
+					bool wasSelectedBitSet = IsSelectedBitSet(GetSystemCounter(), TAC);
+					m_counterResetCycle = m_pClock->GetCycles();
+					if (wasSelectedBitSet)
+					{
+						IncrementTima(1);
+					}
+					ScheduleOverflow();
+				}
+				else
+				{
+					value = static_cast<Uint8>(GetSystemCounter() >> 8);
+				}
+				return true;
 			}
-			m_TimaTicksRemaining += seconds * frequency;
-
-			while (m_TimaTicksRemaining > 1.0f)
+			break;
+		case Registers::TIMA:
 			{
-				// Handle overflow
-				if (TIMA == 0xFF)
+				Synchronize();
+				if (requestType == MemoryRequestType::Write)
 				{
-					TIMA = TMA;
-					m_pCpu->SignalInterrupt(Bit2);
+					TIMA = value;
+					ScheduleOverflow();
 				}
-
-				++TIMA;
-				m_TimaTicksRemaining -= 1.0f;
+				else
+				{
+					value = TIMA;
+				}
+				return true;
 			}
-		}
-	}
-	
-	virtual bool HandleRequest(MemoryRequestType requestType, Uint16 address, Uint8& value)
-	{
-		switch (address)
-		{
-		case Registers::DIV:
+			break;
+		case Registers::TMA:
+			{
+				Synchronize();
+				if (requestType == MemoryRequestType::Write)
+				{
+					TMA = value;
+					ScheduleOverflow();
+				}
+				else
+				{
+					value = TMA;
+				}
+				return true;
+			}
+			break;
+		case Registers::TAC:
 			{
+				Synchronize();
 				if (requestType == MemoryRequestType::Write)
 				{
-					DIV = 0;
+					// Switching the selected bit from set to clear, by disabling or picking another bit, is a falling edge too
+					bool wasSelectedBitSet = IsSelectedBitSet(GetSystemCounter(), TAC);
+					TAC = value;
+					if (wasSelectedBitSet && !IsSelectedBitSet(GetSystemCounter(), TAC))
+					{
+						IncrementTima(1);
+					}
+					ScheduleOverflow();
 				}
 				else
 				{
-					value = DIV;
+					value = TAC;
 				}
 				return true;
 			}
 			break;
-		SERVICE_MMR_RW(TIMA)
-		SERVICE_MMR_RW(TMA)
-		SERVICE_MMR_RW(TAC)
 		}
-	
+
 		return false;
 	}
 
-	Uint8 DIV;
 	Uint8 TIMA;
 	Uint8 TMA;
 	Uint8 TAC;
+
 private:
+	// Counter values cross a multiple of this once per falling edge of the bit TAC selects: 4096Hz, 262144Hz, 65536Hz, 16384Hz
+	static Uint64 GetTimaPeriod(Uint8 tac)
+	{
+		static const Uint64 periods[] = { 1024, 16, 64, 256 };
+		return periods[tac & 0x3];
+	}
+
+	static bool IsTimerEnabled(Uint8 tac)
+	{
+		return (tac & Bit2) != 0;
+	}
+
+	static bool IsSelectedBitSet(Uint64 counter, Uint8 tac)
+	{
+		return IsTimerEnabled(tac) && ((counter & (GetTimaPeriod(tac) / 2)) != 0);
+	}
+
+	// The system counter without wrapping; DIV is bits 8-15 of it
+	Uint64 GetSystemCounter() const
+	{
+		return m_pClock->GetCycles() - m_counterResetCycle;
+	}
+
+	// Applies the falling edges since TIMA was last brought up to date
+	void Synchronize()
+	{
+		Uint64 cycle = m_pClock->GetCycles();
+		if (IsTimerEnabled(TAC))
+		{
+			Uint64 period = GetTimaPeriod(TAC);
+			Uint64 edges = ((cycle - m_counterResetCycle) / period) - ((m_timaCycle - m_counterResetCycle) / period);
+			IncrementTima(edges);
+		}
+		m_timaCycle = cycle;
+	}
+
+	void IncrementTima(Uint64 increments)
+	{
+		Uint64 incrementsToOverflow = 0x100 - TIMA;
+		if (increments < incrementsToOverflow)
+		{
+			TIMA = static_cast<Uint8>(TIMA + increments);
+			return;
+		}
+
+		// On overflow TIMA is reloaded from TMA, and any further increments count up from there
+		Uint64 reloadPeriod = 0x100 - TMA;
+		TIMA = static_cast<Uint8>(TMA + (increments - incrementsToOverflow) % reloadPeriod);
+		m_pCpu->SignalInterrupt(Bit2);
+	}
+
+	// Works out the cycle of the next overflow from TIMA's current value; needed after anything that affects it
+	void ScheduleOverflow()
+	{
+		m_overflowCycle = MasterClock::kNever;
+		if (IsTimerEnabled(TAC))
+		{
+			Uint64 period = GetTimaPeriod(TAC);
+			Uint64 counter = m_timaCycle - m_counterResetCycle;
+			Uint64 overflowCounter = ((counter / period) + (0x100 - TIMA)) * period;
+			m_overflowCycle = m_counterResetCycle + overflowCounter;
+		}
+	}
+
 	std::shared_ptr<Cpu> m_pCpu;
-	float m_DivTicksRemaining;
-	float m_TimaTicksRemaining;
-};
\ No newline at end of file
+	std::shared_ptr<MasterClock> m_pClock;
+	Uint64 m_counterResetCycle; // when DIV was last written, from which the system counter counts
+	Uint64 m_timaCycle; // when TIMA was last brought up to date
+	Uint64 m_overflowCycle;
+};
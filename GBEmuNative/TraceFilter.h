@@ -0,0 +1,144 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <vector>
+
+// Narrows what the analyzer traces, so that a long session can be traced without paying for every instruction.  Each kind
+// of filter that is set has to pass for an instruction to be traced:
+// -address ranges: only instructions in them, per ROM bank in the banked window at 4000h-7FFFh; this is a bitmap test
+// -a function: only instructions inside it and whatever it calls, interrupt handlers included; the analyzer keeps track of
+//  this as functions are called and return, so it costs a flag test
+// -a watchpoint: only instructions around an access to an address, the given number before and after it, back to the
+//  start of the frame at most; the ones before are kept in memory until then, so with this filter every instruction costs
+//  a record copy, but none reaches the file.  An access by an instruction that the other filters leave out is not a hit.
+class TraceFilter
+{
+public:
+	// For the banked window: ranges there apply to every bank
+	static const int kAnyBank = -1;
+
+	TraceFilter()
+		: m_hasFunction(false)
+		, m_functionBank(kAnyBank)
+		, m_functionAddress(0)
+		, m_hasWatchpoint(false)
+		, m_watchAddress(0)
+		, m_watchRecordsAround(0)
+	{
+	}
+
+	// Inclusive; the bank only matters for addresses in the banked window
+	void AddAddressRange(int bank, Uint16 firstAddress, Uint16 lastAddress)
+	{
+		if (firstAddress > lastAddress)
+		{
+			throw Exception("Invalid trace address range %04X-%04X", firstAddress, lastAddress);
+		}
+		if ((bank < kAnyBank) || (bank > 0xFF))
+		{
+			throw Exception("Invalid ROM bank %d", bank);
+		}
+
+		if (m_addressBitmap.empty())
+		{
+			m_addressBitmap.resize((kUnbankedSize + kNumBanks * kBankSize) / 32, 0);
+		}
+
+		for (Uint32 address = firstAddress; address <= lastAddress; ++address)
+		{
+			auto banked = IsBanked(static_cast<Uint16>(address));
+			Uint32 firstBank = (banked && (bank != kAnyBank)) ? static_cast<Uint32>(bank) : 0;
+			Uint32 lastBank = (banked && (bank == kAnyBank)) ? kNumBanks - 1 : firstBank;
+			for (auto b = firstBank; b <= lastBank; ++b)
+			{
+				auto index = GetBitIndex(static_cast<Uint8>(b), static_cast<Uint16>(address));
+				m_addressBitmap[index / 32] |= 1u << (index % 32);
+			}
+		}
+	}
+
+	bool HasAddressRanges() const
+	{
+		return !m_addressBitmap.empty();
+	}
+
+	bool IsAddressTraced(Uint8 bank, Uint16 address) const
+	{
+		auto index = GetBitIndex(bank, address);
+		return (m_addressBitmap[index / 32] & (1u << (index % 32))) != 0;
+	}
+
+	void SetFunction(int bank, Uint16 entryPoint)
+	{
+		if ((bank < kAnyBank) || (bank > 0xFF))
+		{
+			throw Exception("Invalid ROM bank %d", bank);
+		}
+		m_hasFunction = true;
+		m_functionBank = bank;
+		m_functionAddress = entryPoint;
+	}
+
+	bool HasFunction() const
+	{
+		return m_hasFunction;
+	}
+
+	bool IsFunction(Uint8 bank, Uint16 entryPoint) const
+	{
+		return m_hasFunction && (entryPoint == m_functionAddress) && (!IsBanked(entryPoint) || (m_functionBank == kAnyBank) || (m_functionBank == bank));
+	}
+
+	// Reads and writes both count as hits, as with the memory bus's data breakpoint
+	void SetWatchpoint(Uint16 address, Uint32 recordsAround)
+	{
+		if (recordsAround == 0)
+		{
+			throw Exception("A trace watchpoint needs a number of instructions to trace around it");
+		}
+		m_hasWatchpoint = true;
+		m_watchAddress = address;
+		m_watchRecordsAround = recordsAround;
+	}
+
+	bool HasWatchpoint() const
+	{
+		return m_hasWatchpoint;
+	}
+
+	Uint16 GetWatchAddress() const
+	{
+		return m_watchAddress;
+	}
+
+	Uint32 GetWatchRecordsAround() const
+	{
+		return m_watchRecordsAround;
+	}
+
+private:
+	static const Uint32 kNumBanks = 256;
+	static const Uint32 kBankedBase = 0x4000;
+	static const Uint32 kBankSize = 0x4000;
+	static const Uint32 kUnbankedSize = 0x10000;
+
+	static bool IsBanked(Uint16 address)
+	{
+		return (address >= kBankedBase) && (address < kBankedBase + kBankSize);
+	}
+
+	// One bit for each address outside the banked window, then one for each address in it, bank after bank
+	static Uint32 GetBitIndex(Uint8 bank, Uint16 address)
+	{
+		return IsBanked(address) ? (kUnbankedSize + bank * kBankSize + (address - kBankedBase)) : address;
+	}
+
+	std::vector<Uint32> m_addressBitmap; // empty without ranges
+	bool m_hasFunction;
+	int m_functionBank;
+	Uint16 m_functionAddress;
+	bool m_hasWatchpoint;
+	Uint16 m_watchAddress;
+	Uint32 m_watchRecordsAround;
+};
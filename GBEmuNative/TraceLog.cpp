@@ -1,15 +1,237 @@
 #include "TraceLog.h"
 
+#include "Analyzer.h"
+#include "CpuMetadata.h"
+
+#include "Cpu.h"
+#include "GameLinkPort.h"
+#include "Joypad.h"
+#include "Lcd.h"
+#include "Sound.h"
+#include "Timer.h"
+
+#include <vector>
+
 namespace TraceLog
 {
-	std::string s_traceLog;
-	bool s_enabled;
-	struct FlushOnDestroy
+	namespace
 	{
-		~FlushOnDestroy()
+		std::string GetRegisterName(Uint16 address)
+		{
+			switch (address)
+			{
+#define ENUMERATE_DEVICE(device, reg) case device::Registers::reg: return std::string(#reg); break;
+				ENUMERATE_DEVICES()
+#undef ENUMERATE_DEVICE
+			}
+			return "";
+		}
+
+		// Instructions that access a register by its absolute address, with LD (nn), get the address as a comment; the
+		// mnemonic itself is always the one from the opcode table
+		std::string GetOperandComment(CpuMetadata::OperandFormat format, const Record& record)
+		{
+			switch (format)
+			{
+			case CpuMetadata::OperandFormat::Indirect16:
+				{
+					auto address = Make16(record.opcode[2], record.opcode[1]);
+					if (!GetRegisterName(address).empty())
+					{
+						return Format("(%04Xh)", address);
+					}
+				}
+				break;
+			default:
+				break;
+			}
+			return "";
+		}
+
+		std::string FormatRecord(const Record& record)
+		{
+			switch (record.type)
+			{
+			case RecordType::Halt:
+				return "(HALT executed, CPU halted)\n";
+			case RecordType::HaltResumed:
+				return Format("(resuming after HALT - IF %d)\n", record.value);
+			case RecordType::Interrupt:
+				return Format("(interrupt 0x%04X pending - CPU unhalted)\n", record.pc);
+			case RecordType::WatchpointRead:
+				return Format("(watchpoint: read 0x%02X from 0x%04X)\n", record.value, record.pc);
+			case RecordType::WatchpointWrite:
+				return Format("(watchpoint: wrote 0x%02X to 0x%04X)\n", record.value, record.pc);
+			case RecordType::Instruction:
+				break;
+			default:
+				return Format("(unknown trace record type %d)\n", record.type);
+			}
+
+			const auto& meta = CpuMetadata::GetOpcodeMetadata(record.opcode[0], record.opcode[1]);
+
+			auto comment = GetOperandComment(meta.directOutputFormat, record);
+			auto inputComment = GetOperandComment(meta.directInputFormat, record);
+			if (!inputComment.empty())
+			{
+				comment += comment.empty() ? inputComment : (" / " + inputComment);
+			}
+
+			// Format partly inspired from VisualBoyAdvance and then bastardized...
+			return Format("CPU %08d: [%04X] %-16s %-10s AF=%02X%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X %c%c%c%c LY=%d %c%c\n",
+				record.instructionCount,
+				record.pc,
+				meta.fullMnemonic.c_str(),
+				comment.empty() ? "" : ("; " + comment).c_str(),
+				record.a,
+				record.f,
+				record.b,
+				record.c,
+				record.d,
+				record.e,
+				record.h,
+				record.l,
+				record.sp,
+				(record.f & FlagBitMask::Zero) ? 'Z' : 'z',
+				(record.f & FlagBitMask::Subtract) ? 'S' : 's',
+				(record.f & FlagBitMask::HalfCarry) ? 'H' : 'h',
+				(record.f & FlagBitMask::Carry) ? 'C' : 'c',
+				record.ly,
+				(record.flags & kVBlankRequested) ? 'V' : 'v',
+				(record.flags & kInterruptsEnabled) ? 'I' : 'i');
+		}
+	}
+
+	void Decode(const char* pTraceFileName, const char* pTextFileName, Uint32 firstFrame, Uint32 numFrames)
+	{
+		FILE* pTraceFile = nullptr;
+		if ((fopen_s(&pTraceFile, pTraceFileName, "rb") != 0) || !pTraceFile)
+		{
+			throw Exception("Can't open trace file %s", pTraceFileName);
+		}
+		Janitor closeTraceFile([&] { fclose(pTraceFile); });
+
+		FileHeader header;
+		if ((fread(&header, sizeof(header), 1, pTraceFile) != 1) || (header.magic != FileHeader::kMagic))
 		{
-			TraceLog::Flush();
+			throw Exception("Not a trace file: %s", pTraceFileName);
+		}
+		if ((header.version != FileHeader::kVersion) || (header.recordSize != sizeof(Record)))
+		{
+			throw Exception("Unsupported trace file version %u: %s", header.version, pTraceFileName);
+		}
+		header.romName[sizeof(header.romName) - 1] = '\0';
+
+		// Where the frames start and end, from the index; the last frame ends with the file
+		Uint64 startOffset = 0;
+		Uint64 endOffset = ~static_cast<Uint64>(0);
+		{
+			auto indexFileName = GetIndexFileName(pTraceFileName);
+			FILE* pIndexFile = nullptr;
+			if ((fopen_s(&pIndexFile, indexFileName.c_str(), "rb") != 0) || !pIndexFile)
+			{
+				throw Exception("Can't open trace index file %s", indexFileName.c_str());
+			}
+			Janitor closeIndexFile([&] { fclose(pIndexFile); });
+
+			IndexHeader indexHeader;
+			if ((fread(&indexHeader, sizeof(indexHeader), 1, pIndexFile) != 1) || (indexHeader.magic != IndexHeader::kMagic)
+				|| (indexHeader.version != IndexHeader::kVersion))
+			{
+				throw Exception("Not a trace index file: %s", indexFileName.c_str());
+			}
+
+			auto readFrameOffset = [&](Uint64 frame, Uint64& offset)
+			{
+				return (_fseeki64(pIndexFile, sizeof(indexHeader) + frame * sizeof(Uint64), SEEK_SET) == 0)
+					&& (fread(&offset, sizeof(offset), 1, pIndexFile) == 1);
+			};
+			if (!readFrameOffset(firstFrame, startOffset))
+			{
+				throw Exception("The trace has no frame %u", firstFrame);
+			}
+			if (numFrames != kAllFrames)
+			{
+				readFrameOffset(static_cast<Uint64>(firstFrame) + numFrames, endOffset);
+			}
+		}
+		if (_fseeki64(pTraceFile, startOffset, SEEK_SET) != 0)
+		{
+			throw Exception("Failed to seek in %s", pTraceFileName);
+		}
+
+		FILE* pTextFile = nullptr;
+		if ((fopen_s(&pTextFile, pTextFileName, "wb") != 0) || !pTextFile)
+		{
+			throw Exception("Can't open %s for writing", pTextFileName);
+		}
+		Janitor closeTextFile([&] { fclose(pTextFile); });
+
+		std::string text = Format("\n\nNew run on %s\n\n", header.romName);
+		auto writeText = [&]()
+		{
+			if (!text.empty() && (fwrite(text.data(), text.length(), 1, pTextFile) != 1))
+			{
+				throw Exception("Failed to write %s", pTextFileName);
+			}
+			text.clear();
+		};
+
+		// Decoded from a buffer that is topped up whenever it could be holding less than a whole record
+		DeltaCoder coder;
+		std::vector<Uint8> data(1 << 20);
+		size_t dataBegin = 0;
+		size_t dataEnd = 0;
+		auto dataOffset = startOffset; // of data[0] in the file
+		auto bytesLeft = endOffset - startOffset;
+		bool endOfData = false;
+		auto frame = (firstFrame > 0) ? firstFrame - 1 : 0;
+		for (;;)
+		{
+			if ((dataEnd - dataBegin < DeltaCoder::kMaxEncodedSize) && !endOfData)
+			{
+				memmove(data.data(), data.data() + dataBegin, dataEnd - dataBegin);
+				dataOffset += dataBegin;
+				dataEnd -= dataBegin;
+				dataBegin = 0;
+				auto bytesToRead = static_cast<size_t>(SDL_min(static_cast<Uint64>(data.size() - dataEnd), bytesLeft));
+				auto bytesRead = fread(data.data() + dataEnd, 1, bytesToRead, pTraceFile);
+				dataEnd += bytesRead;
+				bytesLeft -= bytesRead;
+				endOfData = (bytesRead < bytesToRead) || (bytesLeft == 0);
+			}
+			if (dataBegin == dataEnd)
+			{
+				break;
+			}
+
+			Record record;
+			const Uint8* pData = data.data() + dataBegin;
+			if (!coder.Decode(pData, data.data() + dataEnd, record))
+			{
+				// A trace cut off mid-record, by the emulator stopping, just ends there
+				if (endOfData)
+				{
+					break;
+				}
+				writeText();
+				throw Exception("Trace file is corrupt at offset %llu: %s", dataOffset + dataBegin, pTraceFileName);
+			}
+			dataBegin = pData - data.data();
+
+			if (record.type == RecordType::Frame)
+			{
+				text += Format("(frame %u)\n", ++frame);
+			}
+			else
+			{
+				text += FormatRecord(record);
+			}
+			if (text.length() >= (1 << 20))
+			{
+				writeText();
+			}
 		}
-	};
-	FlushOnDestroy s_flushOnDestroy;
+		writeText();
+	}
 }
@@ -1,86 +1,576 @@
 #pragma once
 
+#include "SpscRingBuffer.h"
 #include "Utils.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <stdio.h>
 
 namespace
 {
-	static const char* TRACELOG_FILENAME = "tracelog.txt";
+	static const char* TRACELOG_FILENAME = "tracelog.bin";
+	static const char* TRACELOG_TEXT_FILENAME = "tracelog.txt";
 }
 
+// The trace is binary: a fixed-size record per traced event, copied out of the emulator's state with no formatting, queued
+// in a lock-free ring and written to disk, delta-compressed, by a thread of its own.  Every frame starts with a keyframe, and
+// an index file beside the trace gives the offset of each, so Decode() can turn any run of frames into the text the analyzer
+// used to write directly, offline, without reading what comes before them.
 namespace TraceLog
 {
-	extern std::string s_traceLog;
-	extern bool s_enabled;
+	enum class RecordType : Uint8
+	{
+		Instruction, // about to execute the instruction at pc
+		Halt,
+		HaltResumed, // value is IF
+		Interrupt, // pc is the handler address
+		Frame, // VBlank: the next frame starts here
+		WatchpointRead, // pc is the address watched, value the value read
+		WatchpointWrite, // pc is the address watched, value the value written
+	};
 
-	inline void SetEnabled(bool enabled)
+	// Record::flags
+	enum RecordFlags
 	{
-		s_enabled = enabled;
-	}
+		kVBlankRequested = Bit0,
+		kInterruptsEnabled = Bit1,
+	};
+
+	struct Record
+	{
+		Uint64 cycle; // master clock
+		Uint32 instructionCount;
+		Uint16 pc;
+		Uint16 sp;
+		RecordType type;
+		Uint8 bank;
+		Uint8 opcode[3]; // the instruction's bytes, as far as it goes
+		Uint8 a, f, b, c, d, e, h, l;
+		Uint8 ly;
+		Uint8 flags;
+		Uint8 value;
+	};
+	static_assert(sizeof(Record) == 32, "Trace records are meant to be 32 bytes");
 
-	inline bool IsEnabled()
+	struct FileHeader
 	{
-		return s_enabled;
+		static const Uint32 kMagic = 0x52544247; // "GBTR" little-endian
+		static const Uint32 kVersion = 2;
+
+		Uint32 magic;
+		Uint32 version;
+		Uint32 recordSize;
+		char romName[52];
+	};
+	static_assert(sizeof(FileHeader) == 64, "Trace file headers are meant to be 64 bytes");
+
+	// The index file is this header, followed by the trace file offset of each frame's keyframe as a Uint64, so that finding a
+	// frame takes one seek however long the trace is.  Frame 0 starts with the trace, each one after it with a Frame record.
+	struct IndexHeader
+	{
+		static const Uint32 kMagic = 0x49544247; // "GBTI" little-endian
+		static const Uint32 kVersion = 1;
+
+		Uint32 magic;
+		Uint32 version;
+	};
+
+	inline std::string GetIndexFileName(const char* pTraceFileName)
+	{
+		return std::string(pTraceFileName) + ".idx";
 	}
 
-	inline void Flush()
+	// Stores records as deltas against the one before: a mask of the fields that differ from a prediction, then only those
+	// fields.  The prediction is the previous record, moved on by as many cycles and bytes of program counter as the same
+	// instruction took the last time it ran, with the instruction bytes last seen at the new address.  A typical instruction
+	// then costs two or three bytes rather than 32.  A keyframe is a whole record, and forgets everything learned before it,
+	// so that decoding can start there.
+	class DeltaCoder
 	{
-		FILE* pFile;
-		auto succeeded = false;
-		auto delay = 10;
-		for (auto i = 0; i < 10; ++i)
+	public:
+		// Enough for any encoded record, keyframe or delta
+		static const size_t kMaxEncodedSize = 48;
+
+		DeltaCoder()
+			: m_opcodeCache(0x10000)
+			, m_generation(0)
+			, m_hasPrevious(false)
+		{
+		}
+
+		void Encode(const Record& record, bool keyframe, std::vector<Uint8>& data)
+		{
+			// A clock that went backwards means the machine was reset; deltas are only ever forwards
+			if (keyframe || !m_hasPrevious || (record.cycle < m_previous.cycle))
+			{
+				data.push_back(Bit7);
+				data.push_back(Bit7);
+				data.push_back(static_cast<Uint8>(kKeyframe >> 16));
+				auto pRecord = reinterpret_cast<const Uint8*>(&record);
+				data.insert(data.end(), pRecord, pRecord + sizeof(record));
+				Restart(record);
+				return;
+			}
+
+			auto predicted = Predict();
+			Uint32 mask = 0;
+			mask |= (record.type != predicted.type) ? kType : 0u;
+			mask |= (record.bank != predicted.bank) ? kBank : 0u;
+			mask |= (record.pc != predicted.pc) ? kPc : 0u;
+			mask |= (record.instructionCount != predicted.instructionCount) ? kInstructionCount : 0u;
+			mask |= (record.cycle != predicted.cycle) ? kCycles : 0u;
+			mask |= (memcmp(record.opcode, GetPredictedOpcode(record.type, record.pc), sizeof(record.opcode)) != 0) ? kOpcode : 0u;
+			mask |= (record.sp != predicted.sp) ? kSp : 0u;
+			mask |= (record.a != predicted.a) ? kA : 0u;
+			mask |= (record.f != predicted.f) ? kF : 0u;
+			mask |= (record.b != predicted.b) ? kB : 0u;
+			mask |= (record.c != predicted.c) ? kC : 0u;
+			mask |= (record.d != predicted.d) ? kD : 0u;
+			mask |= (record.e != predicted.e) ? kE : 0u;
+			mask |= (record.h != predicted.h) ? kH : 0u;
+			mask |= (record.l != predicted.l) ? kL : 0u;
+			mask |= (record.ly != predicted.ly) ? kLy : 0u;
+			mask |= (record.flags != predicted.flags) ? kFlags : 0u;
+			mask |= (record.value != predicted.value) ? kValue : 0u;
+
+			// The mask is one byte for the fields that change most, and more only when needed
+			data.push_back(static_cast<Uint8>((mask & 0x7F) | ((mask > 0x7F) ? Bit7 : 0)));
+			if (mask > 0x7F)
+			{
+				data.push_back(static_cast<Uint8>(((mask >> 8) & 0x7F) | ((mask > 0x7FFF) ? Bit7 : 0)));
+				if (mask > 0x7FFF)
+				{
+					data.push_back(static_cast<Uint8>(mask >> 16));
+				}
+			}
+
+			// In the order Decode() needs them: the opcode's prediction depends on the type and pc
+			if (mask & kType) data.push_back(static_cast<Uint8>(record.type));
+			if (mask & kBank) data.push_back(record.bank);
+			if (mask & kPc) Write16(record.pc, data);
+			if (mask & kInstructionCount) WriteVarint(static_cast<Uint32>(record.instructionCount - m_previous.instructionCount), data);
+			if (mask & kCycles) WriteVarint(record.cycle - m_previous.cycle, data);
+			if (mask & kOpcode) data.insert(data.end(), record.opcode, record.opcode + sizeof(record.opcode));
+			if (mask & kSp) Write16(record.sp, data);
+			if (mask & kA) data.push_back(record.a);
+			if (mask & kF) data.push_back(record.f);
+			if (mask & kB) data.push_back(record.b);
+			if (mask & kC) data.push_back(record.c);
+			if (mask & kD) data.push_back(record.d);
+			if (mask & kE) data.push_back(record.e);
+			if (mask & kH) data.push_back(record.h);
+			if (mask & kL) data.push_back(record.l);
+			if (mask & kLy) data.push_back(record.ly);
+			if (mask & kFlags) data.push_back(record.flags);
+			if (mask & kValue) data.push_back(record.value);
+
+			Learn(record);
+		}
+
+		// Decodes the record at pData and moves past it; false, with pData left as it was, if the data ends before the record
+		// does or is not a valid record
+		bool Decode(const Uint8*& pData, const Uint8* pEnd, Record& record)
 		{
-			fopen_s(&pFile, TRACELOG_FILENAME, "a");
-			if (pFile)
+			auto p = pData;
+			bool valid = true;
+			auto read8 = [&]() -> Uint8
+			{
+				valid = valid && (p < pEnd);
+				return valid ? *p++ : 0;
+			};
+			auto read16 = [&]() -> Uint16
+			{
+				auto low = read8();
+				return Make16(read8(), low);
+			};
+			auto readVarint = [&]() -> Uint64
 			{
-				fwrite(s_traceLog.data(), s_traceLog.length(), 1, pFile);
-				fclose(pFile);
-				succeeded = true;
-				break;
+				Uint64 value = 0;
+				for (int shift = 0; valid && (shift < 64); shift += 7)
+				{
+					auto byte = read8();
+					value |= static_cast<Uint64>(byte & 0x7F) << shift;
+					if (!(byte & Bit7))
+					{
+						break;
+					}
+				}
+				return value;
+			};
+
+			Uint32 mask = read8();
+			if (mask & Bit7)
+			{
+				mask = (mask & 0x7F) | (read8() << 8);
+				if (mask & (Bit7 << 8))
+				{
+					mask = (mask & 0x7FFF) | (read8() << 16);
+				}
+			}
+			if (!valid || (mask & ~kAllFields) || (!(mask & kKeyframe) && !m_hasPrevious))
+			{
+				return false;
+			}
+
+			if (mask & kKeyframe)
+			{
+				if ((mask != kKeyframe) || (pEnd - p < static_cast<ptrdiff_t>(sizeof(record))))
+				{
+					return false;
+				}
+				memcpy(&record, p, sizeof(record));
+				pData = p + sizeof(record);
+				Restart(record);
+				return true;
+			}
+
+			auto predicted = Predict();
+			record = predicted;
+			if (mask & kType) record.type = static_cast<RecordType>(read8());
+			if (mask & kBank) record.bank = read8();
+			if (mask & kPc) record.pc = read16();
+			if (mask & kInstructionCount) record.instructionCount = m_previous.instructionCount + static_cast<Uint32>(readVarint());
+			if (mask & kCycles) record.cycle = m_previous.cycle + readVarint();
+			if (mask & kOpcode)
+			{
+				record.opcode[0] = read8();
+				record.opcode[1] = read8();
+				record.opcode[2] = read8();
 			}
 			else
 			{
-				SDL_Delay(delay);
-				delay = (delay * 4 / 3);
+				memcpy(record.opcode, GetPredictedOpcode(record.type, record.pc), sizeof(record.opcode));
 			}
+			if (mask & kSp) record.sp = read16();
+			if (mask & kA) record.a = read8();
+			if (mask & kF) record.f = read8();
+			if (mask & kB) record.b = read8();
+			if (mask & kC) record.c = read8();
+			if (mask & kD) record.d = read8();
+			if (mask & kE) record.e = read8();
+			if (mask & kH) record.h = read8();
+			if (mask & kL) record.l = read8();
+			if (mask & kLy) record.ly = read8();
+			if (mask & kFlags) record.flags = read8();
+			if (mask & kValue) record.value = read8();
+
+			if (!valid)
+			{
+				return false;
+			}
+			pData = p;
+			Learn(record);
+			return true;
 		}
-		
-		if (!succeeded)
+
+	private:
+		// Mask bits; bits 7 and 15 say whether another byte of mask follows
+		static const Uint32 kCycles = Bit0;
+		static const Uint32 kPc = Bit1;
+		static const Uint32 kA = Bit2;
+		static const Uint32 kF = Bit3;
+		static const Uint32 kH = Bit4;
+		static const Uint32 kL = Bit5;
+		static const Uint32 kLy = Bit6;
+
+		static const Uint32 kB = Bit0 << 8;
+		static const Uint32 kC = Bit1 << 8;
+		static const Uint32 kD = Bit2 << 8;
+		static const Uint32 kE = Bit3 << 8;
+		static const Uint32 kSp = Bit4 << 8;
+		static const Uint32 kOpcode = Bit5 << 8;
+		static const Uint32 kFlags = Bit6 << 8;
+
+		static const Uint32 kType = Bit0 << 16;
+		static const Uint32 kBank = Bit1 << 16;
+		static const Uint32 kValue = Bit2 << 16;
+		static const Uint32 kInstructionCount = Bit3 << 16;
+		static const Uint32 kKeyframe = Bit4 << 16;
+
+		static const Uint32 kAllFields = 0x1F7F7F;
+
+		// One per opcode, CB-prefixed ones included, and one per other record type
+		static const size_t kNumPredictionKeys = 512 + 8;
+
+		struct Prediction
+		{
+			Uint64 cycles;
+			Uint16 pcDelta;
+		};
+
+		struct CachedOpcode
 		{
-			throw Exception("Failed to flush trace log, will be missing instructions");
+			Uint32 generation; // valid if the current one
+			Uint8 bytes[3];
+		};
+
+		static size_t GetPredictionKey(const Record& record)
+		{
+			if (record.type != RecordType::Instruction)
+			{
+				return 512 + (static_cast<size_t>(record.type) & 7);
+			}
+			return (record.opcode[0] == 0xCB) ? 256 + record.opcode[1] : record.opcode[0];
 		}
-		s_traceLog.clear();
-	}
 
-	inline void Reset()
-	{
-		FILE* pFile;
-		fopen_s(&pFile, TRACELOG_FILENAME, "wb");
-		if (pFile)
+		// The next record as far as it can be told from the previous one: the instruction bytes are predicted separately, once
+		// the pc is known
+		Record Predict() const
 		{
-			fclose(pFile);
+			const auto& prediction = m_predictions[GetPredictionKey(m_previous)];
+			auto predicted = m_previous;
+			predicted.type = RecordType::Instruction;
+			predicted.pc = static_cast<Uint16>(m_previous.pc + prediction.pcDelta);
+			predicted.instructionCount = m_previous.instructionCount + 1;
+			predicted.cycle = m_previous.cycle + prediction.cycles;
+			predicted.value = 0;
+			return predicted;
 		}
-		else
+
+		const Uint8* GetPredictedOpcode(RecordType type, Uint16 pc) const
 		{
-			throw Exception("Can't reset log");
+			static const Uint8 none[3] = {};
+			const auto& cached = m_opcodeCache[pc];
+			return ((type == RecordType::Instruction) && (cached.generation == m_generation)) ? cached.bytes : none;
 		}
-	}
 
-	inline void Log(const std::string& message)
+		void Learn(const Record& record)
+		{
+			auto& prediction = m_predictions[GetPredictionKey(m_previous)];
+			prediction.cycles = record.cycle - m_previous.cycle;
+			prediction.pcDelta = static_cast<Uint16>(record.pc - m_previous.pc);
+
+			if (record.type == RecordType::Instruction)
+			{
+				auto& cached = m_opcodeCache[record.pc];
+				cached.generation = m_generation;
+				memcpy(cached.bytes, record.opcode, sizeof(cached.bytes));
+			}
+			m_previous = record;
+		}
+
+		void Restart(const Record& keyframe)
+		{
+			// The opcode cache is too big to clear every frame; entries from before are told apart by their generation
+			++m_generation;
+			memset(m_predictions, 0, sizeof(m_predictions));
+			m_hasPrevious = true;
+			m_previous = keyframe;
+			Learn(keyframe);
+		}
+
+		static void Write16(Uint16 value, std::vector<Uint8>& data)
+		{
+			data.push_back(static_cast<Uint8>(value));
+			data.push_back(static_cast<Uint8>(value >> 8));
+		}
+
+		static void WriteVarint(Uint64 value, std::vector<Uint8>& data)
+		{
+			while (value > 0x7F)
+			{
+				data.push_back(static_cast<Uint8>(value | Bit7));
+				value >>= 7;
+			}
+			data.push_back(static_cast<Uint8>(value));
+		}
+
+		Record m_previous;
+		Prediction m_predictions[kNumPredictionKeys];
+		std::vector<CachedOpcode> m_opcodeCache; // by pc
+		Uint32 m_generation;
+		bool m_hasPrevious;
+	};
+
+	// Writes records to a trace file and its index from a background thread, which also does the encoding.  Write() is for
+	// one thread only (the emulation thread); it gathers records into small batches before queueing them, and only waits if
+	// the writer has fallen a whole ring behind, so that nothing is ever dropped.
+	class Writer
 	{
-		if (!s_enabled)
+	public:
+		Writer(const char* pFileName, const char* pRomName)
+			: m_ring(kRingCapacity)
+			, m_numPending(0)
+			, m_stopRequested(false)
+			, m_flushRequested(false)
+			, m_writeFailed(false)
+		{
+			if ((fopen_s(&m_pFile, pFileName, "wb") != 0) || !m_pFile)
+			{
+				throw Exception("Can't open trace file %s", pFileName);
+			}
+			auto indexFileName = GetIndexFileName(pFileName);
+			if ((fopen_s(&m_pIndexFile, indexFileName.c_str(), "wb") != 0) || !m_pIndexFile)
+			{
+				fclose(m_pFile);
+				throw Exception("Can't open trace index file %s", indexFileName.c_str());
+			}
+
+			FileHeader header = {};
+			header.magic = FileHeader::kMagic;
+			header.version = FileHeader::kVersion;
+			header.recordSize = sizeof(Record);
+			strncpy_s(header.romName, pRomName, _TRUNCATE);
+			IndexHeader indexHeader = {};
+			indexHeader.magic = IndexHeader::kMagic;
+			indexHeader.version = IndexHeader::kVersion;
+			m_fileOffset = sizeof(header);
+			if ((fwrite(&header, sizeof(header), 1, m_pFile) != 1) || (fwrite(&indexHeader, sizeof(indexHeader), 1, m_pIndexFile) != 1)
+				|| (fwrite(&m_fileOffset, sizeof(m_fileOffset), 1, m_pIndexFile) != 1))
+			{
+				fclose(m_pFile);
+				fclose(m_pIndexFile);
+				throw Exception("Can't write trace file %s", pFileName);
+			}
+
+			m_thread = std::thread([this]() { ThreadMain(); });
+		}
+
+		~Writer()
+		{
+			QueuePending();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stopRequested = true;
+			}
+			m_wakeUp.notify_one();
+			m_thread.join();
+			fclose(m_pFile);
+			fclose(m_pIndexFile);
+		}
+
+		void Write(const Record& record)
 		{
-			return;
+			m_pending[m_numPending++] = record;
+			if (m_numPending == kBatchSize)
+			{
+				QueuePending();
+			}
 		}
 
-		s_traceLog += message;
+		// Waits for everything written so far to reach the file
+		void Flush()
+		{
+			QueuePending();
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_flushRequested = true;
+			m_wakeUp.notify_one();
+			m_flushed.wait(lock, [this]() { return !m_flushRequested; });
 
-		static int const DUMP_BUFFER_SIZE = 1000000;
-		if (s_traceLog.length() > DUMP_BUFFER_SIZE)
+			if (m_writeFailed)
+			{
+				throw Exception("Failed to write trace, it will be missing records");
+			}
+		}
+
+	private:
+		static const size_t kBatchSize = 256;
+		static const size_t kRingCapacity = 1 << 18; // 8MB
+
+		void QueuePending()
 		{
-			Flush();
+			const Record* pRecords = m_pending;
+			while (m_numPending > 0)
+			{
+				auto numWritten = m_ring.Write(pRecords, m_numPending);
+				pRecords += numWritten;
+				m_numPending -= numWritten;
+				if (m_numPending > 0)
+				{
+					m_wakeUp.notify_one();
+					std::this_thread::yield();
+				}
+			}
 		}
-	}
-}
\ No newline at end of file
+
+		void ThreadMain()
+		{
+			// Only woken early to flush or stop; otherwise the ring is emptied every millisecond, which is far more often than
+			// it can fill
+			static const auto pollInterval = std::chrono::milliseconds(1);
+
+			std::vector<Record> records(kRingCapacity / 16);
+			std::vector<Uint8> data;
+			std::vector<Uint64> frameOffsets;
+			for (;;)
+			{
+				bool flushRequested, stopRequested;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wakeUp.wait_for(lock, pollInterval, [this]() { return m_stopRequested || m_flushRequested; });
+					flushRequested = m_flushRequested;
+					stopRequested = m_stopRequested;
+				}
+
+				// Anything queued before a flush or stop was requested is in the ring by now
+				for (;;)
+				{
+					auto numRecords = m_ring.Read(records.data(), records.size());
+					if (numRecords == 0)
+					{
+						break;
+					}
+
+					data.clear();
+					frameOffsets.clear();
+					for (size_t i = 0; i < numRecords; ++i)
+					{
+						bool frameStart = (records[i].type == RecordType::Frame);
+						if (frameStart)
+						{
+							frameOffsets.push_back(m_fileOffset + data.size());
+						}
+						m_coder.Encode(records[i], frameStart, data);
+					}
+
+					if ((fwrite(data.data(), data.size(), 1, m_pFile) != 1)
+						|| (!frameOffsets.empty() && (fwrite(frameOffsets.data(), sizeof(Uint64), frameOffsets.size(), m_pIndexFile) != frameOffsets.size())))
+					{
+						m_writeFailed = true;
+					}
+					m_fileOffset += data.size();
+				}
+
+				if (flushRequested)
+				{
+					fflush(m_pFile);
+					fflush(m_pIndexFile);
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_flushRequested = false;
+					m_flushed.notify_all();
+				}
+
+				if (stopRequested)
+				{
+					break;
+				}
+			}
+		}
+
+		FILE* m_pFile;
+		FILE* m_pIndexFile;
+		Uint64 m_fileOffset; // writer thread only, from here on
+		DeltaCoder m_coder;
+		SpscRingBuffer<Record> m_ring;
+		Record m_pending[kBatchSize]; // emulation thread only
+		size_t m_numPending;
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_wakeUp;
+		std::condition_variable m_flushed;
+		bool m_stopRequested;
+		bool m_flushRequested;
+		std::atomic<bool> m_writeFailed;
+	};
+
+	static const Uint32 kAllFrames = ~0u;
+
+	// Writes a trace file out as text, one line per record, from the given frame on, found through the index
+	void Decode(const char* pTraceFileName, const char* pTextFileName, Uint32 firstFrame = 0, Uint32 numFrames = kAllFrames);
+}
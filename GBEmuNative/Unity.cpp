@@ -1,6 +1,9 @@
 #include "Analyzer.cpp"
 #include "Emulator.cpp"
 #include "GameBoy.cpp"
+#include "GuestProfile.cpp"
 #include "MemoryBus.cpp"
+#include "RomCoverage.cpp"
+#include "SamplingProfiler.cpp"
 #include "TraceLog.cpp"
 #include "Utils.cpp"
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <stdio.h>
+
+// Streams 16-bit PCM into a RIFF WAVE file.  Samples are gathered in a large buffer and written out in big blocks, so that
+// rendering faster than real time isn't held up by lots of small writes.  The header is written up front with empty sizes,
+// which are patched in by Close() once the length is known.
+class WavWriter
+{
+public:
+	static const size_t kBufferNumMonoSamples = 1 << 20; // 2MB
+
+	WavWriter(const char* pFileName, int frequency, int numChannels)
+		: m_pFile(nullptr)
+		, m_frequency(frequency)
+		, m_numChannels(numChannels)
+		, m_numDataBytes(0)
+	{
+		m_buffer.reserve(kBufferNumMonoSamples);
+
+		if ((fopen_s(&m_pFile, pFileName, "wb") != 0) || !m_pFile)
+		{
+			throw Exception("Couldn't open WAV file for writing: %s", pFileName);
+		}
+
+		if (!WriteHeader())
+		{
+			fclose(m_pFile);
+			throw Exception("Couldn't write to WAV file: %s", pFileName);
+		}
+	}
+
+	~WavWriter()
+	{
+		// Errors can't be reported from here; call Close() to find out about them
+		if (m_pFile)
+		{
+			Finish();
+		}
+	}
+
+	// Interleaved samples, numChannels per frame
+	void Write(const Sint16* pSamples, size_t numMonoSamples)
+	{
+		SDL_assert(m_pFile);
+
+		while (numMonoSamples > 0)
+		{
+			size_t count = SDL_min(numMonoSamples, kBufferNumMonoSamples - m_buffer.size());
+			m_buffer.insert(m_buffer.end(), pSamples, pSamples + count);
+			pSamples += count;
+			numMonoSamples -= count;
+
+			if ((m_buffer.size() == kBufferNumMonoSamples) && !WriteBuffer())
+			{
+				throw Exception("Couldn't write to WAV file");
+			}
+		}
+	}
+
+	void Close()
+	{
+		if (m_pFile && !Finish())
+		{
+			throw Exception("Couldn't finish writing WAV file");
+		}
+	}
+
+	// Sample frames written so far, including any still buffered
+	Uint32 GetNumFrames() const
+	{
+		return static_cast<Uint32>((m_numDataBytes / sizeof(Sint16) + m_buffer.size()) / m_numChannels);
+	}
+
+private:
+	static const Uint32 kHeaderSize = 44;
+
+	bool WriteBuffer()
+	{
+		// RIFF sizes are 32-bit
+		Uint64 numBytes = m_buffer.size() * sizeof(Sint16);
+		if (m_numDataBytes + numBytes > 0xFFFFFFFF - kHeaderSize)
+		{
+			return false;
+		}
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+		for (auto& sample : m_buffer)
+		{
+			sample = static_cast<Sint16>(SDL_SwapLE16(static_cast<Uint16>(sample)));
+		}
+#endif
+
+		if (fwrite(m_buffer.data(), sizeof(Sint16), m_buffer.size(), m_pFile) != m_buffer.size())
+		{
+			return false;
+		}
+
+		m_numDataBytes += static_cast<Uint32>(numBytes);
+		m_buffer.clear();
+		return true;
+	}
+
+	bool WriteHeader()
+	{
+		Uint32 blockAlign = m_numChannels * sizeof(Sint16);
+
+		Uint8 header[kHeaderSize];
+		Uint8* pOut = header;
+		auto put32 = [&pOut](Uint32 value) { for (int i = 0; i < 4; ++i) { *pOut++ = static_cast<Uint8>(value >> (i * 8)); } };
+		auto put16 = [&pOut](Uint16 value) { for (int i = 0; i < 2; ++i) { *pOut++ = static_cast<Uint8>(value >> (i * 8)); } };
+		auto putTag = [&pOut](const char* pTag) { memcpy(pOut, pTag, 4); pOut += 4; };
+
+		putTag("RIFF");
+		put32(kHeaderSize - 8 + m_numDataBytes);
+		putTag("WAVE");
+		putTag("fmt ");
+		put32(16);
+		put16(1); // PCM
+		put16(static_cast<Uint16>(m_numChannels));
+		put32(m_frequency);
+		put32(m_frequency * blockAlign);
+		put16(static_cast<Uint16>(blockAlign));
+		put16(16);
+		putTag("data");
+		put32(m_numDataBytes);
+		SDL_assert(pOut == header + kHeaderSize);
+
+		return fwrite(header, sizeof(header), 1, m_pFile) == 1;
+	}
+
+	// Writes out the buffer and the final sizes and closes the file, returning whether all of that worked
+	bool Finish()
+	{
+		bool succeeded = WriteBuffer() && (fseek(m_pFile, 0, SEEK_SET) == 0) && WriteHeader();
+		succeeded = (fclose(m_pFile) == 0) && succeeded;
+		m_pFile = nullptr;
+		return succeeded;
+	}
+
+	FILE* m_pFile;
+	int m_frequency;
+	int m_numChannels;
+	Uint32 m_numDataBytes;
+	std::vector<Sint16> m_buffer;
+};